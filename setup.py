@@ -7,15 +7,20 @@ if not version[0] == '3':
 from distutils.core import setup, Extension
 
 unrtf_c_sources = list(map(lambda f: 'unrtf_ext/src/{}'.format(f), [
+   'arena.cpp',
    'attr.cpp',
+   'context.cpp',
    'convert.cpp',
    'error.cpp',
    'hash.cpp',
+   'keywords.cpp',
    'malloc.cpp',
    'my_iconv.cpp',
+   'outbuf.cpp',
    'output.cpp',
    'parse.cpp',
    'path.cpp',
+   'scan.cpp',
    'unicode.cpp',
    'user.cpp',
    'util.cpp',
@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+#-*- coding: utf-8 -*-
+
+"""Run from the top of the tree after building the extension:
+
+    python3 -m unittest discover tests
+"""
+
+import html
+import unittest
+
+import unrtf
+
+
+def converted_text(rtf_data, streaming):
+    # The output is UTF-8 with utf8_output personalities and &#N;
+    # references otherwise; either way it must decode
+    return html.unescape(unrtf.convert(rtf_data, streaming=streaming).decode('utf-8'))
+
+
+class SurrogateTest(unittest.TestCase):
+
+    def test_pair(self):
+        # U+1F600 as the UTF-16 pair D83D DE00, with fallbacks
+        rtf_data = b'{\\rtf1\\ansi a\\u-10179?\\u-8704?b}'
+        for streaming in (False, True):
+            text = converted_text(rtf_data, streaming)
+            self.assertIn('a\U0001F600b', text)
+
+    def test_pair_across_lines(self):
+        rtf_data = b'{\\rtf1\\ansi\\uc2 a\\u-10179??\r\n\\u-8704??b}'
+        for streaming in (False, True):
+            text = converted_text(rtf_data, streaming)
+            self.assertIn('a\U0001F600b', text)
+
+    def test_lone_surrogates(self):
+        rtf_data = b'{\\rtf1\\ansi a\\u55357?c\\u-8704?b\\u-10179?}'
+        for streaming in (False, True):
+            text = converted_text(rtf_data, streaming)
+            self.assertIn('a�c�b�', text)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -1,31 +1,57 @@
 #!/usr/bin/env python3
 #-*- coding: utf-8 -*-
 
-import os
-import sys
-from contextlib import contextmanager
 import _unrtf
 
-@contextmanager
-def stdoutRedirected(to=os.devnull):
-    fd = sys.stdout.fileno()
+Error = _unrtf.Error
 
-    def _redirect_stdout(to):
-        sys.stdout.close()
-        os.dup2(to.fileno(), fd)
-        sys.stdout = os.fdopen(fd, 'w')
+def _is_blank(rtf_data):
+    if isinstance(rtf_data, (str, bytes, bytearray)):
+        return not rtf_data.strip()
+    return False
 
-    with os.fdopen(os.dup(fd), 'w') as old_stdout:
-        with open(to, 'w') as file:
-            _redirect_stdout(to=file)
-        try:
-            yield
-        finally:
-            _redirect_stdout(to=old_stdout)
+def convert(rtf_data, no_pict_mode=True, streaming=False, drop=None):
+    """Converts RTF data and returns the rendered output as bytes. The data
+    may be str or any bytes-like object (bytes, bytearray, memoryview,
+    mmap); bytes-like data is parsed in place, without a copy. With
+    streaming=True the document is rendered while it is parsed, so memory
+    use does not grow with the document size. drop names destinations to
+    leave out: 'header', 'footer', 'footnote', 'annotation', 'xe' (index
+    entries) and 'tc' (table of contents entries); ValueError is raised
+    for other names."""
+    assert rtf_data is not None
+    if _is_blank(rtf_data):
+        return b''
+    return _unrtf.convert(rtf_data, no_pict_mode, streaming, drop)
+
+def convert_stream(rtf_data, callback, chunk_size=65536, no_pict_mode=True,
+                   streaming=False, drop=None):
+    """Converts RTF data and passes the output to callback in bytes chunks
+    of about chunk_size, while the document is being rendered, so the
+    output never has to be held as a whole. An exception raised by the
+    callback ends the conversion and propagates."""
+    assert rtf_data is not None
+    if _is_blank(rtf_data):
+        return
+    _unrtf.convert_stream(rtf_data, callback, chunk_size, no_pict_mode, streaming,
+                          drop)
+
+def convert_many(rtf_docs, threads=0, no_pict_mode=True, streaming=False,
+                 drop=None):
+    """Converts many RTF documents on a native thread pool (threads=0: one
+    per core). Returns a list with one (output bytes, error) tuple per
+    document; error is None on success, output is None on failure."""
+    return _unrtf.convert_many(list(rtf_docs), threads, no_pict_mode, streaming,
+                               drop)
+
+def hash_stats():
+    """Returns counters of the per-conversion string tables, summed over
+    every conversion finished in this process."""
+    return _unrtf.hash_stats()
 
 def unrtf(rtf_data, output_file, no_pict_mode=True):
     assert rtf_data is not None
-    if rtf_data.strip() == '':
+    if _is_blank(rtf_data):
         return ''
-    with stdoutRedirected(to=output_file):
-        _unrtf.unrtf(rtf_data, no_pict_mode)
+    with open(output_file, 'wb') as f:
+        f.write(convert(rtf_data, no_pict_mode))
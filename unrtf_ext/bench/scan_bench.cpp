@@ -0,0 +1,180 @@
+/* Micro-benchmark of the plain text scanner (src/scan.cpp).
+ *
+ * Not built by setup.py. From this directory:
+ *
+ *   g++ -O2 -I../src -DPACKAGE_VERSION='"1"' \
+ *       -DPKGDATADIR='"/usr/local/share/python-unrtf/"' -o scan_bench \
+ *       scan_bench.cpp $(ls ../src/*.cpp | grep -v pylib) -lpthread
+ *   ./scan_bench [file.rtf] [megabytes]
+ *
+ * The input (samples/sample.rtf by default) is repeated up to the given
+ * size. Each kernel walks the whole buffer from special byte to special
+ * byte, which is what read_word() does; "bytewise" is the per-character
+ * loop read_word() used before the kernels. The group skipping kernels
+ * (scan_group*) are timed the same way. The best of 10 rounds is kept. Then the full tokenizer
+ * (word_read) is timed with the kernel chosen at run time.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "context.h"
+#include "parse.h"
+#include "scan.h"
+
+typedef const char *(*Kernel)(const char *, const char *);
+typedef const char *(*GroupKernel)(const char *, const char *, unsigned long *);
+
+static const char *
+scan_text_bytewise(const char *p, const char *end)
+{
+    while (p < end)
+    {
+        switch (*p)
+        {
+        case '\\':
+        case '{':
+        case '}':
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            return p;
+        }
+        p++;
+    }
+    return p;
+}
+
+static double
+seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+typedef struct
+{
+    const char *name;
+    Kernel kernel;
+    GroupKernel group_kernel;
+    double best;
+    size_t count;   /* runs, or lines for the group kernels */
+} Bench;
+
+static double
+time_kernel(Bench *b, const std::string &doc)
+{
+    const char *end = doc.data() + doc.size();
+    const char *p = doc.data();
+    unsigned long lines = 0;
+    size_t runs = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    while (p < end)
+    {
+        p = b->kernel ? b->kernel(p, end) : b->group_kernel(p, end, &lines);
+        runs++;
+        if (p < end)
+        {
+            p++;
+        }
+    }
+    double s = seconds_since(start);
+    b->count = b->kernel ? runs : lines;
+    return s;
+}
+
+/* The kernels take turns, round after round, so that none of them is
+ * always timed right after the AVX2 loop */
+static void
+bench_kernels(Bench *benches, int n, const std::string &doc, int rounds)
+{
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            double s = time_kernel(&benches[i], doc);
+            if (r == 0 || s < benches[i].best)
+            {
+                benches[i].best = s;
+            }
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        printf("%-10s %8.1f MB/s  (%zu %s)\n", benches[i].name, doc.size() / benches[i].best / 1e6,
+               benches[i].count, benches[i].kernel ? "runs" : "lines");
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "../../samples/sample.rtf";
+    size_t megabytes = argc > 2 ? atoi(argv[2]) : 64;
+    std::string sample, doc;
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return 1;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+        sample.append(buf, n);
+    }
+    fclose(f);
+    if (sample.empty())
+    {
+        fprintf(stderr, "%s is empty\n", path);
+        return 1;
+    }
+
+    while (doc.size() < megabytes * 1024 * 1024)
+    {
+        doc += sample;
+    }
+    printf("%s x %zu: %zu bytes\n\n", path, doc.size() / sample.size(), doc.size());
+
+    Bench text[5] = {};
+    int kernels = 0;
+    text[kernels++] = { "bytewise", scan_text_bytewise };
+    text[kernels++] = { "scalar", scan_text_scalar };
+#ifdef SCAN_HAVE_X86
+    text[kernels++] = { "sse2", scan_text_sse2 };
+    if (scan_have_avx2())
+    {
+        text[kernels++] = { "avx2", scan_text_avx2 };
+    }
+#endif
+    text[kernels++] = { "scan_text", scan_text };
+    bench_kernels(text, kernels, doc, 10);
+    printf("(scan_text uses %s past its first bytes)\n\n", scan_text_kernel_name());
+
+    Bench group[4] = {};
+    kernels = 0;
+    group[kernels++] = { "g-scalar", NULL, scan_group_scalar };
+#ifdef SCAN_HAVE_X86
+    group[kernels++] = { "g-sse2", NULL, scan_group_sse2 };
+    if (scan_have_avx2())
+    {
+        group[kernels++] = { "g-avx2", NULL, scan_group_avx2 };
+    }
+#endif
+    group[kernels++] = { "scan_group", NULL, scan_group };
+    bench_kernels(group, kernels, doc, 10);
+    printf("\n");
+
+    UnrtfContext *ctx = context_create(NULL, 1);
+    auto start = std::chrono::steady_clock::now();
+    Word *w = word_read(ctx, doc.data(), doc.size());
+    double s = seconds_since(start);
+    printf("word_read  %8.1f MB/s  (%s)\n", doc.size() / s / 1e6, w ? "ok" : "empty");
+    context_free(ctx);
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "error.h"
+#include "malloc.h"
+#include "arena.h"
+
+/* Blocks start at this size and double up to ARENA_MAX_BLOCK; a larger
+ * request gets a block of its own */
+#define ARENA_MIN_BLOCK (16 * 1024)
+#define ARENA_MAX_BLOCK (1024 * 1024)
+#define ARENA_ALIGN (sizeof(void *) > sizeof(double) ? sizeof(void *) : sizeof(double))
+
+struct _arena_block
+{
+    struct _arena_block *next;
+    size_t size;
+    /* data follows, aligned to ARENA_ALIGN */
+};
+
+#define BLOCK_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define BLOCK_DATA(b) ((char *) (b) + BLOCK_HEADER)
+
+/*========================================================================
+ * Name:    arena_grow
+ * Purpose:    Starts a new block holding at least n bytes.
+ * Args:    Arena, byte count.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+arena_grow(Arena *a, size_t n)
+{
+    size_t size = a->head ? a->head->size * 2 : ARENA_MIN_BLOCK;
+    ArenaBlock *b;
+
+    if (size > ARENA_MAX_BLOCK)
+    {
+        size = ARENA_MAX_BLOCK;
+    }
+    if (size < n)
+    {
+        size = n;
+    }
+    b = (ArenaBlock *) my_malloc(BLOCK_HEADER + size);
+    if (!b)
+    {
+        error_handler("out of memory");
+    }
+    b->size = size;
+    b->next = a->head;
+    a->head = b;
+    a->used = 0;
+}
+
+/*========================================================================
+ * Name:    arena_alloc
+ * Purpose:    Takes n bytes from the arena. The memory is not cleared.
+ * Args:    Arena, byte count.
+ * Returns:    Pointer aligned for any scalar type.
+ *=======================================================================*/
+
+void *
+arena_alloc(Arena *a, size_t n)
+{
+    void *p;
+
+    n = (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (!a->head || a->head->size - a->used < n)
+    {
+        arena_grow(a, n);
+    }
+    p = BLOCK_DATA(a->head) + a->used;
+    a->used += n;
+    return p;
+}
+
+/*========================================================================
+ * Name:    arena_strdup
+ * Purpose:    Copies len bytes of a string into the arena.
+ * Args:    Arena, string, length.
+ * Returns:    0-terminated copy.
+ *=======================================================================*/
+
+char *
+arena_strdup(Arena *a, const char *s, size_t len)
+{
+    char *copy = (char *) arena_alloc(a, len + 1);
+
+    memcpy(copy, s, len);
+    copy[len] = 0;
+    return copy;
+}
+
+/*========================================================================
+ * Name:    arena_mark
+ * Purpose:    Records the current end of the arena.
+ * Args:    Arena.
+ * Returns:    Mark for arena_release().
+ *=======================================================================*/
+
+ArenaMark
+arena_mark(Arena *a)
+{
+    ArenaMark m;
+
+    m.block = a->head;
+    m.used = a->used;
+    return m;
+}
+
+/*========================================================================
+ * Name:    arena_release
+ * Purpose:    Gives back everything allocated since a mark. Blocks
+ *             started after the mark are freed.
+ * Args:    Arena, mark.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+arena_release(Arena *a, ArenaMark m)
+{
+    ArenaBlock *next;
+
+    while (a->head != m.block)
+    {
+        next = a->head->next;
+        my_free((char *) a->head);
+        a->head = next;
+    }
+    a->used = m.used;
+}
+
+/*========================================================================
+ * Name:    arena_reset
+ * Purpose:    Gives back everything allocated, keeping the oldest block
+ *             for the next conversion.
+ * Args:    Arena.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+arena_reset(Arena *a)
+{
+    ArenaBlock *next;
+
+    while (a->head && a->head->next)
+    {
+        next = a->head->next;
+        my_free((char *) a->head);
+        a->head = next;
+    }
+    a->used = 0;
+}
+
+/*========================================================================
+ * Name:    arena_free
+ * Purpose:    Releases all the storage of an arena.
+ * Args:    Arena.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+arena_free(Arena *a)
+{
+    ArenaMark none = {NULL, 0};
+
+    arena_release(a, none);
+}
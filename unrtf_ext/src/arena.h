@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Bump allocator for the storage of one conversion (Word nodes, interned
+ * strings). Allocations are never freed one by one: the whole arena is
+ * reset when the conversion is over, or rolled back to a mark.
+ */
+
+typedef struct _arena_block ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock *head;       /* block being filled, newest first */
+    size_t used;            /* bytes taken in head */
+} Arena;
+
+/* Position in an arena, to roll back to with arena_release() */
+typedef struct
+{
+    ArenaBlock *block;
+    size_t used;
+} ArenaMark;
+
+#define ARENA_CLEAR {NULL, 0}
+
+extern void *arena_alloc(Arena *, size_t);
+extern char *arena_strdup(Arena *, const char *, size_t);
+extern ArenaMark arena_mark(Arena *);
+extern void arena_release(Arena *, ArenaMark);
+extern void arena_reset(Arena *);
+extern void arena_free(Arena *);
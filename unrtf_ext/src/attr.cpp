@@ -37,12 +37,12 @@
 #include "error.h"
 #include "attr.h"
 #include "main.h"
+#include "outbuf.h"
+#include "context.h"
 
-extern void starting_body();
-extern void starting_text();
+extern void starting_body(UnrtfContext *ctx);
+extern void starting_text(UnrtfContext *ctx);
 
-extern int simulate_allcaps;
-extern int simulate_smallcaps;
 
 
 #define MAX_ATTRS 100
@@ -63,11 +63,10 @@ typedef struct _stack
     struct _stack *prev;
 } AttrStack;
 
-/*@null@*/ static AttrStack *stack_of_stacks = NULL;
-/*@null@*/ static AttrStack *stack_of_stacks_top = NULL;
+/* The stack of stacks itself is ctx->stack_of_stacks(_top). */
 
-static void attr_express_begin(int attr, char *param);
-static void attr_express_end(int attr, char *param);
+static void attr_express_begin(UnrtfContext *ctx, int attr, char *param);
+static void attr_express_end(UnrtfContext *ctx, int attr, char *param);
 
 
 /* Iterate from top of given stack looking for findattr */
@@ -83,9 +82,9 @@ static int attr_find(AttrStack *stack, int findattr)
 }
 
 /* Iterate all stacks looking for most recent value for attr */
-static int attrstack_find_attr(int findattr, char **paramp)
+static int attrstack_find_attr(UnrtfContext *ctx, int findattr, char **paramp)
 {
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
 
     while (stack)
     {
@@ -102,13 +101,13 @@ static int attrstack_find_attr(int findattr, char **paramp)
 
 /* Remove attribute at the given index, unexpressing and reexpressing
    the ones above in appropriate order. */
-static void attr_pull_out(AttrStack *stack, int index)
+static void attr_pull_out(UnrtfContext *ctx, AttrStack *stack, int index)
 {
     int j;
     /* Unexpress all newer attributes, and the one we'll remove */
     for (j = stack->tos; j >= index; j--)
     {
-        attr_express_end(stack->attr_stack[j], stack->attr_stack_params[j]);
+        attr_express_end(ctx, stack->attr_stack[j], stack->attr_stack_params[j]);
     }
 
     /* Delete target attribute and shift the stack down */
@@ -124,19 +123,19 @@ static void attr_pull_out(AttrStack *stack, int index)
     /* Re-express unexpressed attributes */
     for (j = index; j <= stack->tos; j++) 
     {
-        attr_express_begin(stack->attr_stack[j], stack->attr_stack_params[j]);
+        attr_express_begin(ctx, stack->attr_stack[j], stack->attr_stack_params[j]);
     }
     return;
 }
 
 /* Unexpress and remove top attr. Internal version, no checking of args */
-static void attr_pop_internal(AttrStack *stack, int attr)
+static void attr_pop_internal(UnrtfContext *ctx, AttrStack *stack, int attr)
 {
     if (stack->tos >= 0)
     {
         char *param = stack->attr_stack_params[stack->tos];
 
-        attr_express_end(attr, param);
+        attr_express_end(ctx, attr, param);
 
         if (param)
         {
@@ -151,22 +150,22 @@ static void attr_pop_internal(AttrStack *stack, int attr)
 /*========================================================================
  * Name:    attr_express_begin
  * Purpose:    Print the HTML for beginning an attribute.
- * Args:    Attribute number, optional string parameter.
+ * Args:    Conversion context, attribute number, optional string parameter.
  * Returns:    None.
  *=======================================================================*/
 
-static void attr_express_begin(int attr, char *param)
+static void attr_express_begin(UnrtfContext *ctx, int attr, char *param)
 {
     switch (attr)
     {
     case ATTR_BOLD:
-        if (safe_printf(0, op->bold_begin))
+        if (safe_printf(ctx, 0, op->bold_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "bold_begin");
         };
         break;
     case ATTR_ITALIC:
-        if (safe_printf(0, op->italic_begin))
+        if (safe_printf(ctx, 0, op->italic_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "italic_begin");
         };
@@ -181,32 +180,32 @@ static void attr_express_begin(int attr, char *param)
     case ATTR_2DOT_DASH_UL:
     case ATTR_WORD_UL:
     case ATTR_UNDERLINE:
-        if (safe_printf(0, op->underline_begin))
+        if (safe_printf(ctx, 0, op->underline_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "underline_begin");
         };
         break;
 
     case ATTR_DOUBLE_UL:
-        if (safe_printf(0, op->dbl_underline_begin))
+        if (safe_printf(ctx, 0, op->dbl_underline_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "dbl_underline_begin");
         };
         break;
 
     case ATTR_FONTSIZE:
-        op_begin_std_fontsize(op, atoi(param));
+        op_begin_std_fontsize(ctx, op, atoi(param));
         break;
 
     case ATTR_FONTFACE:
-        if (safe_printf(1, op->font_begin, param))
+        if (safe_printf(ctx, 1, op->font_begin, param))
         {
             fprintf(stderr, TOO_MANY_ARGS, "font_begin");
         };
         break;
 
     case ATTR_FOREGROUND:
-        if (safe_printf(1, op->foreground_begin, param))
+        if (safe_printf(ctx, 1, op->foreground_begin, param))
         {
             fprintf(stderr, TOO_MANY_ARGS, "foreground_begin");
         };
@@ -214,66 +213,66 @@ static void attr_express_begin(int attr, char *param)
 
     case ATTR_BACKGROUND:
         if (!simple_mode)
-            if (safe_printf(1, op->background_begin, param))
+            if (safe_printf(ctx, 1, op->background_begin, param))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "background_begin");
             };
         break;
 
     case ATTR_SUPER:
-        if (safe_printf(0, op->superscript_begin))
+        if (safe_printf(ctx, 0, op->superscript_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "superscript_begin");
         };
         break;
     case ATTR_SUB:
-        if (safe_printf(0, op->subscript_begin))
+        if (safe_printf(ctx, 0, op->subscript_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "subscript_begin");
         };
         break;
 
     case ATTR_STRIKE:
-        if (safe_printf(0, op->strikethru_begin))
+        if (safe_printf(ctx, 0, op->strikethru_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "strikethru_begin");
         };
         break;
 
     case ATTR_DBL_STRIKE:
-        if (safe_printf(0, op->dbl_strikethru_begin))
+        if (safe_printf(ctx, 0, op->dbl_strikethru_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "dbl_strikethru_begin");
         };
         break;
 
     case ATTR_EXPAND:
-        if (safe_printf(1, op->expand_begin, param))
+        if (safe_printf(ctx, 1, op->expand_begin, param))
         {
             fprintf(stderr, TOO_MANY_ARGS, "expand_begin");
         };
         break;
 
     case ATTR_OUTLINE:
-        if (safe_printf(0, op->outline_begin))
+        if (safe_printf(ctx, 0, op->outline_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "outline_begin");
         };
         break;
     case ATTR_SHADOW:
-        if (safe_printf(0, op->shadow_begin))
+        if (safe_printf(ctx, 0, op->shadow_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "shadow_begin");
         };
         break;
     case ATTR_EMBOSS:
-        if (safe_printf(0, op->emboss_begin))
+        if (safe_printf(ctx, 0, op->emboss_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "emboss_begin");
         };
         break;
     case ATTR_ENGRAVE:
-        if (safe_printf(0, op->engrave_begin))
+        if (safe_printf(ctx, 0, op->engrave_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "engrave_begin");
         };
@@ -282,12 +281,12 @@ static void attr_express_begin(int attr, char *param)
     case ATTR_CAPS:
         if (op->simulate_all_caps)
         {
-            simulate_allcaps = TRUE;
+            ctx->simulate_allcaps = TRUE;
         }
         else
         {
             if (op->all_caps_begin)
-                if (safe_printf(0, op->all_caps_begin))
+                if (safe_printf(ctx, 0, op->all_caps_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "all_caps_begin");
                 }
@@ -297,12 +296,12 @@ static void attr_express_begin(int attr, char *param)
     case ATTR_SMALLCAPS:
         if (op->simulate_small_caps)
         {
-            simulate_smallcaps = TRUE;
+            ctx->simulate_smallcaps = TRUE;
         }
         else
         {
             if (op->small_caps_begin)
-                if (safe_printf(0, op->small_caps_begin))
+                if (safe_printf(ctx, 0, op->small_caps_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "small_caps_begin");
                 };
@@ -315,22 +314,22 @@ static void attr_express_begin(int attr, char *param)
 /*========================================================================
  * Name:    attr_express_end
  * Purpose:    Print HTML to complete an attribute.
- * Args:    Attribute number.
+ * Args:    Conversion context, attribute number.
  * Returns:    None.
  *=======================================================================*/
 
-static void attr_express_end(int attr, char *param)
+static void attr_express_end(UnrtfContext *ctx, int attr, char *param)
 {
     switch (attr)
     {
     case ATTR_BOLD:
-        if (safe_printf(0, op->bold_end))
+        if (safe_printf(ctx, 0, op->bold_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "bold_end");
         };
         break;
     case ATTR_ITALIC:
-        if (safe_printf(0, op->italic_end))
+        if (safe_printf(ctx, 0, op->italic_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "italic_end");
         };
@@ -345,98 +344,98 @@ static void attr_express_end(int attr, char *param)
     case ATTR_2DOT_DASH_UL:
     case ATTR_WORD_UL:
     case ATTR_UNDERLINE:
-        if (safe_printf(0, op->underline_end))
+        if (safe_printf(ctx, 0, op->underline_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "underline_end");
         };
         break;
 
     case ATTR_DOUBLE_UL:
-        if (safe_printf(0, op->dbl_underline_end))
+        if (safe_printf(ctx, 0, op->dbl_underline_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "dbl_underline_end");
         };
         break;
 
     case ATTR_FONTSIZE:
-        op_end_std_fontsize(op, atoi(param));
+        op_end_std_fontsize(ctx, op, atoi(param));
         break;
 
     case ATTR_FONTFACE:
-        if (safe_printf(0, op->font_end))
+        if (safe_printf(ctx, 0, op->font_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "font_end");
         };
         break;
 
     case ATTR_FOREGROUND:
-        if (safe_printf(0, op->foreground_end))
+        if (safe_printf(ctx, 0, op->foreground_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "foreground_end");
         };
         break;
     case ATTR_BACKGROUND:
         if (!simple_mode)
-            if (safe_printf(0, op->background_end))
+            if (safe_printf(ctx, 0, op->background_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "background_end");
             };
         break;
 
     case ATTR_SUPER:
-        if (safe_printf(0, op->superscript_end))
+        if (safe_printf(ctx, 0, op->superscript_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "superscript_end");
         };
         break;
     case ATTR_SUB:
-        if (safe_printf(0, op->subscript_end))
+        if (safe_printf(ctx, 0, op->subscript_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "subscript_end");
         };
         break;
 
     case ATTR_STRIKE:
-        if (safe_printf(0, op->strikethru_end))
+        if (safe_printf(ctx, 0, op->strikethru_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "strikethru_end");
         };
         break;
 
     case ATTR_DBL_STRIKE:
-        if (safe_printf(0, op->dbl_strikethru_end))
+        if (safe_printf(ctx, 0, op->dbl_strikethru_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "dbl_strikethru_end");
         };
         break;
 
     case ATTR_OUTLINE:
-        if (safe_printf(0, op->outline_end))
+        if (safe_printf(ctx, 0, op->outline_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "outline_end");
         };
         break;
     case ATTR_SHADOW:
-        if (safe_printf(0, op->shadow_end))
+        if (safe_printf(ctx, 0, op->shadow_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "shadow_end");
         };
         break;
     case ATTR_EMBOSS:
-        if (safe_printf(0, op->emboss_end))
+        if (safe_printf(ctx, 0, op->emboss_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "emboss_end");
         };
         break;
     case ATTR_ENGRAVE:
-        if (safe_printf(0, op->engrave_end))
+        if (safe_printf(ctx, 0, op->engrave_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "engrave_end");
         };
         break;
 
     case ATTR_EXPAND:
-        if (safe_printf(0, op->expand_end))
+        if (safe_printf(ctx, 0, op->expand_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "expand_end");
         };
@@ -445,12 +444,12 @@ static void attr_express_end(int attr, char *param)
     case ATTR_CAPS:
         if (op->simulate_all_caps)
         {
-            simulate_allcaps = FALSE;
+            ctx->simulate_allcaps = FALSE;
         }
         else
         {
             if (op->all_caps_end)
-                if (safe_printf(0, op->all_caps_end))
+                if (safe_printf(ctx, 0, op->all_caps_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "all_caps_end");
                 };
@@ -460,12 +459,12 @@ static void attr_express_end(int attr, char *param)
     case ATTR_SMALLCAPS:
         if (op->simulate_small_caps)
         {
-            simulate_smallcaps = FALSE;
+            ctx->simulate_smallcaps = FALSE;
         }
         else
         {
             if (op->small_caps_end)
-                if (safe_printf(0, op->small_caps_end))
+                if (safe_printf(ctx, 0, op->small_caps_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "small_caps_end");
                 };
@@ -479,13 +478,13 @@ static void attr_express_end(int attr, char *param)
 /*========================================================================
  * Name:    attr_push
  * Purpose:    Pushes an attribute onto the current attribute stack.
- * Args:    Attribute number, optional string parameter.
+ * Args:    Conversion context, attribute number, optional string parameter.
  * Returns:    None.
  *=======================================================================*/
 
-void attr_push(int attr, char *param)
+void attr_push(UnrtfContext *ctx, int attr, char *param)
 {
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
     int i;
     char *oldparam;
 
@@ -500,7 +499,7 @@ void attr_push(int attr, char *param)
     /* Remove any current value of the same attr in the top stack */
     if ((i = attr_find(stack, attr)) != -1) 
     {
-        attr_pull_out(stack, i);
+        attr_pull_out(ctx, stack, i);
     }
 
     if (stack->tos >= MAX_ATTRS - 1)
@@ -511,8 +510,8 @@ void attr_push(int attr, char *param)
 
     /* Make sure it's understood we're in the <body> section. */
     /* KLUDGE */
-    starting_body();
-    starting_text();
+    starting_body(ctx);
+    starting_text(ctx);
 
     ++stack->tos;
     stack->attr_stack[stack->tos] = attr;
@@ -525,14 +524,14 @@ void attr_push(int attr, char *param)
         stack->attr_stack_params[stack->tos] = NULL;
     }
 
-    attr_express_begin(attr, param);
+    attr_express_begin(ctx, attr, param);
 }
 
 /* Unexpress and remove an attribute which is not the top one */
-int attr_find_pop(int findattr)
+int attr_find_pop(UnrtfContext *ctx, int findattr)
 {
     int i;
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
 
     if (!stack)
     {
@@ -545,28 +544,28 @@ int attr_find_pop(int findattr)
     {
         return FALSE;
     }
-    attr_pull_out(stack, i);
+    attr_pull_out(ctx, stack, i);
     return TRUE;
 }
 
 /*========================================================================
  * Name:    attr_get_param
  * Purpose:    Reads an attribute from the current attribute stack.
- * Args:    Attribute number
+ * Args:    Conversion context, attribute number
  * Returns:    string.
  *=======================================================================*/
 
 char *
-attr_get_param(int attr)
+attr_get_param(UnrtfContext *ctx, int attr)
 {
     int i;
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
     if (!stack)
     {
         if (attr != ATTR_ENCODING)
         {
             /*
-             * attr_get_param(ATTR_ENCODING) is always called
+             * attr_get_param(ctx, ATTR_ENCODING) is always called
              * called once without a stack being available.
              */
             warning_handler("No stack to get attribute from");
@@ -618,7 +617,7 @@ attrstack_copy_all(AttrStack *src, AttrStack *dest)
  * Name:    attrstack_unexpress_all
  * Purpose:    Routine to un-express all attributes heretofore applied,
  *         without removing any from the stack.
- * Args:    Stack whose contents should be unexpressed.
+ * Args:    Conversion context, stack whose contents should be unexpressed.
  * Returns:    None.
  * Notes:    This is needed by attrstack_push, but also for \cell, which
  *         often occurs within a brace group, yet HTML uses <td></td>
@@ -626,7 +625,7 @@ attrstack_copy_all(AttrStack *src, AttrStack *dest)
  *=======================================================================*/
 
 void
-attrstack_unexpress_all(AttrStack *stack)
+attrstack_unexpress_all(UnrtfContext *ctx, AttrStack *stack)
 {
     int i;
 
@@ -634,7 +633,7 @@ attrstack_unexpress_all(AttrStack *stack)
 
     for (i = stack->tos; i >= 0; i--)
     {
-        attr_express_end(stack->attr_stack[i], stack->attr_stack_params[i]);
+        attr_express_end(ctx, stack->attr_stack[i], stack->attr_stack_params[i]);
     }
 }
 
@@ -643,11 +642,11 @@ attrstack_unexpress_all(AttrStack *stack)
  * Name:    attrstack_push
  * Purpose:    Creates a new attribute stack, pushes it onto the stack
  *        of stacks, performs inheritance from previous stack.
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 void
-attrstack_push()
+attrstack_push(UnrtfContext *ctx)
 {
     AttrStack *new_stack;
 
@@ -661,9 +660,9 @@ attrstack_push()
 
     memset((void *) new_stack, 0, sizeof(AttrStack));
 
-    if (!stack_of_stacks)
+    if (!ctx->stack_of_stacks)
     {
-        stack_of_stacks = new_stack;
+        ctx->stack_of_stacks = new_stack;
         new_stack->tos = -1;
     } 
     else
@@ -671,26 +670,26 @@ attrstack_push()
         /* Parent stack exists. Copy all attributes. This means that they
            will be unexpressed when we exit this group, which is why there 
          is a call to re-express the parent context in attrstack_drop */
-        attrstack_copy_all(stack_of_stacks_top, new_stack);
+        attrstack_copy_all(ctx->stack_of_stacks_top, new_stack);
     }
         
     /* stack_of_stacks_top is NULL if this is the first stack */
-    new_stack->prev = stack_of_stacks_top;
-    stack_of_stacks_top = new_stack;
+    new_stack->prev = ctx->stack_of_stacks_top;
+    ctx->stack_of_stacks_top = new_stack;
 }
 
 /*========================================================================
  * Name:    attr_pop
  * Purpose:    Removes and undoes the effect of the top attribute of
  *        the current AttrStack.
- * Args:    The top attribute's number, for verification.
+ * Args:    Conversion context, the top attribute's number, for verification.
  * Returns:    Success/fail flag.
  *=======================================================================*/
 
 int
-attr_pop(int attr)
+attr_pop(UnrtfContext *ctx, int attr)
 {
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
 
     if (!stack)
     {
@@ -700,7 +699,7 @@ attr_pop(int attr)
 
     if (stack->tos >= 0 && stack->attr_stack[stack->tos] == attr)
     {
-        attr_pop_internal(stack, attr);
+        attr_pop_internal(ctx, stack, attr);
         return TRUE;
     }
     else
@@ -715,14 +714,14 @@ attr_pop(int attr)
  * Name:    attr_read
  * Purpose:    Reads but leaves in place the top attribute of the top
  *         attribute stack.
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    Attribute number.
  *=======================================================================*/
 
 int
-attr_read()
+attr_read(UnrtfContext *ctx)
 {
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
     if (!stack)
     {
         warning_handler("no stack to read attribute from");
@@ -744,14 +743,14 @@ attr_read()
 /*========================================================================
  * Name:    attr_drop_all
  * Purpose:    Empty top attr stack without unexpressing attributes.
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 void
-attr_drop_all()
+attr_drop_all(UnrtfContext *ctx)
 {
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
     if (!stack)
     {
         warning_handler("no stack to drop all attributes from");
@@ -774,49 +773,80 @@ attr_drop_all()
  * Name:    attrstack_drop
  * Purpose:    Removes the top AttrStack from the stack of stacks, undoing
  *        all attributes that it had in it.
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 void
-attrstack_drop()
+attrstack_drop(UnrtfContext *ctx)
 {
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
     if (!stack)
     {
         warning_handler("no attr-stack to drop");
         return;
     }
 
-    attr_pop_all();
+    attr_pop_all(ctx);
 
     if (stack->prev == NULL)
     {
-        stack_of_stacks = NULL;
+        ctx->stack_of_stacks = NULL;
     }
-    stack_of_stacks_top = stack->prev;
+    ctx->stack_of_stacks_top = stack->prev;
 
     my_free(reinterpret_cast<char*>(stack));
 
     /* Re-set attributes for parent state */
-    if (stack_of_stacks_top)
+    if (ctx->stack_of_stacks_top)
     {
-        attrstack_express_all(/*stack_of_stacks_top*/);
+        attrstack_express_all(ctx /*stack_of_stacks_top*/);
     }
 }
 
+/*========================================================================
+ * Name:    attrstack_free_all
+ * Purpose:    Releases every AttrStack without expressing anything. Used
+ *        when a conversion is abandoned or its context reused.
+ * Args:    Conversion context.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+attrstack_free_all(UnrtfContext *ctx)
+{
+    AttrStack *stack = ctx->stack_of_stacks_top;
+    while (stack)
+    {
+        AttrStack *prev = stack->prev;
+        while (stack->tos >= 0)
+        {
+            char *param = stack->attr_stack_params[stack->tos];
+            if (param)
+            {
+                my_free(param);
+            }
+            stack->tos--;
+        }
+        my_free(reinterpret_cast<char*>(stack));
+        stack = prev;
+    }
+    ctx->stack_of_stacks = NULL;
+    ctx->stack_of_stacks_top = NULL;
+}
+
 /*========================================================================
  * Name:    attr_pop_all
  * Purpose:    Routine to undo all attributes heretofore applied,
  *        also reversing the order in which they were applied.
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 void
-attr_pop_all()
+attr_pop_all(UnrtfContext *ctx)
 {
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
     if (!stack)
     {
         warning_handler("no stack to pop from");
@@ -825,14 +855,14 @@ attr_pop_all()
 
     while (stack->tos >= 0)
     {
-        attr_pop_internal(stack, stack->attr_stack[stack->tos]);
+        attr_pop_internal(ctx, stack, stack->attr_stack[stack->tos]);
     }
 }
 
 /*========================================================================
  * Name:    attrstack_express_all
  * Purpose:    Routine to re-express all attributes heretofore applied.
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  * Notes:    This is needed by attrstack_push, but also for \cell, which
  *         often occurs within a brace group, yet HTML uses <td></td>
@@ -840,9 +870,9 @@ attr_pop_all()
  *=======================================================================*/
 
 void
-attrstack_express_all()
+attrstack_express_all(UnrtfContext *ctx)
 {
-    AttrStack *stack = stack_of_stacks_top;
+    AttrStack *stack = ctx->stack_of_stacks_top;
     int i;
 
     if (!stack)
@@ -853,7 +883,7 @@ attrstack_express_all()
 
     for (i = 0; i <= stack->tos; i++)
     {
-        attr_express_begin(stack->attr_stack[i], stack->attr_stack_params[i]);
+        attr_express_begin(ctx, stack->attr_stack[i], stack->attr_stack_params[i]);
     }
 }
 
@@ -861,23 +891,44 @@ attrstack_express_all()
  * Name:    safe_printf
  * Purpose:    Prevents format string attack and writes empty string
         instead of NULL.
- * Args:    Number of parameters (without a string), string to write,
+ * Args:    Conversion context, number of parameters (without a string), string to write,
         additional parameters to print (have to be strings).
+ *          Strings of the personality are printed from their
+ *          compiled form (op_compile_templates()), others are scanned.
  * Returns:    Returns 0 if number of not escaped '%' in string
          is not greater than nr, else returns -1
  *=======================================================================*/
 
 
 int
-safe_printf(int nr, char *string, ...)
+safe_printf(UnrtfContext *ctx, int nr, char *string, ...)
 {
 
     char *s;
     int i = 0, ret_code = 0;
     va_list arguments;
+    const Template *t;
 
     if (string == NULL)
         ;
+    else if ((t = op_find_template(op, string)) != NULL)
+    {
+        size_t pos = 0;
+
+        va_start(arguments, string);
+        for (i = 0; i < nr && i < t->slots; i++)
+        {
+            outbuf_write(ctx->out, t->text + pos, t->slot_at[i] - pos);
+            outbuf_puts(ctx->out, va_arg(arguments, char *));
+            pos = t->slot_at[i];
+        }
+        va_end(arguments);
+        outbuf_write(ctx->out, t->text + pos, t->len - pos);
+        if (t->slots > nr)
+        {
+            ret_code = -1;
+        }
+    }
     else
     {
         va_start(arguments, string);
@@ -888,7 +939,7 @@ safe_printf(int nr, char *string, ...)
             {
                 if (string[i] != '\\' || string[i + 1] != '%')
                 {
-                    printf("%c", string[i]);
+                    outbuf_putc(ctx->out, string[i]);
                 }
                 i++;
             }
@@ -896,7 +947,7 @@ safe_printf(int nr, char *string, ...)
             if (string[i] != '\0')
             {
                 s = va_arg(arguments, char *);
-                printf("%s", s);
+                outbuf_puts(ctx->out, s);
                 i++;
             }
         }
@@ -908,7 +959,7 @@ safe_printf(int nr, char *string, ...)
             {
                 if (string[i] != '%' || (string[i] == '%' && (i != 0 && string[i - 1] == '\\')))
                 {
-                    printf("%c", string[i]);
+                    outbuf_putc(ctx->out, string[i]);
                 }
                 else
                 {
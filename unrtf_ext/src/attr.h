@@ -64,26 +64,29 @@ Collection *add_to_collection(Collection *col, int nr, const char *text);
 const char *get_from_collection(Collection *c, int nr);
 void free_collection(Collection *c);
 
-extern void attr_push(int attr, char *param);
+typedef struct _unrtf_context UnrtfContext;
 
-extern void attrstack_push();
-extern void attrstack_drop();
-extern void attrstack_express_all();
+extern void attr_push(UnrtfContext *ctx, int attr, char *param);
 
-extern int attr_find_pop(int findattr);
-extern int attr_pop(int attr);
+extern void attrstack_push(UnrtfContext *ctx);
+extern void attrstack_drop(UnrtfContext *ctx);
+extern void attrstack_express_all(UnrtfContext *ctx);
+extern void attrstack_free_all(UnrtfContext *ctx);
 
-extern int attr_read();
+extern int attr_find_pop(UnrtfContext *ctx, int findattr);
+extern int attr_pop(UnrtfContext *ctx, int attr);
 
-extern void attr_drop_all();
+extern int attr_read(UnrtfContext *ctx);
 
-extern void attr_pop_all();
+extern void attr_drop_all(UnrtfContext *ctx);
+
+extern void attr_pop_all(UnrtfContext *ctx);
 
 extern void attr_pop_dump();
 
-char *attr_get_param(int attr);
+char *attr_get_param(UnrtfContext *ctx, int attr);
 
-int safe_printf(int nr, char *string, ...);
+int safe_printf(UnrtfContext *ctx, int nr, char *string, ...);
 char *assemble_string(char *string, int nr);
 #define TOO_MANY_ARGS "Tag name \"%s\" do not take so many arguments"
 
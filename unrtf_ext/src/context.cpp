@@ -0,0 +1,174 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "defs.h"
+#include "error.h"
+#include "malloc.h"
+#include "hash.h"
+#include "attr.h"
+#include "context.h"
+#include "convert.h"
+
+/*========================================================================
+ * Name:    context_release
+ * Purpose:    Frees what a conversion accumulated in the context: Word
+ *             nodes, interned strings, font names, attribute stacks.
+ * Args:    Conversion context.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+context_release(UnrtfContext *ctx)
+{
+    int i;
+
+    arena_reset(&ctx->words);
+    hash_free(ctx);
+    attrstack_free_all(ctx);
+
+    my_iconv_t_make_invalid(&ctx->desc);
+    if (ctx->current_encoding && *ctx->current_encoding)
+    {
+        my_free(ctx->current_encoding);
+    }
+    ctx->current_encoding = (char *) "";
+
+    for (i = 0; i < ctx->total_fonts; i++)
+    {
+        if (ctx->font_table[i].name)
+        {
+            my_free(ctx->font_table[i].name);
+        }
+    }
+    ctx->total_fonts = 0;
+}
+
+/*========================================================================
+ * Name:    context_create
+ * Purpose:    Creates the state for one conversion, with every field at
+ *             the value the former globals started with.
+ * Args:    Output buffer receiving the rendered document, nopict flag.
+ * Returns:    Conversion context.
+ *=======================================================================*/
+
+UnrtfContext *
+context_create(OutputBuffer *out, int nopict_mode)
+{
+    UnrtfContext *ctx;
+    my_iconv_t clear = MY_ICONV_T_CLEAR;
+
+    ctx = (UnrtfContext *) my_malloc(sizeof(UnrtfContext));
+    if (!ctx)
+    {
+        error_handler("cannot allocate conversion context");
+    }
+
+    memset((void *) ctx, 0, sizeof(UnrtfContext));
+    ctx->desc = clear;
+    ctx->current_encoding = (char *) "";
+
+    context_reset(ctx, out, nopict_mode);
+    return ctx;
+}
+
+/*========================================================================
+ * Name:    context_reset
+ * Purpose:    Prepares a context for converting another document. The
+ *             word buffer, the string table, the first block of each
+ *             arena, the iconv descriptors (left to be reset when
+ *             picked again) and the last character table used are kept,
+ *             everything else starts over.
+ * Args:    Conversion context, output buffer, nopict flag.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+context_reset(UnrtfContext *ctx, OutputBuffer *out, int nopict_mode)
+{
+    CHECK_PARAM_NOT_NULL(ctx);
+
+    context_release(ctx);
+
+    ctx->out = out;
+    ctx->nopict_mode = nopict_mode;
+    ctx->lineno = 0;
+
+    ctx->in_cur = NULL;
+    ctx->in_end = NULL;
+    ctx->skip_contents = FALSE;
+    ctx->unicode_runs = FALSE;
+    ctx->group_depth = 0;
+    ctx->uc[0] = 1;
+    convert_skip_sets(&ctx->skip_groups, &ctx->skip_starred);
+    memset(&ctx->drop_groups, 0, sizeof(ctx->drop_groups));
+    if (nopict_mode)
+    {
+        keyword_set_add(&ctx->drop_groups, KW_PICT);
+    }
+
+    ctx->indent_level = 0;
+
+    ctx->coming_pars_that_are_tabular = 0;
+    ctx->within_table = FALSE;
+    ctx->have_printed_row_begin = FALSE;
+    ctx->have_printed_cell_begin = FALSE;
+    ctx->have_printed_row_end = FALSE;
+    ctx->have_printed_cell_end = FALSE;
+    ctx->total_chars_this_line = 0;
+    ctx->simulate_smallcaps = FALSE;
+    ctx->simulate_allcaps = FALSE;
+    ctx->within_picture = FALSE;
+    ctx->within_picture_depth = 0;
+    ctx->picture_file_number = 1;
+    ctx->picture_path[0] = 0;
+    ctx->picture_width = 0;
+    ctx->picture_height = 0;
+    ctx->picture_bits_per_pixel = 1;
+    ctx->picture_type = 0;
+    ctx->picture_wmetafile_type = 0;
+    ctx->picture_wmetafile_type_str = NULL;
+    ctx->EndNoteCitations = FALSE;
+    ctx->have_printed_body = FALSE;
+    ctx->within_header = TRUE;
+    ctx->hyperlink_base = NULL;
+    ctx->banner_printed = FALSE;
+    ctx->default_encoding = (char *) "CP1252";
+    ctx->default_font_number = 0;
+    ctx->had_ansicpg = FALSE;
+    ctx->total_colors = 0;
+    ctx->iconv_cur = 0;
+}
+
+/*========================================================================
+ * Name:    context_free
+ * Purpose:    Releases a conversion context and everything it owns,
+ *             except the output buffer.
+ * Args:    Conversion context.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+context_free(UnrtfContext *ctx)
+{
+    int i;
+
+    CHECK_PARAM_NOT_NULL(ctx);
+
+    context_release(ctx);
+    hash_destroy(ctx);
+    arena_free(&ctx->words);
+
+    if (ctx->input_str)
+    {
+        my_free(ctx->input_str);
+    }
+
+    for (i = 0; i < ctx->iconv_cached; i++)
+    {
+        ctx->iconv_cache[i].desc = my_iconv_close(ctx->iconv_cache[i].desc);
+        my_free(ctx->iconv_cache[i].encoding);
+    }
+
+    my_free((char *) ctx);
+}
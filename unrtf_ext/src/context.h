@@ -0,0 +1,121 @@
+#pragma once
+
+#include "outbuf.h"
+#include "arena.h"
+#include "my_iconv.h"
+#include "fontentry.h"
+#include "keywords.h"
+
+/* RTF color table colors are RGB */
+typedef struct
+{
+    unsigned char r, g, b;
+} Color;
+
+#define MAX_COLORS (1024)
+
+/* Size of the buffer accumulating \'XX bytes before they go to iconv */
+#define IIBS 10240
+
+/* Group depths with their own \ucN count; deeper groups share the last */
+#define UC_DEPTHS 256
+
+/* Number of iconv descriptors a context keeps open */
+#define ICONV_CACHE_SIZE 8
+
+typedef struct
+{
+    char *encoding;
+    my_iconv_t desc;
+} IconvCacheEntry;
+
+/* All the state of one conversion. Everything that used to live in
+ * file-level statics of parse.cpp, hash.cpp, attr.cpp and convert.cpp
+ * is kept here, so that several documents can be converted at the
+ * same time. Field names are those of the former globals.
+ */
+typedef struct _unrtf_context
+{
+    OutputBuffer *out;
+    int nopict_mode;
+    int lineno;
+
+    /* parse.cpp */
+    const char *in_cur;     /* next byte of the input */
+    const char *in_end;
+    char *input_str;        /* word buffer */
+    unsigned long current_max_length;
+    int kw;                 /* Keyword of the word in input_str */
+    int has_param;
+    int param;
+    KeywordSet drop_groups;     /* groups starting with these are dropped */
+    KeywordSet skip_groups;     /* groups starting with these are skipped */
+    KeywordSet skip_starred;    /* same after \*, KW_NONE for unknown words */
+    int skip_contents;          /* the group just opened is being skipped */
+    int unicode_runs;           /* \uN characters are read as runs */
+    int group_depth;
+    int uc[UC_DEPTHS];          /* \ucN fallback length of each open group */
+
+    /* hash.cpp */
+    struct _hs *hash;       /* open addressing table */
+    unsigned long hash_size;
+    unsigned long hash_count;
+    unsigned long hash_lookups;
+    unsigned long hash_probes;
+    unsigned long hash_bytes;
+    Arena strings;          /* the stored strings */
+
+    /* word.cpp */
+    Arena words;            /* Word nodes of the document */
+    int indent_level;
+
+    /* attr.cpp */
+    struct _stack *stack_of_stacks;
+    struct _stack *stack_of_stacks_top;
+
+    /* output.cpp, op_char_table */
+    const struct _char_table *char_table;   /* of current_encoding */
+
+    /* convert.cpp */
+    my_iconv_t desc;        /* iconv_cache[0].desc, or invalid */
+    IconvCacheEntry iconv_cache[ICONV_CACHE_SIZE];  /* most recent first */
+    int iconv_cached;
+    int coming_pars_that_are_tabular;
+    int within_table;
+    int have_printed_row_begin;
+    int have_printed_cell_begin;
+    int have_printed_row_end;
+    int have_printed_cell_end;
+    int total_chars_this_line;
+    int simulate_smallcaps;
+    int simulate_allcaps;
+    int within_picture;
+    int within_picture_depth;
+    int picture_file_number;
+    char picture_path[255];
+    int picture_width;
+    int picture_height;
+    int picture_bits_per_pixel;
+    int picture_type;
+    int picture_wmetafile_type;
+    char *picture_wmetafile_type_str;
+    int EndNoteCitations;
+    int have_printed_body;
+    int within_header;
+    const char *hyperlink_base;
+    int banner_printed;
+    char *default_encoding;
+    char *current_encoding;
+    int default_font_number;
+    int had_ansicpg;
+    FontEntry font_table[MAX_FONTS];
+    int total_fonts;
+    Color color_table[MAX_COLORS];
+    int total_colors;
+    char iconv_buffer[IIBS];
+    int iconv_cur;
+} UnrtfContext;
+
+extern UnrtfContext *context_create(OutputBuffer *out, int nopict_mode);
+extern void context_reset(UnrtfContext *ctx, OutputBuffer *out, int nopict_mode);
+extern void context_free(UnrtfContext *ctx);
@@ -41,38 +41,30 @@
 #include "convert.h"
 #include "attr.h"
 #include "fontentry.h"
+#include "outbuf.h"
+#include "context.h"
+#include "keywords.h"
+#include "unicode.h"
 
 typedef struct
 {
-    char *name;
-    int (*func)(Word *, int, char, int);
+    Keyword kw;
+    int (*func)(UnrtfContext *, Word *, int, char, int);
     char *debug_print;
 } HashItem;
-static HashItem *find_command(const char *cmdpp, int *hasparamp, int *paramp);
+static HashItem *find_command(UnrtfContext *ctx, Keyword kw, const char *cmdpp);
 
-extern int nopict_mode;
 extern int quiet;
 
 /*
 #define BINARY_ATTRS
 */
 
-my_iconv_t desc = MY_ICONV_T_CLEAR;
-
-/* Nested tables aren't supported.
- */
-static int coming_pars_that_are_tabular = 0;
-static int within_table = FALSE;
-static int have_printed_row_begin = FALSE;
-static int have_printed_cell_begin = FALSE;
-static int have_printed_row_end = FALSE;
-static int have_printed_cell_end = FALSE;
-static void check_for_table();
-
-
-/* Previously in word_print_core function
+/* All conversion state (iconv descriptor, table and picture flags,
+ * font and color tables...) lives in the UnrtfContext, see context.h.
+ * Nested tables aren't supported.
  */
-static int total_chars_this_line = 0; /* for simulating \tab */
+static void check_for_table(UnrtfContext *ctx);
 
 
 /* Paragraph alignment (kludge)
@@ -87,12 +79,6 @@ enum
 
 
 
-/* This value is set by attr_push and attr_pop
- */
-int simulate_smallcaps;
-int simulate_allcaps;
-
-
 /* Most pictures must be written to files. */
 enum
 {
@@ -106,111 +92,64 @@ enum
     PICT_PNG,
     PICT_EMF,
 };
-static int within_picture = FALSE;
-static int within_picture_depth;
-static int picture_file_number = 1;
-static char picture_path[255];
-static int picture_width;
-static int picture_height;
-static int picture_bits_per_pixel = 1;
-static int picture_type = PICT_UNKNOWN;
-static int picture_wmetafile_type;
-static char *picture_wmetafile_type_str;
-
-static int EndNoteCitations = FALSE;
-
-static int have_printed_body = FALSE;
-static int within_header = TRUE;
-
-
-static const char *hyperlink_base = NULL;
-
-
-void starting_body();
-void starting_text();
-void print_with_special_exprs(const char *s);
-
-static int banner_printed = FALSE;
-
-void
-convert_reset()
-{
-    my_iconv_t desc = MY_ICONV_T_CLEAR;
-
-    coming_pars_that_are_tabular = 0;
-    within_table = FALSE;
-    have_printed_row_begin = FALSE;
-    have_printed_cell_begin = FALSE;
-    have_printed_row_end = FALSE;
-    have_printed_cell_end = FALSE;
-
-    total_chars_this_line = 0;
-    within_picture = FALSE;
-    picture_file_number = 1;
-    picture_bits_per_pixel = 1;
-    picture_type = PICT_UNKNOWN;
 
-    EndNoteCitations = FALSE;
-
-    have_printed_body = FALSE;
-    within_header = TRUE;
-
-    hyperlink_base = NULL;
-}
+void starting_body(UnrtfContext *ctx);
+void starting_text(UnrtfContext *ctx);
+void print_with_special_exprs(UnrtfContext *ctx, const char *s);
 
 /*========================================================================
  * Name:    print_banner
  * Purpose:    Writes program-identifying text to the output stream.
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 void
-print_banner()
+print_banner(UnrtfContext *ctx)
 {
-    if (!banner_printed)
+    if (!ctx->banner_printed)
     {
-        if (safe_printf(0, op->comment_begin))
+        if (safe_printf(ctx, 0, op->comment_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
         }
-        printf(" Translation from RTF performed by ");
-        printf("UnRTF, version ");
-        printf("%s ", PACKAGE_VERSION);
-        if (safe_printf(0, op->comment_end))
+        outbuf_printf(ctx->out, " Translation from RTF performed by ");
+        outbuf_printf(ctx->out, "UnRTF, version ");
+        outbuf_printf(ctx->out, "%s ", PACKAGE_VERSION);
+        if (safe_printf(ctx, 0, op->comment_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_end");
         }
     }
-    banner_printed = TRUE;
+    ctx->banner_printed = TRUE;
 }
 
 
 /*========================================================================
  * Name:    starting_body
  * Purpose:    Switches output stream for writing document contents.
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 void
-starting_body()
+starting_body(UnrtfContext *ctx)
 {
-    if (!have_printed_body)
+    if (!ctx->have_printed_body)
     {
         if (!inline_mode)
         {
-            if (safe_printf(0, op->header_end))
+            if (safe_printf(ctx, 0, op->header_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "header_end");
             }
-            if (safe_printf(0, op->body_begin))
+            if (safe_printf(ctx, 0, op->body_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "body_begin");
             }
         }
-        within_header = FALSE;
-        have_printed_body = TRUE;
+        ctx->within_header = FALSE;
+        ctx->have_printed_body = TRUE;
     }
 }
 
@@ -253,12 +192,12 @@ static char *month_strings[12] =
  * Name:    word_dump_date
  * Purpose:    Extracts date from an RTF input stream, writes it to
  *              output stream.
- * Args:    Word*, buffered RTF stream
+ * Args:    Conversion context, Word*, buffered RTF stream
  * Returns:    None.
  *=======================================================================*/
 
 void
-word_dump_date(Word *w)
+word_dump_date(UnrtfContext *ctx, Word *w)
 {
     int year = 0, month = 0, day = 0, hour = 0, minute = 0;
     CHECK_PARAM_NOT_NULL(w);
@@ -270,44 +209,41 @@ word_dump_date(Word *w)
         {
             return;
         }
-        if (*s == '\\')
+        if (w->has_param && w->param >= 0)
         {
-            ++s;
-            if (!strncmp(s, "yr", 2) && isdigit(s[2]))
-            {
-                year = atoi(&s[2]);
-            }
-            else if (!strncmp(s, "mo", 2) && isdigit(s[2]))
+            switch (w->kw)
             {
-                month = atoi(&s[2]);
+            case KW_YR:
+                year = w->param;
+                break;
+            case KW_MO:
+                month = w->param;
                 if (month > 12)
                 {
                     warning_handler("bogus month");
                     return;
                 }
-            }
-            else if (!strncmp(s, "dy", 2) && isdigit(s[2]))
-            {
-                day = atoi(&s[2]);
-            }
-            else if (!strncmp(s, "min", 3) && isdigit(s[3]))
-            {
-                minute = atoi(&s[3]);
-            }
-            else if (!strncmp(s, "hr", 2) && isdigit(s[2]))
-            {
-                hour = atoi(&s[2]);
+                break;
+            case KW_DY:
+                day = w->param;
+                break;
+            case KW_MIN:
+                minute = w->param;
+                break;
+            case KW_HR:
+                hour = w->param;
+                break;
             }
         }
         w = w->next;
     }
     if (year && month > 0 && month <= 12 && day)
     {
-        printf("%d %s %d ", day, month_strings[month - 1], year);
+        outbuf_printf(ctx->out, "%d %s %d ", day, month_strings[month - 1], year);
     }
     if (hour && minute)
     {
-        printf("%02d:%02d ", hour, minute);
+        outbuf_printf(ctx->out, "%02d:%02d ", hour, minute);
     }
 }
 
@@ -315,44 +251,94 @@ word_dump_date(Word *w)
 
 /*-------------------------------------------------------------------*/
 
-static char *default_encoding = "CP1252";
-/* current_encoding not NULL to be safe. "" is detected to avoid
-   free() on 1st call */
-static char *current_encoding = "";
-/* Encoding expected by op_translate_buffer. Until we find a way to specify
-   transparent UTF-8 passthrough */
-static char *output_encoding = "UTF-32BE";
-static int default_font_number = 0; // Set by \deffx command
-static int had_ansicpg;
-extern FontEntry font_table[MAX_FONTS];
-extern int total_fonts;
-
-static void flush_iconv_input();
-static void accumulate_iconv_input(int ch);
+/* Encoding expected by op_translate_buffer, or by op_print_utf8 for
+   personalities with utf8_output */
+static const char *
+output_encoding()
+{
+    return op->utf8_output ? "UTF-8" : "UTF-32BE";
+}
+
+static void flush_iconv_input(UnrtfContext *ctx);
+static void accumulate_iconv_input(UnrtfContext *ctx, int ch);
+static void accumulate_iconv_run(UnrtfContext *ctx, const char *s);
+
+static void
+set_current_encoding(UnrtfContext *ctx, char *encoding)
+{
+    if (ctx->current_encoding && *ctx->current_encoding)
+    {
+        my_free(ctx->current_encoding);
+    }
+    ctx->current_encoding = my_strdup(encoding);
+}
+
+/*========================================================================
+ * Name:    select_encoding
+ * Purpose:    Makes encoding the current one, with its descriptor taken
+ *             from the context cache and reset, so that the groups of a
+ *             document do not keep opening and closing the same
+ *             descriptors (or reading the same charmap files). When the
+ *             cache is full the least recently used descriptor is closed.
+ * Args:    Conversion context, encoding.
+ * Returns:    None.
+ *=======================================================================*/
 
 static void
-set_current_encoding(char *encoding)
+select_encoding(UnrtfContext *ctx, char *encoding)
 {
-    if (current_encoding && *current_encoding)
+    IconvCacheEntry entry;
+    int i;
+
+    for (i = 0; i < ctx->iconv_cached; i++)
+    {
+        if (!strcmp(ctx->iconv_cache[i].encoding, encoding))
+        {
+            break;
+        }
+    }
+    if (i < ctx->iconv_cached)
+    {
+        entry = ctx->iconv_cache[i];
+        my_iconv_reset(entry.desc);
+    }
+    else
+    {
+        if (ctx->iconv_cached == ICONV_CACHE_SIZE)
+        {
+            i = ICONV_CACHE_SIZE - 1;
+            ctx->iconv_cache[i].desc = my_iconv_close(ctx->iconv_cache[i].desc);
+            my_free(ctx->iconv_cache[i].encoding);
+        }
+        else
+        {
+            i = ctx->iconv_cached++;
+        }
+        entry.encoding = my_strdup(encoding);
+        entry.desc = my_iconv_open(output_encoding(), encoding);
+    }
+    memmove(&ctx->iconv_cache[1], &ctx->iconv_cache[0], i * sizeof(IconvCacheEntry));
+    ctx->iconv_cache[0] = entry;
+    ctx->desc = entry.desc;
+
+    if (strcmp(ctx->current_encoding, encoding))
     {
-        my_free(current_encoding);
+        set_current_encoding(ctx, encoding);
     }
-    current_encoding = my_strdup(encoding);
 }
 
 static void
-maybeopeniconv()
+maybeopeniconv(UnrtfContext *ctx)
 {
-    if (!my_iconv_is_valid(desc))
+    if (!my_iconv_is_valid(ctx->desc))
     {
         /* This may happen if output begins without a font command */
-        char *encoding = attr_get_param(ATTR_ENCODING);
+        char *encoding = attr_get_param(ctx, ATTR_ENCODING);
         if (!encoding || !*encoding)
         {
-            encoding = default_encoding;
+            encoding = ctx->default_encoding;
         }
-        desc = my_iconv_open(output_encoding, encoding);
-        set_current_encoding(encoding);
+        select_encoding(ctx, encoding);
     }
 }
 
@@ -360,27 +346,27 @@ maybeopeniconv()
 /*========================================================================
  * Name:    lookup_font
  * Purpose:    Fetches the font entry from the already-read font table.
- * Args:    Font#.
+ * Args:    Conversion context, font#.
  * Returns:    Font name.
  *=======================================================================*/
 FontEntry *
-lookup_font(int num)
+lookup_font(UnrtfContext *ctx, int num)
 {
     int i;
-    if (total_fonts)
-        for (i = 0; i < total_fonts; i++)
+    if (ctx->total_fonts)
+        for (i = 0; i < ctx->total_fonts; i++)
         {
-            if (font_table[i].num == num)
+            if (ctx->font_table[i].num == num)
             {
-                return &font_table[i];
+                return &ctx->font_table[i];
             }
         }
     return NULL;
 }
 char *
-lookup_fontname(int num)
+lookup_fontname(UnrtfContext *ctx, int num)
 {
-    FontEntry *e = lookup_font(num);
+    FontEntry *e = lookup_font(ctx, num);
     if (e == NULL)
     {
         return NULL;
@@ -388,41 +374,6 @@ lookup_fontname(int num)
     return e->name;
 }
 
-// Extract name and parameter from command. RTF spec says name is max
-// 32 chars (inc. param I think), let's be conservative:
-#define MAX_CONTROL_LEN 50
-// Returns 0 for error, 1 if ok no parm, 0 else
-static int controlToNameParm(const char *s, char *name, int maxlen, int *parm)
-{
-    const char *cp = s;
-    int len = 0;
-
-    if (s == 0)
-    {
-        return 0;
-    }
-    while (isalpha(*cp) && len < maxlen)
-    {
-        *name++ = *cp++;
-        len++;
-    }
-    if (len == maxlen)
-    {
-        return 0;
-    }
-    *name = 0;
-    if (!*cp)
-    {
-        return 1;
-    }
-    if (!(*cp == '-') && !isdigit(*cp))
-    {
-        return 0;
-    }
-    *parm = atoi(cp);
-    return 2;
-}
-
 // translate \fcharset parameter value to code page. See MS RTF doc
 static const int fcharsetparmtocp(int parm)
 {
@@ -607,11 +558,11 @@ static char *cptoencoding(int parm)
  *  other commands. The font decl can be alone in a group, or part of
  *  a semicolon-separated list, in which case we take care to stop input just
  *  after the semi-colon
- * Args:    Group containing one or several font decls
+ * Args:    Conversion context, group containing one or several font decls
  * Returns:    None.
  *=======================================================================*/
 
-Word *read_font_decl(Word *w)
+Word *read_font_decl(UnrtfContext *ctx, Word *w)
 {
     int num;
     char name[BUFSIZ];
@@ -627,14 +578,14 @@ Word *read_font_decl(Word *w)
        entry (e.g. '\flomajor') before the font number */
     for (i = 0; i < 2; i++) 
     {
-        tmp = word_string(w);
+        tmp = w ? word_string(w) : NULL;
         if (!tmp || strlen(tmp) < 3 || strncmp("\\f", tmp, 2))
         {
             return 0;
         }            
-        if (isdigit(tmp[2]))
+        if (w->kw == KW_F && w->has_param && tmp[2] != '-')
         {
-            num = atoi(&tmp[2]);
+            num = w->param;
             break;
         } else if (i == 1) {
             return 0;
@@ -672,23 +623,17 @@ Word *read_font_decl(Word *w)
                 strncat(name, tmp, sizeof(name) - strlen(name) - 1);
             }
         }
-        else if (tmp)
+        else if (tmp && w->has_param)
         {
-            char nm[MAX_CONTROL_LEN + 1];
-            int parm;
-            int ret = controlToNameParm(tmp + 1, nm, MAX_CONTROL_LEN, &parm);
-            if (ret == 2)
+            if (w->kw == KW_FCHARSET)
             {
-                if (!strcmp(nm, "fcharset"))
-                {
-                    fcharsetcp = fcharsetparmtocp(parm);
-                }
-                else if (!strcmp(nm, "cpg"))
-                {
-                    cpgcp = parm;
-                }
-                /* not interested by stuff like \froman */
+                fcharsetcp = fcharsetparmtocp(w->param);
             }
+            else if (w->kw == KW_CPG)
+            {
+                cpgcp = w->param;
+            }
+            /* not interested by stuff like \froman */
         }
         w = w->next;
         if (needbreak)
@@ -702,8 +647,8 @@ Word *read_font_decl(Word *w)
             *t = 0;
     }
 
-    font_table[total_fonts].num = num;
-    font_table[total_fonts].name = my_strdup(name);
+    ctx->font_table[ctx->total_fonts].num = num;
+    ctx->font_table[ctx->total_fonts].name = my_strdup(name);
 
     /* Explicit cpg parameter has priority on fcharset one */
     if (cpgcp == -1)
@@ -713,7 +658,7 @@ Word *read_font_decl(Word *w)
 
     if (cpgcp != -1)
     {
-        font_table[total_fonts].encoding = cptoencoding(cpgcp);
+        ctx->font_table[ctx->total_fonts].encoding = cptoencoding(cpgcp);
     }
     else
     {
@@ -721,11 +666,11 @@ Word *read_font_decl(Word *w)
          * symbol encoding, else no local encoding */
         if (strcasestr(name, "symbol"))
         {
-            font_table[total_fonts].encoding = "SYMBOL";
+            ctx->font_table[ctx->total_fonts].encoding = "SYMBOL";
         }
         else
         {
-            font_table[total_fonts].encoding = 0;
+            ctx->font_table[ctx->total_fonts].encoding = 0;
         }
     }
 
@@ -733,33 +678,33 @@ Word *read_font_decl(Word *w)
        even if cpgcp is set */
     if (strcasecmp(name, "symbol") == 0)
     {
-        font_table[total_fonts].encoding = "SYMBOL";
+        ctx->font_table[ctx->total_fonts].encoding = "SYMBOL";
     }
-    if (safe_printf(0, assemble_string(op->fonttable_fontnr, num)))
+    if (safe_printf(ctx, 0, assemble_string(op->fonttable_fontnr, num)))
     {
         fprintf(stderr, TOO_MANY_ARGS, "fonttable_fontnr");
     }
-    if (safe_printf(1, op->fonttable_fontname, name))
+    if (safe_printf(ctx, 1, op->fonttable_fontname, name))
     {
         fprintf(stderr, TOO_MANY_ARGS, "fonttable_fontname");
     }
-    total_fonts++;
+    ctx->total_fonts++;
     return w;
 }
 
 /*========================================================================
  * Name:    process_font_table
  * Purpose:    Processes the font table of an RTF file.
- * Args:    Tree of words.
+ * Args:    Conversion context, tree of words.
  * Returns:    None.
  *=======================================================================*/
 
 void
-process_font_table(Word *w)
+process_font_table(UnrtfContext *ctx, Word *w)
 {
     CHECK_PARAM_NOT_NULL(w);
 
-    if (safe_printf(0, op->fonttable_begin))
+    if (safe_printf(ctx, 0, op->fonttable_begin))
     {
         fprintf(stderr, TOO_MANY_ARGS, "fonttable_begin");
     }
@@ -771,12 +716,12 @@ process_font_table(Word *w)
     {
         if (w->child)
         {
-            read_font_decl(w->child);
+            read_font_decl(ctx, w->child);
             w = w->next;
         }
         else if (word_string(w))
         {
-            w = read_font_decl(w);
+            w = read_font_decl(ctx, w);
         }
         else
         {
@@ -786,7 +731,7 @@ process_font_table(Word *w)
         }
     }
 
-    if (safe_printf(0, op->fonttable_end))
+    if (safe_printf(ctx, 0, op->fonttable_end))
     {
         fprintf(stderr, TOO_MANY_ARGS, "fonttable_end");
     }
@@ -797,23 +742,23 @@ process_font_table(Word *w)
      * in the header (or not in which case it is o). Don't do it if
      * we had an explicit ansicpg command (no logic in this, just works).
      */
-    if (total_fonts > 0 && !had_ansicpg)
+    if (ctx->total_fonts > 0 && !ctx->had_ansicpg)
     {
-        FontEntry *e = lookup_font(default_font_number);
+        FontEntry *e = lookup_font(ctx, ctx->default_font_number);
         if (e && e->encoding && *e->encoding)
         {
-            default_encoding = e->encoding;
+            ctx->default_encoding = e->encoding;
         }
     }
 
     if (!quiet) 
     {
-        if (safe_printf(0, op->comment_begin))
+        if (safe_printf(ctx, 0, op->comment_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
         }
-        printf("font table contains %d fonts total", total_fonts);
-        if (safe_printf(0, op->comment_end))
+        outbuf_printf(ctx->out, "font table contains %d fonts total", ctx->total_fonts);
+        if (safe_printf(ctx, 0, op->comment_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_end");
         }
@@ -823,18 +768,18 @@ process_font_table(Word *w)
     {
         int i;
 
-        if (safe_printf(0, op->comment_begin))
+        if (safe_printf(ctx, 0, op->comment_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
         }
-        printf("font table dump: \n");
-        for (i = 0; i < total_fonts; i++)
+        outbuf_printf(ctx->out, "font table dump: \n");
+        for (i = 0; i < ctx->total_fonts; i++)
         {
-            printf(" font %d = %s encoding = %s\n", font_table[i].num,
-                   font_table[i].name, font_table[i].encoding);
+            outbuf_printf(ctx->out, " font %d = %s encoding = %s\n", ctx->font_table[i].num,
+                   ctx->font_table[i].name, ctx->font_table[i].encoding);
         }
 
-        if (safe_printf(0, op->comment_end))
+        if (safe_printf(ctx, 0, op->comment_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_end");
         }
@@ -845,12 +790,12 @@ process_font_table(Word *w)
 /*========================================================================
  * Name:    process_index_entry
  * Purpose:    Processes an index entry of an RTF file.
- * Args:    Tree of words.
+ * Args:    Conversion context, tree of words.
  * Returns:    None.
  *=======================================================================*/
 
 void
-process_index_entry(Word *w)
+process_index_entry(UnrtfContext *ctx, Word *w)
 {
     Word *w2;
 
@@ -864,12 +809,12 @@ process_index_entry(Word *w)
 
             if (debug_mode && str)
             {
-                if (safe_printf(0, op->comment_begin))
+                if (safe_printf(ctx, 0, op->comment_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                 }
-                printf("index entry word: %s ", str);
-                if (safe_printf(0, op->comment_end))
+                outbuf_printf(ctx->out, "index entry word: %s ", str);
+                if (safe_printf(ctx, 0, op->comment_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                 }
@@ -883,12 +828,12 @@ process_index_entry(Word *w)
 /*========================================================================
  * Name:    process_toc_entry
  * Purpose:    Processes an index entry of an RTF file.
- * Args:    Tree of words, flag to say whether to include a page#.
+ * Args:    Conversion context, tree of words, flag to say whether to include a page#.
  * Returns:    None.
  *=======================================================================*/
 
 void
-process_toc_entry(Word *w, int include_page_num)
+process_toc_entry(UnrtfContext *ctx, Word *w, int include_page_num)
 {
     Word *w2;
 
@@ -903,14 +848,14 @@ process_toc_entry(Word *w, int include_page_num)
             if (debug_mode && str)
             {
 
-                if (safe_printf(0, op->comment_begin))
+                if (safe_printf(ctx, 0, op->comment_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                 }
-                printf("toc %s entry word: %s ",
+                outbuf_printf(ctx->out, "toc %s entry word: %s ",
                        include_page_num ? "page#" : "no page#",
                        str);
-                if (safe_printf(0, op->comment_end))
+                if (safe_printf(ctx, 0, op->comment_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                 }
@@ -924,12 +869,12 @@ process_toc_entry(Word *w, int include_page_num)
 /*========================================================================
  * Name:    process_info_group
  * Purpose:    Processes the \info group of an RTF file.
- * Args:    Tree of words.
+ * Args:    Conversion context, tree of words.
  * Returns:    None.
  *=======================================================================*/
 
 void
-process_info_group(Word *w)
+process_info_group(UnrtfContext *ctx, Word *w)
 {
     Word *child;
 
@@ -939,7 +884,7 @@ process_info_group(Word *w)
         return;
     }
 
-    maybeopeniconv();
+    maybeopeniconv(ctx);
 
     while (w)
     {
@@ -957,10 +902,10 @@ process_info_group(Word *w)
 
             if (!inline_mode)
             {
-                if (!strcmp("\\title", s))
+                if (WORD_IS(child, KW_TITLE))
                 {
 
-                    if (safe_printf(0, op->document_title_begin))
+                    if (safe_printf(ctx, 0, op->document_title_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "document_title_begin");
                     }
@@ -970,25 +915,29 @@ process_info_group(Word *w)
                         const char *s2 = word_string(w2);
                         if (s2 && s2[0] != '\\')
                         {
-                            print_with_special_exprs(s2);
+                            print_with_special_exprs(ctx, s2);
+                        }
+                        else if (w2->kw == KW_HEX)
+                        {
+                            accumulate_iconv_run(ctx, s2 + 2);
                         }
-                        else if (s2 && s2[1] == '\'' && s2[2] && s2[3])
+                        else if (w2->kw == KW_HEX_EXPR && s2[2] && s2[3])
                         {
                             int ch = h2toi(&s2[2]);
-                            accumulate_iconv_input(ch);
+                            accumulate_iconv_input(ctx, ch);
                         }
 
                         w2 = w2->next;
                     }
-                    flush_iconv_input();
-                    if (safe_printf(0, op->document_title_end))
+                    flush_iconv_input(ctx);
+                    if (safe_printf(ctx, 0, op->document_title_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "document_title_end");
                     }
                 }
-                else if (!strcmp("\\keywords", s))
+                else if (WORD_IS(child, KW_KEYWORDS))
                 {
-                    if (safe_printf(0, op->document_keywords_begin))
+                    if (safe_printf(ctx, 0, op->document_keywords_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "document_keywords_begin");
                     }
@@ -998,18 +947,18 @@ process_info_group(Word *w)
                         const char *s2 = word_string(w2);
                         if (s2 && s2[0] != '\\')
                         {
-                            printf("%s,", s2);
+                            outbuf_printf(ctx->out, "%s,", s2);
                         }
                         w2 = w2->next;
                     }
-                    if (safe_printf(0, op->document_keywords_end))
+                    if (safe_printf(ctx, 0, op->document_keywords_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "document_keywords_end");
                     }
                 }
-                else if (!strcmp("\\author", s))
+                else if (WORD_IS(child, KW_AUTHOR))
                 {
-                    if (safe_printf(0, op->document_author_begin))
+                    if (safe_printf(ctx, 0, op->document_author_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "document_author_begin");
                     }
@@ -1019,133 +968,133 @@ process_info_group(Word *w)
                         const char *s2 = word_string(w2);
                         if (s2 && s2[0] != '\\')
                         {
-                            printf("%s", s2);
+                            outbuf_puts(ctx->out, s2);
                         }
                         w2 = w2->next;
                     }
-                    if (safe_printf(0, op->document_author_end))
+                    if (safe_printf(ctx, 0, op->document_author_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "document_author_end");
                     }
                 }
-                else if (!strcmp("\\comment", s))
+                else if (WORD_IS(child, KW_COMMENT))
                 {
-                    if (safe_printf(0, op->comment_begin))
+                    if (safe_printf(ctx, 0, op->comment_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                     }
-                    printf("comments: ");
+                    outbuf_printf(ctx->out, "comments: ");
                     w2 = child->next;
                     while (w2)
                     {
                         const char *s2 = word_string(w2);
                         if (s2 && s2[0] != '\\')
                         {
-                            printf("%s", s2);
+                            outbuf_puts(ctx->out, s2);
                         }
                         w2 = w2->next;
                     }
-                    if (safe_printf(0, op->comment_end))
+                    if (safe_printf(ctx, 0, op->comment_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                     }
                 }
-                else if (!strncmp("\\nofpages", s, 9))
+                else if (child->kw == KW_NOFPAGES)
                 {
-                    if (safe_printf(0, op->comment_begin))
+                    if (safe_printf(ctx, 0, op->comment_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                     }
-                    printf("total pages: %s", &s[9]);
-                    if (safe_printf(0, op->comment_end))
+                    outbuf_printf(ctx->out, "total pages: %s", &s[9]);
+                    if (safe_printf(ctx, 0, op->comment_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                     }
                 }
-                else if (!strncmp("\\nofwords", s, 9))
+                else if (child->kw == KW_NOFWORDS)
                 {
-                    if (safe_printf(0, op->comment_begin))
+                    if (safe_printf(ctx, 0, op->comment_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                     }
-                    printf("total words: %s", &s[9]);
-                    if (safe_printf(0, op->comment_end))
+                    outbuf_printf(ctx->out, "total words: %s", &s[9]);
+                    if (safe_printf(ctx, 0, op->comment_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                     }
                 }
-                else if (!strncmp("\\nofchars", s, 9) && isdigit(s[9]))
+                else if (child->kw == KW_NOFCHARS && isdigit(s[9]))
                 {
-                    if (safe_printf(0, op->comment_begin))
+                    if (safe_printf(ctx, 0, op->comment_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                     }
-                    printf("total chars: %s", &s[9]);
-                    if (safe_printf(0, op->comment_end))
+                    outbuf_printf(ctx->out, "total chars: %s", &s[9]);
+                    if (safe_printf(ctx, 0, op->comment_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                     }
                 }
-                else if (!strcmp("\\creatim", s))
+                else if (WORD_IS(child, KW_CREATIM))
                 {
-                    if (safe_printf(0, op->comment_begin))
+                    if (safe_printf(ctx, 0, op->comment_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                     }
-                    printf("creation date: ");
+                    outbuf_printf(ctx->out, "creation date: ");
                     if (child->next)
                     {
-                        word_dump_date(child->next);
+                        word_dump_date(ctx, child->next);
                     }
-                    if (safe_printf(0, op->comment_end))
+                    if (safe_printf(ctx, 0, op->comment_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                     }
                 }
-                else if (!strcmp("\\printim", s))
+                else if (WORD_IS(child, KW_PRINTIM))
                 {
-                    if (safe_printf(0, op->comment_begin))
+                    if (safe_printf(ctx, 0, op->comment_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                     }
-                    printf("last printed: ");
+                    outbuf_printf(ctx->out, "last printed: ");
                     if (child->next)
                     {
-                        word_dump_date(child->next);
+                        word_dump_date(ctx, child->next);
                     }
-                    if (safe_printf(0, op->comment_end))
+                    if (safe_printf(ctx, 0, op->comment_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                     }
                 }
-                else if (!strcmp("\\buptim", s))
+                else if (WORD_IS(child, KW_BUPTIM))
                 {
-                    if (safe_printf(0, op->comment_begin))
+                    if (safe_printf(ctx, 0, op->comment_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                     }
-                    printf("last backup: ");
+                    outbuf_printf(ctx->out, "last backup: ");
                     if (child->next)
                     {
-                        word_dump_date(child->next);
+                        word_dump_date(ctx, child->next);
                     }
-                    if (safe_printf(0, op->comment_end))
+                    if (safe_printf(ctx, 0, op->comment_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                     }
                 }
-                else if (!strcmp("\\revtim", s))
+                else if (WORD_IS(child, KW_REVTIM))
                 {
-                    if (safe_printf(0, op->comment_begin))
+                    if (safe_printf(ctx, 0, op->comment_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                     }
-                    printf("revision date: ");
+                    outbuf_printf(ctx->out, "revision date: ");
                     if (child->next)
                     {
-                        word_dump_date(child->next);
+                        word_dump_date(ctx, child->next);
                     }
-                    if (safe_printf(0, op->comment_end))
+                    if (safe_printf(ctx, 0, op->comment_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                     }
@@ -1155,15 +1104,15 @@ process_info_group(Word *w)
             /* Irregardless of whether we're in inline mode,
              * we want to process the following.
              */
-            if (!strcmp("\\hlinkbase", s))
+            if (WORD_IS(child, KW_HLINKBASE))
             {
                 const char *linkstr = NULL;
 
-                if (safe_printf(0, op->comment_begin))
+                if (safe_printf(ctx, 0, op->comment_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                 }
-                printf("hyperlink base: ");
+                outbuf_printf(ctx->out, "hyperlink base: ");
                 if (child->next)
                 {
                     Word *nextword = child->next;
@@ -1176,19 +1125,19 @@ process_info_group(Word *w)
 
                 if (linkstr)
                 {
-                    printf("%s", linkstr);
+                    outbuf_puts(ctx->out, linkstr);
                 }
                 else
                 {
-                    printf("(none)");
+                    outbuf_printf(ctx->out, "(none)");
                 }
-                if (safe_printf(0, op->comment_end))
+                if (safe_printf(ctx, 0, op->comment_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                 }
 
                 /* Store the pointer, it will remain good. */
-                hyperlink_base = linkstr;
+                ctx->hyperlink_base = linkstr;
             }
         }
         w = w->next;
@@ -1197,27 +1146,15 @@ process_info_group(Word *w)
 
 /*-------------------------------------------------------------------*/
 
-/* RTF color table colors are RGB */
-
-typedef struct
-{
-    unsigned char r, g, b;
-} Color;
-
-#define MAX_COLORS (1024)
-static Color color_table[MAX_COLORS];
-static int total_colors = 0;
-
-
 /*========================================================================
  * Name:    process_color_table
  * Purpose:    Processes the color table of an RTF file.
- * Args:    Tree of words.
+ * Args:    Conversion context, tree of words.
  * Returns:    None.
  *=======================================================================*/
 
 void
-process_color_table(Word *w)
+process_color_table(UnrtfContext *ctx, Word *w)
 {
     int r, g, b;
 
@@ -1232,30 +1169,30 @@ process_color_table(Word *w)
     while (w)
     {
         const char *s = word_string(w);
-        if (s == 0 || total_colors >= MAX_COLORS)
+        if (s == 0 || ctx->total_colors >= MAX_COLORS)
         {
             break;
         }
 
-        if (!strncmp("\\red", s, 4))
+        if (w->kw == KW_RED)
         {
-            r = atoi(&s[4]);
+            r = w->param;
             while (r > 255)
             {
                 r >>= 8;
             }
         }
-        else if (!strncmp("\\green", s, 6))
+        else if (w->kw == KW_GREEN)
         {
-            g = atoi(&s[6]);
+            g = w->param;
             while (g > 255)
             {
                 g >>= 8;
             }
         }
-        else if (!strncmp("\\blue", s, 5))
+        else if (w->kw == KW_BLUE)
         {
-            b = atoi(&s[5]);
+            b = w->param;
             while (b > 255)
             {
                 b >>= 8;
@@ -1268,18 +1205,18 @@ process_color_table(Word *w)
              */
             if (!strcmp(";", s))
             {
-                color_table[total_colors].r = r;
-                color_table[total_colors].g = g;
-                color_table[total_colors++].b = b;
+                ctx->color_table[ctx->total_colors].r = r;
+                ctx->color_table[ctx->total_colors].g = g;
+                ctx->color_table[ctx->total_colors++].b = b;
                 if (debug_mode)
                 {
-                    if (safe_printf(0, op->comment_begin))
+                    if (safe_printf(ctx, 0, op->comment_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                     }
-                    printf("storing color entry %d: %02x%02x%02x",
-                           total_colors - 1, r, g, b);
-                    if (safe_printf(0, op->comment_end))
+                    outbuf_printf(ctx->out, "storing color entry %d: %02x%02x%02x",
+                           ctx->total_colors - 1, r, g, b);
+                    if (safe_printf(ctx, 0, op->comment_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                     }
@@ -1292,12 +1229,12 @@ process_color_table(Word *w)
 
     if (debug_mode)
     {
-        if (safe_printf(0, op->comment_begin))
+        if (safe_printf(ctx, 0, op->comment_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
         }
-        printf("color table had %d entries", total_colors);
-        if (safe_printf(0, op->comment_end))
+        outbuf_printf(ctx->out, "color table had %d entries", ctx->total_colors);
+        if (safe_printf(ctx, 0, op->comment_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_end");
         }
@@ -1307,26 +1244,26 @@ process_color_table(Word *w)
 /*========================================================================
  * Name:    cmd_cf
  * Purpose:    Executes the \cf command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_cf(Word *w, int align, char has_param, int num)
+cmd_cf(UnrtfContext *ctx, Word *w, int align, char has_param, int num)
 {
     char str[40];
 
-    if (!has_param || num < 0 || num >= total_colors)
+    if (!has_param || num < 0 || num >= ctx->total_colors)
     {
         warning_handler("font color change attempted is invalid");
     }
     else
     {
         sprintf(str, "#%02x%02x%02x",
-                color_table[num].r,
-                color_table[num].g,
-                color_table[num].b);
-        attr_push(ATTR_FOREGROUND, str);
+                ctx->color_table[num].r,
+                ctx->color_table[num].g,
+                ctx->color_table[num].b);
+        attr_push(ctx, ATTR_FOREGROUND, str);
     }
     return FALSE;
 }
@@ -1336,26 +1273,26 @@ cmd_cf(Word *w, int align, char has_param, int num)
 /*========================================================================
  * Name:    cmd_cb
  * Purpose:    Executes the \cb command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_cb(Word *w, int align, char has_param, int num)
+cmd_cb(UnrtfContext *ctx, Word *w, int align, char has_param, int num)
 {
     char str[40];
 
-    if (!has_param || num < 0 || num >= total_colors)
+    if (!has_param || num < 0 || num >= ctx->total_colors)
     {
         warning_handler("font color change attempted is invalid");
     }
     else
     {
         sprintf(str, "#%02x%02x%02x",
-                color_table[num].r,
-                color_table[num].g,
-                color_table[num].b);
-        attr_push(ATTR_BACKGROUND, str);
+                ctx->color_table[num].r,
+                ctx->color_table[num].g,
+                ctx->color_table[num].b);
+        attr_push(ctx, ATTR_BACKGROUND, str);
     }
     return FALSE;
 }
@@ -1364,11 +1301,11 @@ cmd_cb(Word *w, int align, char has_param, int num)
 /*========================================================================
  * Name:    cmd_fs
  * Purpose:    Executes the \fs command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_fs(Word *w, int align, char has_param, int points)
+cmd_fs(UnrtfContext *ctx, Word *w, int align, char has_param, int points)
 {
     char str[20];
 
@@ -1381,7 +1318,7 @@ cmd_fs(Word *w, int align, char has_param, int points)
     points /= 2;
 
     sprintf(str, "%d", points);
-    attr_push(ATTR_FONTSIZE, str);
+    attr_push(ctx, ATTR_FONTSIZE, str);
 
     return FALSE;
 }
@@ -1397,12 +1334,12 @@ cmd_fs(Word *w, int align, char has_param, int points)
  *=======================================================================*/
 
 static int
-cmd_field(Word *w, int align, char has_param, int num)
+cmd_field(UnrtfContext *ctx, Word *w, int align, char has_param, int num)
 {
     Word *child;
 
     CHECK_PARAM_NOT_NULL(w);
-    maybeopeniconv();
+    maybeopeniconv(ctx);
     while (w)
     {
         child = w->child;
@@ -1418,20 +1355,19 @@ cmd_field(Word *w, int align, char has_param, int num)
             }
 
 #if 1 /* daved experimenting with fldrslt */
-            if (!strcmp("\\fldrslt", s))
+            if (WORD_IS(child, KW_FLDRSLT))
             {
                 return FALSE;
             }
 #endif
 
 
-            if (!strcmp("\\*", s))
+            if (WORD_IS(child, KW_STAR))
             {
                 w2 = child->next;
                 while (w2)
                 {
-                    const char *s2 = word_string(w2);
-                    if (s2 && !strcmp("\\fldinst", s2))
+                    if (WORD_IS(w2, KW_FLDINST))
                     {
                         Word *w3;
                         const char *s;
@@ -1453,11 +1389,11 @@ cmd_field(Word *w, int align, char has_param, int num)
                                 const char *string;
                                 char_num = atoi(s4);
 
-                                string = op_translate_char(op,
-                                                           FONT_SYMBOL, char_num);
+                                string = op_translate_char(op, FONT_SYMBOL,
+                                                           char_num);
                                 if (string != NULL)
                                 {
-                                    printf("%s", string);
+                                    outbuf_puts(ctx->out, string);
                                     my_free(const_cast<char*>(string));
                                 }
                                 else
@@ -1479,7 +1415,7 @@ cmd_field(Word *w, int align, char has_param, int num)
                             const char *s3 = word_string(w3);
                             if (s3 && !strcmp("EN.CITE", s3))
                             {
-                                EndNoteCitations = TRUE;
+                                ctx->EndNoteCitations = TRUE;
                             }
                             /*
                             ** If we have a file with EndNote
@@ -1491,7 +1427,7 @@ cmd_field(Word *w, int align, char has_param, int num)
                             ** wanted.)
                             */
 
-                            if (s3 && !strcmp("HYPERLINK", s3) && !EndNoteCitations)
+                            if (s3 && !strcmp("HYPERLINK", s3) && !ctx->EndNoteCitations)
                             {
                                 Word *w4;
                                 const char *s4;
@@ -1503,12 +1439,12 @@ cmd_field(Word *w, int align, char has_param, int num)
                                 if (w4)
                                 {
                                     s4 = word_string(w4);
-                                    if (safe_printf(0, op->hyperlink_begin))
+                                    if (safe_printf(ctx, 0, op->hyperlink_begin))
                                     {
                                         fprintf(stderr, TOO_MANY_ARGS, "hyperlink_begin");
                                     }
-                                    printf("%s", s4);
-                                    if (safe_printf(0, op->hyperlink_end))
+                                    outbuf_puts(ctx->out, s4);
+                                    if (safe_printf(ctx, 0, op->hyperlink_end))
                                     {
                                         fprintf(stderr, TOO_MANY_ARGS, "hyperlink_end");
                                     }
@@ -1536,11 +1472,11 @@ cmd_field(Word *w, int align, char has_param, int num)
 /*========================================================================
  * Name:    cmd_f
  * Purpose:    Executes the \f command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_f(Word *w, int align, char has_param, int num)
+cmd_f(UnrtfContext *ctx, Word *w, int align, char has_param, int num)
 {
     char *name;
 
@@ -1549,16 +1485,16 @@ cmd_f(Word *w, int align, char has_param, int num)
     {
         return FALSE;
     }
-    FontEntry *e = lookup_font(num);
+    FontEntry *e = lookup_font(ctx, num);
     name = e ? e->name : NULL;
     if (!e || !name)
     {
-        if (safe_printf(0, op->comment_begin))
+        if (safe_printf(ctx, 0, op->comment_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
         }
-        printf("invalid font number %d", num);
-        if (safe_printf(0, op->comment_end))
+        outbuf_printf(ctx->out, "invalid font number %d", num);
+        if (safe_printf(ctx, 0, op->comment_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_end");
         }
@@ -1575,18 +1511,16 @@ cmd_f(Word *w, int align, char has_param, int num)
         /* we are going to output entities, so should not output font */
         if (strstr(name, "Symbol") == NULL)
         {
-            attr_push(ATTR_FONTFACE, name);
+            attr_push(ctx, ATTR_FONTFACE, name);
         }
 
-        desc = my_iconv_close(desc);
-        char *encoding = default_encoding;
+        char *encoding = ctx->default_encoding;
         if (e->encoding && *e->encoding)
         {
             encoding = e->encoding;
-            attr_push(ATTR_ENCODING, encoding);
+            attr_push(ctx, ATTR_ENCODING, encoding);
         }
-        desc = my_iconv_open(output_encoding, encoding);
-        set_current_encoding(encoding);
+        select_encoding(ctx, encoding);
     }
 
     return FALSE;
@@ -1595,15 +1529,15 @@ cmd_f(Word *w, int align, char has_param, int num)
 /*========================================================================
  * Name:    cmd_deff
  * Purpose:    Executes the \deff command, set default font
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_deff(Word *w, int align, char has_param, int num)
+cmd_deff(UnrtfContext *ctx, Word *w, int align, char has_param, int num)
 {
     if (has_param)
     {
-        default_font_number = num;
+        ctx->default_font_number = num;
     }
     return FALSE;
 }
@@ -1611,26 +1545,26 @@ cmd_deff(Word *w, int align, char has_param, int num)
 /*========================================================================
  * Name:    cmd_highlight
  * Purpose:    Executes the \cf command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_highlight(Word *w, int align, char has_param, int num)
+cmd_highlight(UnrtfContext *ctx, Word *w, int align, char has_param, int num)
 {
     char str[40];
 
-    if (!has_param || num < 0 || num >= total_colors)
+    if (!has_param || num < 0 || num >= ctx->total_colors)
     {
         warning_handler("font background color change attempted is invalid");
     }
     else
     {
         sprintf(str, "#%02x%02x%02x",
-                color_table[num].r,
-                color_table[num].g,
-                color_table[num].b);
-        attr_push(ATTR_BACKGROUND, str);
+                ctx->color_table[num].r,
+                ctx->color_table[num].g,
+                ctx->color_table[num].b);
+        attr_push(ctx, ATTR_BACKGROUND, str);
     }
     return FALSE;
 }
@@ -1640,12 +1574,12 @@ cmd_highlight(Word *w, int align, char has_param, int num)
 /*========================================================================
  * Name:    cmd_tab
  * Purpose:    Executes the \tab command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_tab(Word *w, int align, char has_param, int param)
+cmd_tab(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     /* Tab presents a genuine problem
      * since some output formats don't have
@@ -1653,17 +1587,17 @@ cmd_tab(Word *w, int align, char has_param, int param)
      * assume the font is fixed width and that
      * the tabstops are 8 characters apart.
      */
-    int need = 8 - (total_chars_this_line % 8);
-    total_chars_this_line += need;
+    int need = 8 - (ctx->total_chars_this_line % 8);
+    ctx->total_chars_this_line += need;
     while (need > 0)
     {
-        if (safe_printf(0, op->forced_space))
+        if (safe_printf(ctx, 0, op->forced_space))
         {
             fprintf(stderr, TOO_MANY_ARGS, "forced_space");
         }
         need--;
     }
-    printf("\n");
+    outbuf_printf(ctx->out, "\n");
     return FALSE;
 }
 
@@ -1671,14 +1605,14 @@ cmd_tab(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_plain
  * Purpose:    Executes the \plain command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_plain(Word *w, int align, char has_param, int param)
+cmd_plain(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_pop_all();
+    attr_pop_all(ctx);
     return FALSE;
 }
 
@@ -1686,13 +1620,13 @@ cmd_plain(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_fnil
  * Purpose:    Executes the \fnil command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_fnil(Word *w, int align, char has_param, int param)
+cmd_fnil(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_FONTFACE, FONTNIL_STR);
+    attr_push(ctx, ATTR_FONTFACE, FONTNIL_STR);
     return FALSE;
 }
 
@@ -1701,13 +1635,13 @@ cmd_fnil(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_froman
  * Purpose:    Executes the \froman command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_froman(Word *w, int align, char has_param, int param)
+cmd_froman(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_FONTFACE, FONTROMAN_STR);
+    attr_push(ctx, ATTR_FONTFACE, FONTROMAN_STR);
     return FALSE;
 }
 
@@ -1715,14 +1649,14 @@ cmd_froman(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_fswiss
  * Purpose:    Executes the \fswiss command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_fswiss(Word *w, int align, char has_param, int param)
+cmd_fswiss(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_FONTFACE, FONTSWISS_STR);
+    attr_push(ctx, ATTR_FONTFACE, FONTSWISS_STR);
     return FALSE;
 }
 
@@ -1730,14 +1664,14 @@ cmd_fswiss(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_fmodern
  * Purpose:    Executes the \fmodern command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_fmodern(Word *w, int align, char has_param, int param)
+cmd_fmodern(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_FONTFACE, FONTMODERN_STR);
+    attr_push(ctx, ATTR_FONTFACE, FONTMODERN_STR);
     return FALSE;
 }
 
@@ -1745,54 +1679,54 @@ cmd_fmodern(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_fscript
  * Purpose:    Executes the \fscript command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_fscript(Word *w, int align, char has_param, int param)
+cmd_fscript(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_FONTFACE, FONTSCRIPT_STR);
+    attr_push(ctx, ATTR_FONTFACE, FONTSCRIPT_STR);
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_fdecor
  * Purpose:    Executes the \fdecor command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_fdecor(Word *w, int align, char has_param, int param)
+cmd_fdecor(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_FONTFACE, FONTDECOR_STR);
+    attr_push(ctx, ATTR_FONTFACE, FONTDECOR_STR);
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_ftech
  * Purpose:    Executes the \ftech command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_ftech(Word *w, int align, char has_param, int param)
+cmd_ftech(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_FONTFACE, FONTTECH_STR);
+    attr_push(ctx, ATTR_FONTFACE, FONTTECH_STR);
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_expand
  * Purpose:    Executes the \expand command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_expand(Word *w, int align, char has_param, int param)
+cmd_expand(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     char str[10];
     if (has_param)
@@ -1800,11 +1734,11 @@ cmd_expand(Word *w, int align, char has_param, int param)
         sprintf(str, "%d", param / 4);
         if (!param)
         {
-            attr_pop(ATTR_EXPAND);
+            attr_pop(ctx, ATTR_EXPAND);
         }
         else
         {
-            attr_push(ATTR_EXPAND, str);
+            attr_push(ctx, ATTR_EXPAND, str);
         }
     }
     return FALSE;
@@ -1814,24 +1748,24 @@ cmd_expand(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_emboss
  * Purpose:    Executes the \embo command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_emboss(Word *w, int align, char has_param, int param)
+cmd_emboss(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     char str[10];
     if (has_param && !param)
 #ifdef SUPPORT_UNNESTED
-        attr_find_pop(ATTR_EMBOSS);
+        attr_find_pop(ctx, ATTR_EMBOSS);
 #else
-        attr_pop(ATTR_EMBOSS);
+        attr_pop(ctx, ATTR_EMBOSS);
 #endif
     else
     {
         sprintf(str, "%d", param);
-        attr_push(ATTR_EMBOSS, str);
+        attr_push(ctx, ATTR_EMBOSS, str);
     }
     return FALSE;
 }
@@ -1840,22 +1774,22 @@ cmd_emboss(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_engrave
  * Purpose:    Executes the \impr command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_engrave(Word *w, int align, char has_param, int param)
+cmd_engrave(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     char str[10];
     if (has_param && !param)
     {
-        attr_pop(ATTR_ENGRAVE);
+        attr_pop(ctx, ATTR_ENGRAVE);
     }
     else
     {
         sprintf(str, "%d", param);
-        attr_push(ATTR_ENGRAVE, str);
+        attr_push(ctx, ATTR_ENGRAVE, str);
     }
     return FALSE;
 }
@@ -1863,20 +1797,20 @@ cmd_engrave(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_caps
  * Purpose:    Executes the \caps command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_caps(Word *w, int align, char has_param, int param)
+cmd_caps(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && !param)
     {
-        attr_pop(ATTR_CAPS);
+        attr_pop(ctx, ATTR_CAPS);
     }
     else
     {
-        attr_push(ATTR_CAPS, NULL);
+        attr_push(ctx, ATTR_CAPS, NULL);
     }
     return FALSE;
 }
@@ -1885,19 +1819,19 @@ cmd_caps(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_scaps
  * Purpose:    Executes the \scaps command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_scaps(Word *w, int align, char has_param, int param)
+cmd_scaps(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && !param)
     {
-        attr_pop(ATTR_SMALLCAPS);
+        attr_pop(ctx, ATTR_SMALLCAPS);
     }
     else
     {
-        attr_push(ATTR_SMALLCAPS, NULL);
+        attr_push(ctx, ATTR_SMALLCAPS, NULL);
     }
     return FALSE;
 }
@@ -1906,19 +1840,19 @@ cmd_scaps(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_bullet
  * Purpose:    Executes the \bullet command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_bullet(Word *w, int align, char has_param, int param)
+cmd_bullet(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.bullet)
     {
-        if (safe_printf(0, op->chars.bullet))
+        if (safe_printf(ctx, 0, op->chars.bullet))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.bullet");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -1926,19 +1860,19 @@ cmd_bullet(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_ldblquote
  * Purpose:    Executes the \ldblquote command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_ldblquote(Word *w, int align, char has_param, int param)
+cmd_ldblquote(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.left_dbl_quote)
     {
-        if (safe_printf(0, op->chars.left_dbl_quote))
+        if (safe_printf(ctx, 0, op->chars.left_dbl_quote))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.left_dbl_quote");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -1947,20 +1881,20 @@ cmd_ldblquote(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_rdblquote
  * Purpose:    Executes the \rdblquote command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_rdblquote(Word *w, int align, char has_param, int param)
+cmd_rdblquote(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.right_dbl_quote)
     {
-        if (safe_printf(0, op->chars.right_dbl_quote))
+        if (safe_printf(ctx, 0, op->chars.right_dbl_quote))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.right_dbl_quote");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -1969,19 +1903,19 @@ cmd_rdblquote(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_lquote
  * Purpose:    Executes the \lquote command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_lquote(Word *w, int align, char has_param, int param)
+cmd_lquote(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.left_quote)
     {
-        if (safe_printf(0, op->chars.left_quote))
+        if (safe_printf(ctx, 0, op->chars.left_quote))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.left_quote");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -1990,20 +1924,20 @@ cmd_lquote(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_nonbreaking_space
  * Purpose:    Executes the nonbreaking space command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_nonbreaking_space(Word *w, int align, char has_param, int param)
+cmd_nonbreaking_space(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.nonbreaking_space)
     {
-        if (safe_printf(0, op->chars.nonbreaking_space))
+        if (safe_printf(ctx, 0, op->chars.nonbreaking_space))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.nonbreaking_space");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -2012,20 +1946,20 @@ cmd_nonbreaking_space(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_nonbreaking_hyphen
  * Purpose:    Executes the nonbreaking hyphen command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_nonbreaking_hyphen(Word *w, int align, char has_param, int param)
+cmd_nonbreaking_hyphen(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.nonbreaking_hyphen)
     {
-        if (safe_printf(0, op->chars.nonbreaking_hyphen))
+        if (safe_printf(ctx, 0, op->chars.nonbreaking_hyphen))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.nonbreaking_hyphen");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -2034,20 +1968,20 @@ cmd_nonbreaking_hyphen(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_optional_hyphen
  * Purpose:    Executes the optional hyphen command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_optional_hyphen(Word *w, int align, char has_param, int param)
+cmd_optional_hyphen(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.optional_hyphen)
     {
-        if (safe_printf(0, op->chars.optional_hyphen))
+        if (safe_printf(ctx, 0, op->chars.optional_hyphen))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.optional_hyphen");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -2056,19 +1990,19 @@ cmd_optional_hyphen(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_emdash
  * Purpose:    Executes the \emdash command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_emdash(Word *w, int align, char has_param, int param)
+cmd_emdash(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.emdash)
     {
-        if (safe_printf(0, op->chars.emdash))
+        if (safe_printf(ctx, 0, op->chars.emdash))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.emdash");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -2077,20 +2011,20 @@ cmd_emdash(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_endash
  * Purpose:    Executes the \endash command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_endash(Word *w, int align, char has_param, int param)
+cmd_endash(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.endash)
     {
-        if (safe_printf(0, op->chars.endash))
+        if (safe_printf(ctx, 0, op->chars.endash))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.endash");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -2099,20 +2033,20 @@ cmd_endash(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_rquote
  * Purpose:    Executes the \rquote command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_rquote(Word *w, int align, char has_param, int param)
+cmd_rquote(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->chars.right_quote)
     {
-        if (safe_printf(0, op->chars.right_quote))
+        if (safe_printf(ctx, 0, op->chars.right_quote))
         {
             fprintf(stderr, TOO_MANY_ARGS, "chars.right_quote");
         }
-        ++total_chars_this_line; /* \tab */
+        ++ctx->total_chars_this_line; /* \tab */
     }
     return FALSE;
 }
@@ -2121,19 +2055,19 @@ cmd_rquote(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_par
  * Purpose:    Executes the \par command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 static int
-cmd_par(Word *w, int align, char has_param, int param)
+cmd_par(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->line_break)
     {
-        if (safe_printf(0, op->line_break))
+        if (safe_printf(ctx, 0, op->line_break))
         {
             fprintf(stderr, TOO_MANY_ARGS, "line_break");
         }
-        total_chars_this_line = 0; /* \tab */
+        ctx->total_chars_this_line = 0; /* \tab */
     }
     return FALSE;
 }
@@ -2142,20 +2076,20 @@ cmd_par(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_line
  * Purpose:    Executes the \line command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
 static int
-cmd_line(Word *w, int align, char has_param, int param)
+cmd_line(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->line_break)
     {
-        if (safe_printf(0, op->line_break))
+        if (safe_printf(ctx, 0, op->line_break))
         {
             fprintf(stderr, TOO_MANY_ARGS, "line_break");
         }
-        total_chars_this_line = 0; /* \tab */
+        ctx->total_chars_this_line = 0; /* \tab */
     }
     return FALSE;
 }
@@ -2164,19 +2098,19 @@ cmd_line(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_page
  * Purpose:    Executes the \page command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_page(Word *w, int align, char has_param, int param)
+static int cmd_page(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->page_break)
     {
-        if (safe_printf(0, op->page_break))
+        if (safe_printf(ctx, 0, op->page_break))
         {
             fprintf(stderr, TOO_MANY_ARGS, "page_break");
         }
-        total_chars_this_line = 0; /* \tab */
+        ctx->total_chars_this_line = 0; /* \tab */
     }
     return FALSE;
 }
@@ -2185,15 +2119,15 @@ static int cmd_page(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_intbl
  * Purpose:    Executes the \intbl command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_intbl(Word *w, int align, char has_param, int param)
+static int cmd_intbl(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    ++coming_pars_that_are_tabular;
+    ++ctx->coming_pars_that_are_tabular;
 
-    check_for_table();
+    check_for_table(ctx);
 
     return FALSE;
 }
@@ -2202,40 +2136,40 @@ static int cmd_intbl(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_ulnone
  * Purpose:    Executes the \ulnone command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ulnone(Word *w, int align, char has_param, int param)
-{
-    attr_find_pop(ATTR_UNDERLINE);
-    attr_find_pop(ATTR_DOT_UL);
-    attr_find_pop(ATTR_DASH_UL);
-    attr_find_pop(ATTR_DOT_DASH_UL);
-    attr_find_pop(ATTR_2DOT_DASH_UL);
-    attr_find_pop(ATTR_WORD_UL);
-    attr_find_pop(ATTR_WAVE_UL);
-    attr_find_pop(ATTR_THICK_UL);
-    attr_find_pop(ATTR_DOUBLE_UL);
+static int cmd_ulnone(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
+{
+    attr_find_pop(ctx, ATTR_UNDERLINE);
+    attr_find_pop(ctx, ATTR_DOT_UL);
+    attr_find_pop(ctx, ATTR_DASH_UL);
+    attr_find_pop(ctx, ATTR_DOT_DASH_UL);
+    attr_find_pop(ctx, ATTR_2DOT_DASH_UL);
+    attr_find_pop(ctx, ATTR_WORD_UL);
+    attr_find_pop(ctx, ATTR_WAVE_UL);
+    attr_find_pop(ctx, ATTR_THICK_UL);
+    attr_find_pop(ctx, ATTR_DOUBLE_UL);
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_ul
  * Purpose:    Executes the \ul command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ul(Word *w, int align, char has_param, int param)
+static int cmd_ul(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        cmd_ulnone(w, align, has_param, param);
+        cmd_ulnone(ctx, w, align, has_param, param);
     }
     else
     {
-        attr_push(ATTR_UNDERLINE, NULL);
+        attr_push(ctx, ATTR_UNDERLINE, NULL);
     }
     return FALSE;
 }
@@ -2243,26 +2177,26 @@ static int cmd_ul(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_uld
  * Purpose:    Executes the \uld command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_uld(Word *w, int align, char has_param, int param)
+static int cmd_uld(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_DOUBLE_UL, NULL);
+    attr_push(ctx, ATTR_DOUBLE_UL, NULL);
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_uldb
  * Purpose:    Executes the \uldb command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_uldb(Word *w, int align, char has_param, int param)
+static int cmd_uldb(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_DOT_UL, NULL);
+    attr_push(ctx, ATTR_DOT_UL, NULL);
     return FALSE;
 }
 
@@ -2270,13 +2204,13 @@ static int cmd_uldb(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_uldash
  * Purpose:    Executes the \uldash command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_uldash(Word *w, int align, char has_param, int param)
+static int cmd_uldash(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_DASH_UL, NULL);
+    attr_push(ctx, ATTR_DASH_UL, NULL);
     return FALSE;
 }
 
@@ -2284,13 +2218,13 @@ static int cmd_uldash(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_uldashd
  * Purpose:    Executes the \cmd_uldashd command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_uldashd(Word *w, int align, char has_param, int param)
+static int cmd_uldashd(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_DOT_DASH_UL, NULL);
+    attr_push(ctx, ATTR_DOT_DASH_UL, NULL);
     return FALSE;
 }
 
@@ -2298,13 +2232,13 @@ static int cmd_uldashd(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_uldashdd
  * Purpose:    Executes the \uldashdd command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_uldashdd(Word *w, int align, char has_param, int param)
+static int cmd_uldashdd(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_2DOT_DASH_UL, NULL);
+    attr_push(ctx, ATTR_2DOT_DASH_UL, NULL);
     return FALSE;
 }
 
@@ -2312,13 +2246,13 @@ static int cmd_uldashdd(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_ulw
  * Purpose:    Executes the \ulw command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ulw(Word *w, int align, char has_param, int param)
+static int cmd_ulw(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_WORD_UL, NULL);
+    attr_push(ctx, ATTR_WORD_UL, NULL);
     return FALSE;
 }
 
@@ -2326,13 +2260,13 @@ static int cmd_ulw(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_ulth
  * Purpose:    Executes the \ulth command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ulth(Word *w, int align, char has_param, int param)
+static int cmd_ulth(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_THICK_UL, NULL);
+    attr_push(ctx, ATTR_THICK_UL, NULL);
     return FALSE;
 }
 
@@ -2340,13 +2274,13 @@ static int cmd_ulth(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_ulthd
  * Purpose:    Executes the \ulthd command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ulthd(Word *w, int align, char has_param, int param)
+static int cmd_ulthd(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_THICK_UL, NULL);
+    attr_push(ctx, ATTR_THICK_UL, NULL);
     return FALSE;
 }
 
@@ -2354,13 +2288,13 @@ static int cmd_ulthd(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_ulthdash
  * Purpose:    Executes the \ulthdash command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ulthdash(Word *w, int align, char has_param, int param)
+static int cmd_ulthdash(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_THICK_UL, NULL);
+    attr_push(ctx, ATTR_THICK_UL, NULL);
     return FALSE;
 }
 
@@ -2368,13 +2302,13 @@ static int cmd_ulthdash(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_ulwave
  * Purpose:    Executes the \ulwave command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ulwave(Word *w, int align, char has_param, int param)
+static int cmd_ulwave(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_push(ATTR_WAVE_UL, NULL);
+    attr_push(ctx, ATTR_WAVE_UL, NULL);
     return FALSE;
 }
 
@@ -2382,19 +2316,19 @@ static int cmd_ulwave(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_strike
  * Purpose:    Executes the \strike command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_strike(Word *w, int align, char has_param, int param)
+static int cmd_strike(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        attr_pop(ATTR_STRIKE);
+        attr_pop(ctx, ATTR_STRIKE);
     }
     else
     {
-        attr_push(ATTR_STRIKE, NULL);
+        attr_push(ctx, ATTR_STRIKE, NULL);
     }
     return FALSE;
 }
@@ -2402,19 +2336,19 @@ static int cmd_strike(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_strikedl
  * Purpose:    Executes the \strikedl command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_strikedl(Word *w, int align, char has_param, int param)
+static int cmd_strikedl(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        attr_pop(ATTR_DBL_STRIKE);
+        attr_pop(ctx, ATTR_DBL_STRIKE);
     }
     else
     {
-        attr_push(ATTR_DBL_STRIKE, NULL);
+        attr_push(ctx, ATTR_DBL_STRIKE, NULL);
     }
     return FALSE;
 }
@@ -2423,19 +2357,19 @@ static int cmd_strikedl(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_striked
  * Purpose:    Executes the \striked command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_striked(Word *w, int align, char has_param, int param)
+static int cmd_striked(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        attr_pop(ATTR_DBL_STRIKE);
+        attr_pop(ctx, ATTR_DBL_STRIKE);
     }
     else
     {
-        attr_push(ATTR_DBL_STRIKE, NULL);
+        attr_push(ctx, ATTR_DBL_STRIKE, NULL);
     }
     return FALSE;
 }
@@ -2444,11 +2378,11 @@ static int cmd_striked(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_rtf
  * Purpose:    Executes the \rtf command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_rtf(Word *w, int align, char has_param, int param)
+static int cmd_rtf(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return FALSE;
 }
@@ -2456,11 +2390,11 @@ static int cmd_rtf(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_shppict
  * Purpose:    Executes the \shppict command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_shppict(Word *w, int align, char has_param, int param)
+static int cmd_shppict(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return FALSE;
 }
@@ -2468,19 +2402,19 @@ static int cmd_shppict(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_up
  * Purpose:    Executes the \up command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_up(Word *w, int align, char has_param, int param)
+static int cmd_up(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        attr_pop(ATTR_SUPER);
+        attr_pop(ctx, ATTR_SUPER);
     }
     else
     {
-        attr_push(ATTR_SUPER, NULL);
+        attr_push(ctx, ATTR_SUPER, NULL);
     }
     return FALSE;
 }
@@ -2488,11 +2422,11 @@ static int cmd_up(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_u
  * Purpose:    Processes a Unicode character
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, always false
  *=======================================================================*/
 
-static int cmd_u(Word *w, int align, char has_param, int param)
+static int cmd_u(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     /* TODO: Unicode characters won't be correctly preprocessed if sizeof(int) < 4
      *      and document have unicode character which value is greater than 65536
@@ -2519,9 +2453,26 @@ static int cmd_u(Word *w, int align, char has_param, int param)
     /* 0.20.3 - daved added missing function call for unprocessed chars */
     if ((alias = get_alias(op, param)) != NULL)
     {
-        printf("%s", alias);
+        outbuf_puts(ctx->out, alias);
         done++;
     }
+    else if (!done && op->utf8_output)
+    {
+        if (unicode_number < 0)
+        {
+            /* RTF spec: Unicode values beyond 32767 are represented by negative numbers */
+            unicode_number += 65536;
+        }
+        if (unicode_number > 0 && unicode_number < 0x110000)
+        {
+            /* Surrogate pairs are combined by the parser (see
+               read_unicode_run()); a surrogate left here is alone */
+            int paired;
+            unicode_number = unicode_from_utf16(unicode_number, -1, &paired);
+            outbuf_write(ctx->out, tmp, unicode_to_utf8_buf(unicode_number, tmp));
+            done++;
+        }
+    }
     else if (!done && op->unisymbol_print)
     {
         if (unicode_number < 0)
@@ -2531,7 +2482,7 @@ static int cmd_u(Word *w, int align, char has_param, int param)
         }
         sprintf(tmp, "%ld", unicode_number);
 
-        if (safe_printf(1, op->unisymbol_print, tmp))
+        if (safe_printf(ctx, 1, op->unisymbol_print, tmp))
         {
             fprintf(stderr, TOO_MANY_ARGS, "unisymbol_print");
         }
@@ -2550,22 +2501,72 @@ static int cmd_u(Word *w, int align, char has_param, int param)
     return (FALSE);
 }
 
+/*========================================================================
+ * Name:    print_unicode_run
+ * Purpose:    Prints a run of \uN characters read by the parser (see
+ *        read_unicode_run()), whose fallbacks are already skipped.
+ *        With utf8_output the UTF-8 text is copied as it is, aliases
+ *        aside; otherwise each character goes through unisymbol_print
+ *        as in cmd_u().
+ * Args:    Conversion context, UTF-8 text.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+print_unicode_run(UnrtfContext *ctx, const char *s)
+{
+    const unsigned char *p = (const unsigned char *) s;
+    char tmp[12];
+    const char *alias;
+
+    if (op->utf8_output)
+    {
+        op_print_utf8(op, ctx->out, s, strlen(s));
+        return;
+    }
+    while (*p)
+    {
+        long unicode_number = *p++;
+        if (unicode_number >= 0xC0)
+        {
+            int more = unicode_number >= 0xF0 ? 3 : unicode_number >= 0xE0 ? 2 : 1;
+            unicode_number &= 0x3F >> more;
+            while (more-- && *p)
+            {
+                unicode_number = (unicode_number << 6) | (*p++ & 0x3F);
+            }
+        }
+        if ((alias = get_alias(op, unicode_number)) != NULL)
+        {
+            outbuf_puts(ctx->out, alias);
+        }
+        else
+        {
+            sprintf(tmp, "%ld", unicode_number);
+            if (safe_printf(ctx, 1, op->unisymbol_print, tmp))
+            {
+                fprintf(stderr, TOO_MANY_ARGS, "unisymbol_print");
+            }
+        }
+    }
+}
+
 /*========================================================================
  * Name:    cmd_dn
  * Purpose:    Executes the \dn command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_dn(Word *w, int align, char has_param, int param)
+static int cmd_dn(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        attr_pop(ATTR_SUB);
+        attr_pop(ctx, ATTR_SUB);
     }
     else
     {
-        attr_push(ATTR_SUB, NULL);
+        attr_push(ctx, ATTR_SUB, NULL);
     }
     return FALSE;
 }
@@ -2573,33 +2574,33 @@ static int cmd_dn(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_nosupersub
  * Purpose:    Executes the \nosupersub command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_nosupersub(Word *w, int align, char has_param, int param)
+static int cmd_nosupersub(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    attr_pop(ATTR_SUPER);
-    attr_pop(ATTR_SUB);
+    attr_pop(ctx, ATTR_SUPER);
+    attr_pop(ctx, ATTR_SUB);
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_super
  * Purpose:    Executes the \super command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_super(Word *w, int align, char has_param, int param)
+static int cmd_super(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        attr_pop(ATTR_SUPER);
+        attr_pop(ctx, ATTR_SUPER);
     }
     else
     {
-        attr_push(ATTR_SUPER, NULL);
+        attr_push(ctx, ATTR_SUPER, NULL);
     }
     return FALSE;
 }
@@ -2607,19 +2608,19 @@ static int cmd_super(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_sub
  * Purpose:    Executes the \sub command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_sub(Word *w, int align, char has_param, int param)
+static int cmd_sub(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        attr_pop(ATTR_SUB);
+        attr_pop(ctx, ATTR_SUB);
     }
     else
     {
-        attr_push(ATTR_SUB, NULL);
+        attr_push(ctx, ATTR_SUB, NULL);
     }
     return FALSE;
 }
@@ -2627,19 +2628,19 @@ static int cmd_sub(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_shad
  * Purpose:    Executes the \shad command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_shad(Word *w, int align, char has_param, int param)
+static int cmd_shad(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        attr_pop(ATTR_SHADOW);
+        attr_pop(ctx, ATTR_SHADOW);
     }
     else
     {
-        attr_push(ATTR_SHADOW, NULL);
+        attr_push(ctx, ATTR_SHADOW, NULL);
     }
     return FALSE;
 }
@@ -2647,25 +2648,25 @@ static int cmd_shad(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_b
  * Purpose:    Executes the \b command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 #define SUPPORT_UNNESTED
 
 static int
-cmd_b(Word *w, int align, char has_param, int param)
+cmd_b(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
 #ifdef SUPPORT_UNNESTED
-        attr_find_pop(ATTR_BOLD);
+        attr_find_pop(ctx, ATTR_BOLD);
 #else
-        attr_pop(ATTR_BOLD);
+        attr_pop(ctx, ATTR_BOLD);
 #endif
     }
     else
     {
-        attr_push(ATTR_BOLD, NULL);
+        attr_push(ctx, ATTR_BOLD, NULL);
     }
     return FALSE;
 }
@@ -2673,21 +2674,21 @@ cmd_b(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_i
  * Purpose:    Executes the \i command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_i(Word *w, int align, char has_param, int param)
+static int cmd_i(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
 #ifdef SUPPORT_UNNESTED
-        attr_find_pop(ATTR_ITALIC);
+        attr_find_pop(ctx, ATTR_ITALIC);
 #else
-        attr_pop(ATTR_ITALIC);
+        attr_pop(ctx, ATTR_ITALIC);
 #endif
     else
     {
-        attr_push(ATTR_ITALIC, NULL);
+        attr_push(ctx, ATTR_ITALIC, NULL);
     }
     return FALSE;
 }
@@ -2695,10 +2696,10 @@ static int cmd_i(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_s
  * Purpose:    Executes the \s command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
-static int cmd_s(Word *w, int align, char has_param, int param)
+static int cmd_s(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return FALSE;
 }
@@ -2706,16 +2707,16 @@ static int cmd_s(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_sect
  * Purpose:    Executes the \sect command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_sect(Word *w, int align, char has_param, int param)
+static int cmd_sect(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     /* XX kludge */
     if (op->paragraph_begin)
     {
-        if (safe_printf(0, op->paragraph_begin))
+        if (safe_printf(ctx, 0, op->paragraph_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "paragraph_begin");
         }
@@ -2726,20 +2727,20 @@ static int cmd_sect(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_shp
  * Purpose:    Executes the \shp command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_shp(Word *w, int align, char has_param, int param)
+static int cmd_shp(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (op->comment_begin)
     {
-        if (safe_printf(0, op->comment_begin))
+        if (safe_printf(ctx, 0, op->comment_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
         }
-        printf("Drawn Shape (ignored-not implemented yet)");
-        if (safe_printf(0, op->comment_end))
+        outbuf_printf(ctx->out, "Drawn Shape (ignored-not implemented yet)");
+        if (safe_printf(ctx, 0, op->comment_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_end");
         }
@@ -2751,19 +2752,19 @@ static int cmd_shp(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_outl
  * Purpose:    Executes the \outl command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_outl(Word *w, int align, char has_param, int param)
+static int cmd_outl(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (has_param && param == 0)
     {
-        attr_pop(ATTR_OUTLINE);
+        attr_pop(ctx, ATTR_OUTLINE);
     }
     else
     {
-        attr_push(ATTR_OUTLINE, NULL);
+        attr_push(ctx, ATTR_OUTLINE, NULL);
     }
     return FALSE;
 }
@@ -2771,81 +2772,81 @@ static int cmd_outl(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_ansi
  * Purpose:    Executes the \ansi command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ansi(Word *w, int align, char has_param, int param)
+static int cmd_ansi(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    default_encoding = "CP1252";
+    ctx->default_encoding = "CP1252";
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_ansicpg
  * Purpose:    Executes the \ansicpg command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ansicpg(Word *w, int align, char has_param, int param)
+static int cmd_ansicpg(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    default_encoding = cptoencoding(param);
-    had_ansicpg = 1;
+    ctx->default_encoding = cptoencoding(param);
+    ctx->had_ansicpg = 1;
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_pc
  * Purpose:    Executes the \pc command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_pc(Word *w, int align, char has_param, int param)
+static int cmd_pc(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    default_encoding = "CP437";
+    ctx->default_encoding = "CP437";
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_pca
  * Purpose:    Executes the \pca command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_pca(Word *w, int align, char has_param, int param)
+static int cmd_pca(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    default_encoding = "CP850";
+    ctx->default_encoding = "CP850";
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_mac
  * Purpose:    Executes the \mac command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_mac(Word *w, int align, char has_param, int param)
+static int cmd_mac(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    default_encoding = "MAC";
+    ctx->default_encoding = "MAC";
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_colortbl
  * Purpose:    Executes the \colortbl command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_colortbl(Word *w, int align, char has_param, int param)
+static int cmd_colortbl(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (w->next)
     {
-        process_color_table(w->next);
+        process_color_table(ctx, w->next);
     }
     return TRUE;
 }
@@ -2853,15 +2854,15 @@ static int cmd_colortbl(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_fonttbl
  * Purpose:    Executes the \fonttbl command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_fonttbl(Word *w, int align, char has_param, int param)
+static int cmd_fonttbl(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     if (w->next)
     {
-        process_font_table(w->next);
+        process_font_table(ctx, w->next);
     }
     return TRUE;
 }
@@ -2869,11 +2870,11 @@ static int cmd_fonttbl(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_header
  * Purpose:    Executes the \header command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_header(Word *w, int align, char has_param, int param)
+static int cmd_header(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -2881,11 +2882,11 @@ static int cmd_header(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_headerl
  * Purpose:    Executes the \headerl command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_headerl(Word *w, int align, char has_param, int param)
+static int cmd_headerl(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -2893,11 +2894,11 @@ static int cmd_headerl(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_headerr
  * Purpose:    Executes the \headerr command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_headerr(Word *w, int align, char has_param, int param)
+static int cmd_headerr(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -2905,11 +2906,11 @@ static int cmd_headerr(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_headerf
  * Purpose:    Executes the \headerf command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_headerf(Word *w, int align, char has_param, int param)
+static int cmd_headerf(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -2917,11 +2918,11 @@ static int cmd_headerf(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_footer
  * Purpose:    Executes the \footer command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_footer(Word *w, int align, char has_param, int param)
+static int cmd_footer(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -2929,11 +2930,11 @@ static int cmd_footer(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_footerl
  * Purpose:    Executes the \footerl command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_footerl(Word *w, int align, char has_param, int param)
+static int cmd_footerl(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -2941,11 +2942,11 @@ static int cmd_footerl(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_footerr
  * Purpose:    Executes the \footerr command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_footerr(Word *w, int align, char has_param, int param)
+static int cmd_footerr(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -2953,11 +2954,11 @@ static int cmd_footerr(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_footerf
  * Purpose:    Executes the \footerf command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_footerf(Word *w, int align, char has_param, int param)
+static int cmd_footerf(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -2965,11 +2966,11 @@ static int cmd_footerf(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_ignore
  * Purpose:    Dummy function to get rid of subgroups
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_ignore(Word *w, int align, char has_param, int param)
+static int cmd_ignore(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -2979,11 +2980,11 @@ static int cmd_ignore(Word *w, int align, char has_param, int param)
  * Purpose:  Called when encountering {\* which specifies that the whole
  *           group should be discarded if the immediately following command is
  *           not known.
- * Args:     Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:  Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_maybe_ignore(Word *w, int align, char has_param, int param)
+static int cmd_maybe_ignore(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     /* If the next command is known, we let it decide what to do
      * (which may still be to discard the group. If it is not found
@@ -2991,9 +2992,9 @@ static int cmd_maybe_ignore(Word *w, int align, char has_param, int param)
      */
     if (w && w->next)
     {
-        int hasparam, param;
         const char *s = word_string(w->next);
-        if (s && s[0] == '\\' && find_command(s + 1, &hasparam, &param))
+        if (s && s[0] == '\\' && (w->next->kw == KW_UNICODE ||
+                                 find_command(ctx, (Keyword) w->next->kw, s + 1)))
         {
             return FALSE;
         }
@@ -3005,11 +3006,11 @@ static int cmd_maybe_ignore(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_blipuid
  * Purpose:    Dummy function to get rid of uid
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_blipuid(Word *w, int align, char has_param, int param)
+static int cmd_blipuid(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     CHECK_PARAM_NOT_NULL(w);
     return TRUE;
@@ -3018,38 +3019,38 @@ static int cmd_blipuid(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_info
  * Purpose:    Executes the \info command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_info(Word *w, int align, char has_param, int param)
+static int cmd_info(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    process_info_group(w->next);
+    process_info_group(ctx, w->next);
     return TRUE;
 }
 
 /*========================================================================
  * Name:    cmd_pict
  * Purpose:    Executes the \pict command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_pict(Word *w, int align, char has_param, int param)
+static int cmd_pict(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    within_picture = TRUE;
-    picture_width = picture_height = 0;
-    picture_type = PICT_WB;
+    ctx->within_picture = TRUE;
+    ctx->picture_width = ctx->picture_height = 0;
+    ctx->picture_type = PICT_WB;
     return FALSE;
 }
 /*========================================================================
  * Name:    cmd_picprop
  * Purpose:    Executes the \picprop
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_picprop(Word *w, int align, char has_param, int param)
+static int cmd_picprop(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return TRUE;
 }
@@ -3058,11 +3059,11 @@ static int cmd_picprop(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_bin
  * Purpose:    Executes the \bin command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_bin(Word *w, int align, char has_param, int param)
+static int cmd_bin(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
     return FALSE;
 }
@@ -3071,109 +3072,109 @@ static int cmd_bin(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_macpict
  * Purpose:    Executes the \macpict command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_macpict(Word *w, int align, char has_param, int param)
+static int cmd_macpict(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    picture_type = PICT_MAC;
+    ctx->picture_type = PICT_MAC;
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_jpegblip
  * Purpose:    Executes the \jpegblip command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_jpegblip(Word *w, int align, char has_param, int param)
+static int cmd_jpegblip(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    picture_type = PICT_JPEG;
+    ctx->picture_type = PICT_JPEG;
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_pngblip
  * Purpose:    Executes the \pngblip command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_pngblip(Word *w, int align, char has_param, int param)
+static int cmd_pngblip(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    picture_type = PICT_PNG;
+    ctx->picture_type = PICT_PNG;
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_emfblip
  * Purpose:    Executes the \emfblip command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_emfblip(Word *w, int align, char has_param, int param)
+static int cmd_emfblip(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    picture_type = PICT_EMF;
+    ctx->picture_type = PICT_EMF;
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_pnmetafile
  * Purpose:    Executes the \pnmetafile command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_pnmetafile(Word *w, int align, char has_param, int param)
+static int cmd_pnmetafile(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    picture_type = PICT_PM;
+    ctx->picture_type = PICT_PM;
     return FALSE;
 }
 
 /*========================================================================
  * Name:    cmd_wmetafile
  * Purpose:    Executes the \wmetafile command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_wmetafile(Word *w, int align, char has_param, int param)
+static int cmd_wmetafile(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    picture_type = PICT_WM;
-    if (within_picture && has_param)
+    ctx->picture_type = PICT_WM;
+    if (ctx->within_picture && has_param)
     {
-        picture_wmetafile_type = param;
+        ctx->picture_wmetafile_type = param;
         switch (param)
         {
         case 1:
-            picture_wmetafile_type_str = "MM_TEXT";
+            ctx->picture_wmetafile_type_str = "MM_TEXT";
             break;
         case 2:
-            picture_wmetafile_type_str = "MM_LOMETRIC";
+            ctx->picture_wmetafile_type_str = "MM_LOMETRIC";
             break;
         case 3:
-            picture_wmetafile_type_str = "MM_HIMETRIC";
+            ctx->picture_wmetafile_type_str = "MM_HIMETRIC";
             break;
         case 4:
-            picture_wmetafile_type_str = "MM_LOENGLISH";
+            ctx->picture_wmetafile_type_str = "MM_LOENGLISH";
             break;
         case 5:
-            picture_wmetafile_type_str = "MM_HIENGLISH";
+            ctx->picture_wmetafile_type_str = "MM_HIENGLISH";
             break;
         case 6:
-            picture_wmetafile_type_str = "MM_TWIPS";
+            ctx->picture_wmetafile_type_str = "MM_TWIPS";
             break;
         case 7:
-            picture_wmetafile_type_str = "MM_ISOTROPIC";
+            ctx->picture_wmetafile_type_str = "MM_ISOTROPIC";
             break;
         case 8:
-            picture_wmetafile_type_str = "MM_ANISOTROPIC";
+            ctx->picture_wmetafile_type_str = "MM_ANISOTROPIC";
             break;
         default:
-            picture_wmetafile_type_str = "default:MM_TEXT";
+            ctx->picture_wmetafile_type_str = "default:MM_TEXT";
             break;
         }
     }
@@ -3183,15 +3184,15 @@ static int cmd_wmetafile(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_wbmbitspixel
  * Purpose:    Executes the \wbmbitspixel command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_wbmbitspixel(Word *w, int align, char has_param, int param)
+static int cmd_wbmbitspixel(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    if (within_picture && has_param)
+    if (ctx->within_picture && has_param)
     {
-        picture_bits_per_pixel = param;
+        ctx->picture_bits_per_pixel = param;
     }
     return FALSE;
 }
@@ -3199,15 +3200,15 @@ static int cmd_wbmbitspixel(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_picw
  * Purpose:    Executes the \picw command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_picw(Word *w, int align, char has_param, int param)
+static int cmd_picw(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    if (within_picture && has_param)
+    if (ctx->within_picture && has_param)
     {
-        picture_width = param;
+        ctx->picture_width = param;
     }
     return FALSE;
 }
@@ -3215,15 +3216,15 @@ static int cmd_picw(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_pich
  * Purpose:    Executes the \pich command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_pich(Word *w, int align, char has_param, int param)
+static int cmd_pich(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    if (within_picture && has_param)
+    if (ctx->within_picture && has_param)
     {
-        picture_height = param;
+        ctx->picture_height = param;
     }
     return FALSE;
 }
@@ -3232,45 +3233,45 @@ static int cmd_pich(Word *w, int align, char has_param, int param)
 /*========================================================================
  * Name:    cmd_xe
  * Purpose:    Executes the \xe (index entry) command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_xe(Word *w, int align, char has_param, int param)
+static int cmd_xe(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    process_index_entry(w);
+    process_index_entry(ctx, w);
     return TRUE;
 }
 
 /*========================================================================
  * Name:    cmd_tc
  * Purpose:    Executes the \tc (TOC entry) command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_tc(Word *w, int align, char has_param, int param)
+static int cmd_tc(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    process_toc_entry(w, TRUE);
+    process_toc_entry(ctx, w, TRUE);
     return TRUE;
 }
 
 /*========================================================================
  * Name:    cmd_tcn
  * Purpose:    Executes the \tcn (TOC entry, no page #) command.
- * Args:    Word, paragraph align info, and numeric param if any.
+ * Args:    Conversion context, word, paragraph align info, and numeric param if any.
  * Returns:    Flag, true only if rest of Words on line should be ignored.
  *=======================================================================*/
 
-static int cmd_tcn(Word *w, int align, char has_param, int param)
+static int cmd_tcn(UnrtfContext *ctx, Word *w, int align, char has_param, int param)
 {
-    process_toc_entry(w, FALSE);
+    process_toc_entry(ctx, w, FALSE);
     return TRUE;
 }
 
 
 /* All of the possible commands that RTF might recognize. */
-static HashItem hashArray_other [] =
+static HashItem commands[] =
 {
     /* 0.21.7
      *    the "*" command was ignored in earlier versions, but included pictures
@@ -3280,388 +3281,308 @@ static HashItem hashArray_other [] =
      *    follows.  On simple tests this seems to work.  - daved
      */
 #if 0
-    { "*", cmd_ignore, NULL },
+    { KW_STAR, cmd_ignore, NULL },
 #else
-    { "*", cmd_maybe_ignore, NULL },
+    { KW_STAR, cmd_maybe_ignore, NULL },
 #endif
-    { "-", cmd_optional_hyphen, "optional hyphen" },
-    { "_", cmd_nonbreaking_hyphen, "nonbreaking hyphen" },
-    { "~", cmd_nonbreaking_space, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_a [] =
-{
-    { "ansi", &cmd_ansi , NULL },
-    { "ansicpg", &cmd_ansicpg , NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_b [] =
-{
-    { "b", &cmd_b, NULL },
-    { "bullet", &cmd_bullet, NULL },
-    { "bin", &cmd_bin, "picture is binary" },
-    { "blipuid", &cmd_blipuid, NULL },
+    { KW_OPTIONAL_HYPHEN, cmd_optional_hyphen, "optional hyphen" },
+    { KW_NONBREAKING_HYPHEN, cmd_nonbreaking_hyphen, "nonbreaking hyphen" },
+    { KW_NONBREAKING_SPACE, cmd_nonbreaking_space, NULL },
+    { KW_ANSI, &cmd_ansi , NULL },
+    { KW_ANSICPG, &cmd_ansicpg , NULL },
+    { KW_B, &cmd_b, NULL },
+    { KW_BULLET, &cmd_bullet, NULL },
+    { KW_BIN, &cmd_bin, "picture is binary" },
+    { KW_BLIPUID, &cmd_blipuid, NULL },
 #if 0
-    { "bgbdiag", NULL, NULL },
-    { "bgcross", NULL, NULL },
-    { "bgdcross", NULL, NULL },
-    { "bgfdiag", NULL, NULL },
-    { "bghoriz", NULL, NULL },
-    { "bgkbdiag", NULL, NULL },
-    { "bgkcross", NULL, NULL },
-    { "bgkdcross", NULL, NULL },
-    { "bgkfdiag", NULL, NULL },
-    { "bgkhoriz", NULL, NULL },
-    { "bgkvert", NULL, NULL },
-    { "bgvert", NULL, NULL },
-    { "brdrcf", NULL, NULL },
-    { "brdrdb", NULL, NULL },
-    { "brdrdot", NULL, NULL },
-    { "brdrhair", NULL, NULL },
-    { "brdrs", NULL, NULL },
-    { "brdrsh", NULL, NULL },
-    { "brdrth", NULL, NULL },
-    { "brdrw", NULL, NULL },
+    { KW_BGBDIAG, NULL, NULL },
+    { KW_BGCROSS, NULL, NULL },
+    { KW_BGDCROSS, NULL, NULL },
+    { KW_BGFDIAG, NULL, NULL },
+    { KW_BGHORIZ, NULL, NULL },
+    { KW_BGKBDIAG, NULL, NULL },
+    { KW_BGKCROSS, NULL, NULL },
+    { KW_BGKDCROSS, NULL, NULL },
+    { KW_BGKFDIAG, NULL, NULL },
+    { KW_BGKHORIZ, NULL, NULL },
+    { KW_BGKVERT, NULL, NULL },
+    { KW_BGVERT, NULL, NULL },
+    { KW_BRDRCF, NULL, NULL },
+    { KW_BRDRDB, NULL, NULL },
+    { KW_BRDRDOT, NULL, NULL },
+    { KW_BRDRHAIR, NULL, NULL },
+    { KW_BRDRS, NULL, NULL },
+    { KW_BRDRSH, NULL, NULL },
+    { KW_BRDRTH, NULL, NULL },
+    { KW_BRDRW, NULL, NULL },
 #endif
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_c [] =
-{
-    { "caps", &cmd_caps, NULL },
-    { "cb", cmd_cb, NULL },
-    { "cf", cmd_cf, NULL },
-    { "colortbl", &cmd_colortbl, "color table" },
-    { "cols", NULL, "columns (not implemented)" },
-    { "column", NULL, "column break (not implemented)" },
-    { "cbpat", NULL, "Paragraph Shading" },
-    { "cellx", NULL, "Table Definitions" },
-    { "cfpat", NULL, NULL },
-    { "cgrid", NULL, NULL },
-    { "charrsid", NULL, "Revision Mark (ignore)" },
-    { "clbgbcross", NULL, NULL },
-    { "clbgbdiag", NULL, NULL },
-    { "clbgbkbdiag", NULL, NULL },
-    { "clbgbkcross", NULL, NULL },
-    { "clbgbkdcross", NULL, NULL },
-    { "clbgbkfdiag", NULL, NULL },
-    { "clbgbkhor", NULL, NULL },
-    { "clbgbkvert", NULL, NULL },
-    { "clbgdcross", NULL, NULL },
-    { "clbgfdiag", NULL, NULL },
-    { "clbghoriz", NULL, NULL },
-    { "clbgvert", NULL, NULL },
-    { "clbrdrb", NULL, NULL },
-    { "clbrdrl", NULL, NULL },
-    { "clbrdrr", NULL, NULL },
-    { "clbrdrt", NULL, NULL },
-    { "clcbpat", NULL, NULL },
-    { "clcfpat", NULL, NULL },
-    { "clmgf", NULL, NULL },
-    { "clmrg", NULL, NULL },
-    { "clshdng", NULL, NULL },
-    { "cs", NULL, "character style (not implemented)"},
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_d [] =
-{
-    { "deff", cmd_deff, "Default Font" },
-    { "dn", &cmd_dn, NULL },
+    { KW_CAPS, &cmd_caps, NULL },
+    { KW_CB, cmd_cb, NULL },
+    { KW_CF, cmd_cf, NULL },
+    { KW_COLORTBL, &cmd_colortbl, "color table" },
+    { KW_COLS, NULL, "columns (not implemented)" },
+    { KW_COLUMN, NULL, "column break (not implemented)" },
+    { KW_CBPAT, NULL, "Paragraph Shading" },
+    { KW_CELLX, NULL, "Table Definitions" },
+    { KW_CFPAT, NULL, NULL },
+    { KW_CGRID, NULL, NULL },
+    { KW_CHARRSID, NULL, "Revision Mark (ignore)" },
+    { KW_CLBGBCROSS, NULL, NULL },
+    { KW_CLBGBDIAG, NULL, NULL },
+    { KW_CLBGBKBDIAG, NULL, NULL },
+    { KW_CLBGBKCROSS, NULL, NULL },
+    { KW_CLBGBKDCROSS, NULL, NULL },
+    { KW_CLBGBKFDIAG, NULL, NULL },
+    { KW_CLBGBKHOR, NULL, NULL },
+    { KW_CLBGBKVERT, NULL, NULL },
+    { KW_CLBGDCROSS, NULL, NULL },
+    { KW_CLBGFDIAG, NULL, NULL },
+    { KW_CLBGHORIZ, NULL, NULL },
+    { KW_CLBGVERT, NULL, NULL },
+    { KW_CLBRDRB, NULL, NULL },
+    { KW_CLBRDRL, NULL, NULL },
+    { KW_CLBRDRR, NULL, NULL },
+    { KW_CLBRDRT, NULL, NULL },
+    { KW_CLCBPAT, NULL, NULL },
+    { KW_CLCFPAT, NULL, NULL },
+    { KW_CLMGF, NULL, NULL },
+    { KW_CLMRG, NULL, NULL },
+    { KW_CLSHDNG, NULL, NULL },
+    { KW_CS, NULL, "character style (not implemented)"},
+    { KW_DEFF, cmd_deff, "Default Font" },
+    { KW_DN, &cmd_dn, NULL },
 #if 0
-    { "dibitmap", NULL, NULL },
+    { KW_DIBITMAP, NULL, NULL },
 #endif
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_e [] =
-{
-    { "emdash", cmd_emdash, NULL },
-    { "endash", cmd_endash, NULL },
-    { "embo", &cmd_emboss, NULL },
-    { "expand", &cmd_expand, NULL },
-    { "expnd", &cmd_expand, NULL },
-    { "emfblip", &cmd_emfblip, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_f [] =
-{
-    { "f", cmd_f, NULL },
-    { "fdecor", cmd_fdecor, NULL },
-    { "fmodern", cmd_fmodern, NULL },
-    { "fnil", cmd_fnil, NULL },
-    { "fonttbl", cmd_fonttbl, "font table" },
-    { "froman", cmd_froman, NULL },
-    { "fs", cmd_fs, NULL },
-    { "fscript", cmd_fscript, NULL },
-    { "fswiss", cmd_fswiss, NULL },
-    { "ftech", cmd_ftech, NULL },
-    { "field", cmd_field, NULL },
-    { "footer", cmd_footer, NULL },
-    { "footerf", cmd_footerf, NULL },
-    { "footerl", cmd_footerl, NULL },
-    { "footerr", cmd_footerr, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_h [] =
-{
-    { "highlight", &cmd_highlight, NULL },
-    { "header", cmd_header, NULL },
-    { "headerf", cmd_headerf, NULL },
-    { "headerl", cmd_headerl, NULL },
-    { "headerr", cmd_headerr, NULL },
-    { "hl", cmd_ignore, "hyperlink within object" },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_i [] =
-{
-    { "i", &cmd_i, NULL },
-    { "info", &cmd_info, NULL },
-    { "insrsid", NULL, "Revision Mark (ignore)" },
-    { "intbl", &cmd_intbl, NULL },
-    { "impr", &cmd_engrave, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_j [] =
-{
-    { "jpegblip", &cmd_jpegblip, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_l [] =
-{
-    { "ldblquote", &cmd_ldblquote, NULL },
-    { "line", &cmd_line, NULL },
-    { "lquote", &cmd_lquote, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_m [] =
-{
-    { "mac", &cmd_mac , NULL },
-    { "macpict", &cmd_macpict, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_n [] =
-{
-    { "nosupersub", &cmd_nosupersub, NULL },
-    { "nonshppict", &cmd_ignore, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_o [] =
-{
-    { "outl", &cmd_outl, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_p [] =
-{
-    { "page", &cmd_page, NULL },
-    { "par", &cmd_par, NULL },
-    { "pc", &cmd_pc , NULL },
-    { "pca", &cmd_pca , NULL },
-    { "pich", &cmd_pich, NULL },
-    { "pict", &cmd_pict, "picture" },
-    { "picprop", &cmd_picprop, "picture properties" },
-    { "picw", &cmd_picw, NULL },
-    { "plain", &cmd_plain, NULL },
-    { "pngblip", &cmd_pngblip, NULL },
-    { "pnmetafile", &cmd_pnmetafile, NULL },
-    { "emfblip", &cmd_emfblip, NULL },
+    { KW_EMDASH, cmd_emdash, NULL },
+    { KW_ENDASH, cmd_endash, NULL },
+    { KW_EMBO, &cmd_emboss, NULL },
+    { KW_EXPAND, &cmd_expand, NULL },
+    { KW_EXPND, &cmd_expand, NULL },
+    { KW_EMFBLIP, &cmd_emfblip, NULL },
+    { KW_F, cmd_f, NULL },
+    { KW_FDECOR, cmd_fdecor, NULL },
+    { KW_FMODERN, cmd_fmodern, NULL },
+    { KW_FNIL, cmd_fnil, NULL },
+    { KW_FONTTBL, cmd_fonttbl, "font table" },
+    { KW_FROMAN, cmd_froman, NULL },
+    { KW_FS, cmd_fs, NULL },
+    { KW_FSCRIPT, cmd_fscript, NULL },
+    { KW_FSWISS, cmd_fswiss, NULL },
+    { KW_FTECH, cmd_ftech, NULL },
+    { KW_FIELD, cmd_field, NULL },
+    { KW_FOOTER, cmd_footer, NULL },
+    { KW_FOOTERF, cmd_footerf, NULL },
+    { KW_FOOTERL, cmd_footerl, NULL },
+    { KW_FOOTERR, cmd_footerr, NULL },
+    { KW_HIGHLIGHT, &cmd_highlight, NULL },
+    { KW_HEADER, cmd_header, NULL },
+    { KW_HEADERF, cmd_headerf, NULL },
+    { KW_HEADERL, cmd_headerl, NULL },
+    { KW_HEADERR, cmd_headerr, NULL },
+    { KW_HL, cmd_ignore, "hyperlink within object" },
+    { KW_I, &cmd_i, NULL },
+    { KW_INFO, &cmd_info, NULL },
+    { KW_INSRSID, NULL, "Revision Mark (ignore)" },
+    { KW_INTBL, &cmd_intbl, NULL },
+    { KW_IMPR, &cmd_engrave, NULL },
+    { KW_JPEGBLIP, &cmd_jpegblip, NULL },
+    { KW_LDBLQUOTE, &cmd_ldblquote, NULL },
+    { KW_LINE, &cmd_line, NULL },
+    { KW_LQUOTE, &cmd_lquote, NULL },
+    { KW_MAC, &cmd_mac , NULL },
+    { KW_MACPICT, &cmd_macpict, NULL },
+    { KW_NOSUPERSUB, &cmd_nosupersub, NULL },
+    { KW_NONSHPPICT, &cmd_ignore, NULL },
+    { KW_OUTL, &cmd_outl, NULL },
+    { KW_PAGE, &cmd_page, NULL },
+    { KW_PAR, &cmd_par, NULL },
+    { KW_PC, &cmd_pc , NULL },
+    { KW_PCA, &cmd_pca , NULL },
+    { KW_PICH, &cmd_pich, NULL },
+    { KW_PICT, &cmd_pict, "picture" },
+    { KW_PICPROP, &cmd_picprop, "picture properties" },
+    { KW_PICW, &cmd_picw, NULL },
+    { KW_PLAIN, &cmd_plain, NULL },
+    { KW_PNGBLIP, &cmd_pngblip, NULL },
+    { KW_PNMETAFILE, &cmd_pnmetafile, NULL },
 #if 0
-    { "piccropb", NULL, NULL },
-    { "piccropl", NULL, NULL },
-    { "piccropr", NULL, NULL },
-    { "piccropt", NULL, NULL },
-    { "pichgoal", NULL, NULL },
-    { "pichgoal", NULL, NULL },
-    { "picscaled", NULL, NULL },
-    { "picscalex", NULL, NULL },
-    { "picwgoal", NULL, NULL },
+    { KW_PICCROPB, NULL, NULL },
+    { KW_PICCROPL, NULL, NULL },
+    { KW_PICCROPR, NULL, NULL },
+    { KW_PICCROPT, NULL, NULL },
+    { KW_PICHGOAL, NULL, NULL },
+    { KW_PICHGOAL, NULL, NULL },
+    { KW_PICSCALED, NULL, NULL },
+    { KW_PICSCALEX, NULL, NULL },
+    { KW_PICWGOAL, NULL, NULL },
 #endif
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_r [] =
-{
-    { "rdblquote", &cmd_rdblquote, NULL },
-    { "rquote", &cmd_rquote, NULL },
-    { "rtf", &cmd_rtf, NULL },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_s [] =
-{
-    { "s", cmd_s, "style" },
-    { "sect", &cmd_sect, "section break"},
-    { "scaps", &cmd_scaps, NULL },
-    { "super", &cmd_super, NULL },
-    { "sub", &cmd_sub, NULL },
-    { "shad", &cmd_shad, NULL },
-    { "strike", &cmd_strike, NULL },
-    { "striked", &cmd_striked, NULL },
-    { "strikedl", &cmd_strikedl, NULL },
-    { "stylesheet", &cmd_ignore, "style sheet" },
-    { "shp", cmd_shp, "drawn shape" },
-    { "shppict", &cmd_shppict, "shppict wrapper" },
+    { KW_RDBLQUOTE, &cmd_rdblquote, NULL },
+    { KW_RQUOTE, &cmd_rquote, NULL },
+    { KW_RTF, &cmd_rtf, NULL },
+    { KW_S, cmd_s, "style" },
+    { KW_SECT, &cmd_sect, "section break"},
+    { KW_SCAPS, &cmd_scaps, NULL },
+    { KW_SUPER, &cmd_super, NULL },
+    { KW_SUB, &cmd_sub, NULL },
+    { KW_SHAD, &cmd_shad, NULL },
+    { KW_STRIKE, &cmd_strike, NULL },
+    { KW_STRIKED, &cmd_striked, NULL },
+    { KW_STRIKEDL, &cmd_strikedl, NULL },
+    { KW_STYLESHEET, &cmd_ignore, "style sheet" },
+    { KW_SHP, cmd_shp, "drawn shape" },
+    { KW_SHPPICT, &cmd_shppict, "shppict wrapper" },
 #if 0
-    { "shading", NULL, NULL },
+    { KW_SHADING, NULL, NULL },
 #endif
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_t [] =
-{
-    { "tab", &cmd_tab, NULL },
-    { "tc", cmd_tc, "TOC entry" },
-    { "tcn", cmd_tcn, "TOC entry" },
-    { "trowd", NULL, "start new row in table" },
-    { NULL, NULL, NULL}
-};
-static HashItem hashArray_u [] =
-{
-    { "u", &cmd_u, NULL },
-    { "ul", &cmd_ul, NULL },
-    { "up", &cmd_up, NULL },
-    { "uld", &cmd_uld, NULL },
-    { "uldash", &cmd_uldash, NULL },
-    { "uldashd", &cmd_uldashd, NULL },
-    { "uldashdd", &cmd_uldashdd, NULL },
-    { "uldb", &cmd_uldb, NULL },
-    { "ulnone", &cmd_ulnone, NULL },
-    { "ulth", &cmd_ulth, NULL },
-    { "ulthd", &cmd_ulthd, NULL },
-    { "ulthdash", &cmd_ulthdash, NULL },
-    { "ulw", &cmd_ulw, NULL },
-    { "ulwave", &cmd_ulwave, NULL },
-    { NULL, NULL, NULL}
-};
-
-static HashItem hashArray_v [] =
-{
-    { "v", NULL, "Hidden Text" },
-    { NULL, NULL, NULL }
+    { KW_TAB, &cmd_tab, NULL },
+    { KW_TC, cmd_tc, "TOC entry" },
+    { KW_TCN, cmd_tcn, "TOC entry" },
+    { KW_TROWD, NULL, "start new row in table" },
+    { KW_U, &cmd_u, NULL },
+    { KW_UL, &cmd_ul, NULL },
+    { KW_UP, &cmd_up, NULL },
+    { KW_ULD, &cmd_uld, NULL },
+    { KW_ULDASH, &cmd_uldash, NULL },
+    { KW_ULDASHD, &cmd_uldashd, NULL },
+    { KW_ULDASHDD, &cmd_uldashdd, NULL },
+    { KW_ULDB, &cmd_uldb, NULL },
+    { KW_ULNONE, &cmd_ulnone, NULL },
+    { KW_ULTH, &cmd_ulth, NULL },
+    { KW_ULTHD, &cmd_ulthd, NULL },
+    { KW_ULTHDASH, &cmd_ulthdash, NULL },
+    { KW_ULW, &cmd_ulw, NULL },
+    { KW_ULWAVE, &cmd_ulwave, NULL },
+    { KW_V, NULL, "Hidden Text" },
+    { KW_WBMBITSPIXEL, &cmd_wbmbitspixel, NULL },
+    { KW_WMETAFILE, &cmd_wmetafile, NULL },
+    { KW_XE, cmd_xe, "index entry" },
+    { KW_NONE, NULL, NULL }
 };
 
-static HashItem hashArray_w [] =
-{
-    { "wbmbitspixel", &cmd_wbmbitspixel, NULL },
-    { "wmetafile", &cmd_wmetafile, NULL },
-    { NULL, NULL, NULL}
-};
+/*-------------------------------------------------------------------*/
+/*-------------------------------------------------------------------*/
 
-static HashItem hashArray_x [] =
+/* commands[] indexed by Keyword, filled when the module is loaded */
+static HashItem **
+index_commands(void)
 {
-    { "xe", cmd_xe, "index entry" },
-    { NULL, NULL, NULL}
-};
-
-static HashItem *hash [26] =
-{
-    hashArray_a,
-    hashArray_b,
-    hashArray_c,
-    hashArray_d,
-    hashArray_e,
-    hashArray_f,
-    NULL,
-    hashArray_h,
-    hashArray_i,
-    hashArray_j,
-    NULL,
-    hashArray_l,
-    hashArray_m,
-    hashArray_n,
-    hashArray_o,
-    hashArray_p,
-    NULL,
-    hashArray_r,
-    hashArray_s,
-    hashArray_t,
-    hashArray_u,
-    hashArray_v,
-    hashArray_w,
-    hashArray_x,
-    NULL, NULL
-};
+    static HashItem *index[KW_COUNT];
+    HashItem *hip;
 
+    for (hip = commands; hip->kw != KW_NONE; hip++)
+    {
+        index[hip->kw] = hip;
+    }
+    return index;
+}
 
-/*-------------------------------------------------------------------*/
-/*-------------------------------------------------------------------*/
+static HashItem *const *command_index = index_commands();
 
 /*========================================================================
- * Name:    find_command
- * Purpose: Search command lists for input string and return handler and possible parameter
- * Args:    cmdpp pointer to string with command and optional parameter.
- *            ex: "\cmd ..." "\cmd123A..." "\cmd-2ABC..."
- *          hasparamp: parameter existence flag (output)
- *          paramp: parameter value if hasparamp is set
- * Returns: Pointer to command structure, or NULL
+ * Name:    convert_skip_sets
+ * Purpose: Tells the parser which groups render to nothing, so that it
+ *          can leave them out of the document: those starting with a
+ *          word handled by cmd_ignore, and {\* groups whose word is not
+ *          known at all (see cmd_maybe_ignore). Words read by the
+ *          handlers of other groups (\fldinst...) are known, and kept.
+ * Args:    groups, starred: sets to fill.
+ * Returns: None.
  *=======================================================================*/
 
-static HashItem *find_command(const char *cmdpp, int *hasparamp, int *paramp)
+void
+convert_skip_sets(KeywordSet *groups, KeywordSet *starred)
 {
     HashItem *hip;
-    int ch;
-    const char *p; /* Start of parameter */
-    int len;
-
-    /* Look for a parameter */
-    *hasparamp = FALSE;
-    p = cmdpp;
-    while (*p && (!isdigit(*p) && *p != '-'))
-    {
-        p++;
-    }
-    if (*p && (isdigit(*p) || *p == '-'))
-    {
-        *hasparamp = TRUE;
-        *paramp = atoi(p);
-    }
-    len = p - cmdpp;
 
-    /* Generate a hash index */
-    ch = tolower(*cmdpp);
-    if (ch >= 'a' && ch <= 'z')
+    memset(groups, 0, sizeof(*groups));
+    memset(starred, 0, sizeof(*starred));
+    for (hip = commands; hip->kw != KW_NONE; hip++)
     {
-        hip = hash[ch - 'a'];
-    }
-    else
-    {
-        hip = hashArray_other;
-    }
-
-    if (!hip)
-    {
-        if (debug_mode)
+        if (hip->func == cmd_ignore)
         {
-            if (safe_printf(0, op->comment_begin))
-            {
-                fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
-            }
-            printf("Unfamiliar RTF command: %s (HashIndex not found)", cmdpp);
-            if (safe_printf(0, op->comment_end))
-            {
-                fprintf(stderr, TOO_MANY_ARGS, "comment_end");
-            }
+            keyword_set_add(groups, hip->kw);
+            keyword_set_add(starred, hip->kw);
         }
-        return NULL;
     }
+    keyword_set_add(starred, KW_NONE);
+    keyword_set_add(starred, KW_ANNOTATION);
+    keyword_set_add(starred, KW_FOOTNOTE);
+}
+
+/* The destinations of each DROP_ flag */
+static const struct
+{
+    unsigned int flag;
+    Keyword kw;
+} drop_keywords[] =
+{
+    { DROP_HEADERS, KW_HEADER },
+    { DROP_HEADERS, KW_HEADERF },
+    { DROP_HEADERS, KW_HEADERL },
+    { DROP_HEADERS, KW_HEADERR },
+    { DROP_FOOTERS, KW_FOOTER },
+    { DROP_FOOTERS, KW_FOOTERF },
+    { DROP_FOOTERS, KW_FOOTERL },
+    { DROP_FOOTERS, KW_FOOTERR },
+    { DROP_FOOTNOTES, KW_FOOTNOTE },
+    { DROP_ANNOTATIONS, KW_ANNOTATION },
+    { DROP_INDEX_ENTRIES, KW_XE },
+    { DROP_TOC_ENTRIES, KW_TC },
+    { DROP_TOC_ENTRIES, KW_TCN },
+};
+
+/*========================================================================
+ * Name:    convert_drop_set
+ * Purpose: Adds the destinations to leave out of the output to the set
+ *          of groups the parser drops.
+ * Args:    set: set to add to.
+ *          drop: DROP_ flags.
+ * Returns: None.
+ *=======================================================================*/
+
+void
+convert_drop_set(KeywordSet *set, unsigned int drop)
+{
+    size_t i;
 
-    while (hip->name)
+    for (i = 0; i < sizeof(drop_keywords) / sizeof(drop_keywords[0]); i++)
     {
-        /* Don't change the order of tests ! */
-        if (!strncmp(cmdpp, hip->name, len) && hip->name[len] == 0)
+        if (drop & drop_keywords[i].flag)
         {
-            return hip;
+            keyword_set_add(set, drop_keywords[i].kw);
         }
-        hip++;
     }
+}
 
-    if (debug_mode)
+/*========================================================================
+ * Name:    find_command
+ * Purpose: Find the handler of a control word
+ * Args:    ctx conversion context
+ *          kw control word, as returned by keyword_parse()
+ *          cmdpp pointer to string with command and optional parameter,
+ *            for the debug output.
+ *            ex: "\cmd ..." "\cmd123A..." "\cmd-2ABC..."
+ * Returns: Pointer to command structure, or NULL
+ *=======================================================================*/
+
+static HashItem *find_command(UnrtfContext *ctx, Keyword kw, const char *cmdpp)
+{
+    HashItem *hip = command_index[kw];
+
+    if (!hip && debug_mode)
     {
-        if (safe_printf(0, op->comment_begin))
+        if (safe_printf(ctx, 0, op->comment_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
         }
-        printf("Unfamiliar RTF command: %s", cmdpp);
-        if (safe_printf(0, op->comment_end))
+        outbuf_printf(ctx->out, "Unfamiliar RTF command: %s", cmdpp);
+        if (safe_printf(ctx, 0, op->comment_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "comment_end");
         }
     }
-    return NULL;
+    return hip;
 }
 
 
@@ -3679,15 +3600,18 @@ static HashItem *find_command(const char *cmdpp, int *hasparamp, int *paramp)
             wrong if the input was an encoding not
             apparented to ascii, which hopefully is never the case.
             Also we just drop all chars outside [0x20-0x80[
- * Args:    None.
+            Characters come from the table of op_char_table(), and runs
+            that print as themselves are copied at once.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 void
-print_with_special_exprs(const char *s)
+print_with_special_exprs(UnrtfContext *ctx, const char *s)
 {
     int ch;
     int state;
+    const CharTable *t;
 
     enum { SMALL = 0, BIG = 1 };
 
@@ -3695,17 +3619,23 @@ print_with_special_exprs(const char *s)
 
     // Not sure that there are cases where the flush is needed,
     // but this is conceivable, and can't hurt in any case.
-    flush_iconv_input();
+    flush_iconv_input(ctx);
+
+    maybeopeniconv(ctx);
 
-    maybeopeniconv();
+    t = ctx->char_table;
+    if (!t || strcasecmp(ctx->current_encoding, t->encoding))
+    {
+        t = ctx->char_table = op_char_table(op, ctx->current_encoding);
+    }
 
     state = SMALL; /* Pacify gcc,  st001906 - 0.19.6 */
-    if (simulate_smallcaps)
+    if (ctx->simulate_smallcaps)
     {
         if (*s >= 'a' && *s <= 'z')
         {
             state = SMALL;
-            if (safe_printf(0, op->smaller_begin))
+            if (safe_printf(ctx, 0, op->smaller_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "smaller_begin");
             }
@@ -3718,32 +3648,35 @@ print_with_special_exprs(const char *s)
 
     while ((ch = *s))
     {
-        const char *post_trans = NULL;
-
-        if (simulate_allcaps || simulate_smallcaps)
+        if (ctx->simulate_allcaps || ctx->simulate_smallcaps)
         {
             ch = toupper(ch);
         }
-
-        if (ch >= 0x20 && ch < 0x80)
+        else if (t->plain[(unsigned char) ch])
         {
-            post_trans = op_translate_char(op, current_encoding, ch);
-            if (post_trans)
+            const char *run = s;
+            while (t->plain[(unsigned char) *s])
             {
-                printf("%s", post_trans);
-                my_free(const_cast<char*>(post_trans));
+                s++;
             }
+            outbuf_write(ctx->out, run, s - run);
+            continue;
+        }
+
+        if (ch >= 0x20 && ch < 0x80 && t->text[ch])
+        {
+            outbuf_write(ctx->out, t->text[ch], t->len[ch]);
         }
 
         s++;
 
-        if (simulate_smallcaps)
+        if (ctx->simulate_smallcaps)
         {
             ch = *s;
             if (ch >= 'a' && ch <= 'z')
             {
                 if (state == BIG)
-                    if (safe_printf(0, op->smaller_begin))
+                    if (safe_printf(ctx, 0, op->smaller_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "smaller_begin");
                     }
@@ -3752,7 +3685,7 @@ print_with_special_exprs(const char *s)
             else
             {
                 if (state == SMALL)
-                    if (safe_printf(0, op->smaller_end))
+                    if (safe_printf(ctx, 0, op->smaller_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "smaller_end");
                     }
@@ -3767,21 +3700,21 @@ print_with_special_exprs(const char *s)
 /*========================================================================
  * Name:
  * Purpose:
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 static void
-begin_table()
+begin_table(UnrtfContext *ctx)
 {
-    within_table = TRUE;
-    have_printed_row_begin = FALSE;
-    have_printed_cell_begin = FALSE;
-    have_printed_row_end = FALSE;
-    have_printed_cell_end = FALSE;
-    attrstack_push();
-    starting_body();
-    if (safe_printf(0, op->table_begin))
+    ctx->within_table = TRUE;
+    ctx->have_printed_row_begin = FALSE;
+    ctx->have_printed_cell_begin = FALSE;
+    ctx->have_printed_row_end = FALSE;
+    ctx->have_printed_cell_end = FALSE;
+    attrstack_push(ctx);
+    starting_body(ctx);
+    if (safe_printf(ctx, 0, op->table_begin))
     {
         fprintf(stderr, TOO_MANY_ARGS, "table_begin");
     }
@@ -3791,96 +3724,96 @@ begin_table()
 /*========================================================================
  * Name:    end_table
  * Purpose:    finish off table
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 void
-end_table()
+end_table(UnrtfContext *ctx)
 {
-    if (within_table)
+    if (ctx->within_table)
     {
-        if (!have_printed_cell_end)
+        if (!ctx->have_printed_cell_end)
         {
-            attr_pop_all();
-            if (safe_printf(0, op->table_cell_end))
+            attr_pop_all(ctx);
+            if (safe_printf(ctx, 0, op->table_cell_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "table_cell_end");
             }
         }
-        if (!have_printed_row_end)
+        if (!ctx->have_printed_row_end)
         {
-            if (safe_printf(0, op->table_row_end))
+            if (safe_printf(ctx, 0, op->table_row_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "table_row_end");
             }
         }
-        if (safe_printf(0, op->table_end))
+        if (safe_printf(ctx, 0, op->table_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "table_end");
         }
-        within_table = FALSE;
-        have_printed_row_begin = FALSE;
-        have_printed_cell_begin = FALSE;
-        have_printed_row_end = FALSE;
-        have_printed_cell_end = FALSE;
+        ctx->within_table = FALSE;
+        ctx->have_printed_row_begin = FALSE;
+        ctx->have_printed_cell_begin = FALSE;
+        ctx->have_printed_row_end = FALSE;
+        ctx->have_printed_cell_end = FALSE;
     }
 }
 
 /*=======================================================================
  * Name:    check_for_table
  * Purpose:    make certain table has been started
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
-static void check_for_table()
+static void check_for_table(UnrtfContext *ctx)
 {
     //printf("EH: %d %d", coming_pars_that_are_tabular, within_table);
 
-    if (!coming_pars_that_are_tabular && within_table)
+    if (!ctx->coming_pars_that_are_tabular && ctx->within_table)
     {
         //printf("END TABLE\n");
-        end_table();
+        end_table(ctx);
     }
-    else if (coming_pars_that_are_tabular && !within_table)
+    else if (ctx->coming_pars_that_are_tabular && !ctx->within_table)
     {
         //printf("BEGIN TABLE");
-        begin_table();
+        begin_table(ctx);
     }
 }
 
 /*========================================================================
  * Name:
  * Purpose:
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 void
-starting_text()
+starting_text(UnrtfContext *ctx)
 {
-    if (within_table)
+    if (ctx->within_table)
     {
-        if (!have_printed_row_begin)
+        if (!ctx->have_printed_row_begin)
         {
-            if (safe_printf(0, op->table_row_begin))
+            if (safe_printf(ctx, 0, op->table_row_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "table_row_begin");
             }
-            have_printed_row_begin = TRUE;
-            have_printed_row_end = FALSE;
-            have_printed_cell_begin = FALSE;
+            ctx->have_printed_row_begin = TRUE;
+            ctx->have_printed_row_end = FALSE;
+            ctx->have_printed_cell_begin = FALSE;
         }
-        if (!have_printed_cell_begin)
+        if (!ctx->have_printed_cell_begin)
         {
-            if (safe_printf(0, op->table_cell_begin))
+            if (safe_printf(ctx, 0, op->table_cell_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "table_cell_begin");
             }
-            attrstack_express_all();
-            have_printed_cell_begin = TRUE;
-            have_printed_cell_end = FALSE;
+            attrstack_express_all(ctx);
+            ctx->have_printed_cell_begin = TRUE;
+            ctx->have_printed_cell_end = FALSE;
         }
     }
 }
@@ -3891,22 +3824,22 @@ starting_text()
 /*========================================================================
  * Name:
  * Purpose:
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 static void
-starting_paragraph_align(int align)
+starting_paragraph_align(UnrtfContext *ctx, int align)
 {
-    if (within_header && align != ALIGN_LEFT)
+    if (ctx->within_header && align != ALIGN_LEFT)
     {
-        starting_body();
+        starting_body(ctx);
     }
 
     switch (align)
     {
     case ALIGN_CENTER:
-        if (safe_printf(0, op->center_begin))
+        if (safe_printf(ctx, 0, op->center_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "center_begin");
         }
@@ -3914,13 +3847,13 @@ starting_paragraph_align(int align)
     case ALIGN_LEFT:
         break;
     case ALIGN_RIGHT:
-        if (safe_printf(0, op->align_right_begin))
+        if (safe_printf(ctx, 0, op->align_right_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "align_right_begin");
         }
         break;
     case ALIGN_JUSTIFY:
-        if (safe_printf(0, op->justify_begin))
+        if (safe_printf(ctx, 0, op->justify_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "justify_begin");    /* But this is correct */
         }
@@ -3933,17 +3866,17 @@ starting_paragraph_align(int align)
 /*========================================================================
  * Name:
  * Purpose:
- * Args:    None.
+ * Args:    Conversion context.
  * Returns:    None.
  *=======================================================================*/
 
 static void
-ending_paragraph_align(int align)
+ending_paragraph_align(UnrtfContext *ctx, int align)
 {
     switch (align)
     {
     case ALIGN_CENTER:
-        if (safe_printf(0, op->center_end))
+        if (safe_printf(ctx, 0, op->center_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "center_end");
         }
@@ -3951,13 +3884,13 @@ ending_paragraph_align(int align)
     case ALIGN_LEFT:
         break;
     case ALIGN_RIGHT:
-        if (safe_printf(0, op->align_right_end))
+        if (safe_printf(ctx, 0, op->align_right_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "align_right_end");
         }
         break;
     case ALIGN_JUSTIFY:
-        if (safe_printf(0, op->justify_end))
+        if (safe_printf(ctx, 0, op->justify_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "justify_end");
         }
@@ -3966,28 +3899,25 @@ ending_paragraph_align(int align)
 }
 
 
-#define IIBS 10240
-static char iconv_buffer[IIBS];
-static int iconv_cur = 0;
 static void
-flush_iconv_input()
+flush_iconv_input(UnrtfContext *ctx)
 {
     /*  fprintf(stderr, "flush_iconv_input: iconv_cur %d\n", iconv_cur);*/
-    if (iconv_cur <= 0)
+    if (ctx->iconv_cur <= 0)
     {
-        iconv_cur = 0;
+        ctx->iconv_cur = 0;
         return;
     }
-    maybeopeniconv();
-    if (!my_iconv_is_valid(desc))
+    maybeopeniconv(ctx);
+    if (!my_iconv_is_valid(ctx->desc))
     {
         fprintf(stderr, "unrtf: flush: iconv not ready!\n");
         return;
     }
 
     char obuf[IIBS];
-    size_t isiz = iconv_cur;
-    char *ip = iconv_buffer;
+    size_t isiz = ctx->iconv_cur;
+    char *ip = ctx->iconv_buffer;
     while (isiz > 0)
     {
         size_t osiz;
@@ -3996,7 +3926,7 @@ flush_iconv_input()
         osiz = IIBS;
         ocp = obuf;
         errno = 0;
-        if (my_iconv(desc, &ip, &isiz, &ocp, &osiz) == (size_t) - 1 && errno != E2BIG)
+        if (my_iconv(ctx->desc, &ip, &isiz, &ocp, &osiz) == (size_t) - 1 && errno != E2BIG)
         {
             if (errno == EINVAL)
             {
@@ -4005,17 +3935,17 @@ flush_iconv_input()
                 // (more data probably coming)
                 // iconv leaves ip pointing at the
                 // beginning of the sequence.
-                int cnt = iconv_cur - (ip - iconv_buffer);
+                int cnt = ctx->iconv_cur - (ip - ctx->iconv_buffer);
                 /*            fprintf(stderr, "flush_iconv: incomp. input remain %d\n", cnt);*/
                 memcpy(obuf, ip, cnt);
-                memcpy(iconv_buffer, obuf, cnt);
-                iconv_cur = cnt;
+                memcpy(ctx->iconv_buffer, obuf, cnt);
+                ctx->iconv_cur = cnt;
                 return;
             }
             else
             {
                 /*           fprintf(stderr, "flush_iconv: rem. %d errno %d\n", isiz, errno);*/
-                iconv_cur = 0;
+                ctx->iconv_cur = 0;
                 return;
             }
         }
@@ -4024,486 +3954,770 @@ flush_iconv_input()
 
 
         /*        fwrite(obuf, 1, IIBS - osiz, stdout);*/
+        if (op->utf8_output)
+        {
+            op_print_utf8(op, ctx->out, obuf, IIBS - osiz);
+            continue;
+        }
         char *out = op_translate_buffer(op, obuf, IIBS - osiz);
         if (out == 0)
         {
-            iconv_cur = 0;
+            ctx->iconv_cur = 0;
             return;
         }
-        fprintf(stdout, "%s", out);
+        outbuf_puts(ctx->out, out);
         my_free(out);
     }
-    iconv_cur = 0;
+    ctx->iconv_cur = 0;
 }
 
 static void
-accumulate_iconv_input(int ch)
+accumulate_iconv_input(UnrtfContext *ctx, int ch)
 {
     /*    fprintf(stderr, "accumulate_iconv_input: 0x%x\n", ch);*/
-    if (iconv_cur >= IIBS - 1)
+    if (ctx->iconv_cur >= IIBS - 1)
     {
-        flush_iconv_input();
+        flush_iconv_input(ctx);
     }
-    iconv_buffer[iconv_cur++] = ch;
+    ctx->iconv_buffer[ctx->iconv_cur++] = ch;
 }
 
 /*========================================================================
- * Name:
- * Purpose:    Recursive routine to produce the output in the target
- *        format given on a tree of words.
- * Args:    Word* (the tree).
+ * Name:    accumulate_iconv_run
+ * Purpose:    Adds the bytes of a \'XX run (see read_hex_run()) to the
+ *        iconv input, flushed where accumulate_iconv_input() would.
+ * Args:    Conversion context, bytes (0 terminated).
  * Returns:    None.
  *=======================================================================*/
 
 static void
-word_print_core(Word *w, int groupdepth)
+accumulate_iconv_run(UnrtfContext *ctx, const char *s)
 {
-    const char *s;
-    const char *alias;
-    FILE *pictfile = NULL;
-    int is_cell_group = FALSE;
-    int paragraph_begined = FALSE;
-    int paragraph_align = ALIGN_LEFT;
+    size_t len = strlen(s);
 
-    if (groupdepth > MAX_GROUP_DEPTH)
+    while (len > 0)
     {
-        warning_handler("Max group depth reached");
-        return;
+        if (ctx->iconv_cur >= IIBS - 1)
+        {
+            flush_iconv_input(ctx);
+        }
+        size_t n = IIBS - 1 - ctx->iconv_cur;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(ctx->iconv_buffer + ctx->iconv_cur, s, n);
+        ctx->iconv_cur += n;
+        s += n;
+        len -= n;
     }
-    CHECK_PARAM_NOT_NULL(w);
-
-    //if (!coming_pars_that_are_tabular && within_table) {
-    //end_table();
-    //}
-    //else if (coming_pars_that_are_tabular && !within_table) {
-    //begin_table();
-    //}
-    check_for_table();
+}
 
-    /* Mark our place in the stack */
-    attrstack_push();
+/* Rendering state of one group. The words of a group go through
+ * group_word() one at a time, taken from the Word tree or, in streaming
+ * mode, straight from the tokenizer.
+ */
+typedef struct
+{
+    int groupdepth;
+    FILE *pictfile;
+    int is_cell_group;
+    int paragraph_begined;
+    int paragraph_align;
+    int streaming;       /* the following words are not read yet */
+    int skip_next;       /* streaming: drop the next word or group */
+    Collection *opt;     /* streaming: optimize_words() state */
+} GroupState;
 
-    while (w)
-    {
+/* group_word() result for a command that needs the rest of the group */
+#define NEEDS_SIBLINGS (-1)
 
-        s = word_string(w);
-        // If we have hex data and we're getting out of the hex area
-        // flush it.
-        if (iconv_cur > 0 && s && strncmp(s, "\\'", 2))
-        {
-            flush_iconv_input();
-        }
+static void word_print_core(UnrtfContext *ctx, Word *w, int groupdepth);
 
-        if (s)
-        {
+/*========================================================================
+ * Name:    needs_siblings
+ * Purpose:    Tells whether a command handler reads the words following
+ *        its own (tables, fields, \info, \* ...).
+ * Args:    Command.
+ * Returns:    TRUE for those handlers.
+ *=======================================================================*/
 
-            /*--Ignore whitespace in header--------------------*/
-            if (*s == ' ' && within_header)
-            {
-                /* no op */
-            }
-            else
-                /*--Handle word -----------------------------------*/
-                if (s[0] != '\\')
+static int
+needs_siblings(HashItem *hip)
+{
+    return hip->func == cmd_colortbl
+           || hip->func == cmd_fonttbl
+           || hip->func == cmd_field
+           || hip->func == cmd_maybe_ignore
+           || hip->func == cmd_info
+           || hip->func == cmd_xe
+           || hip->func == cmd_tc
+           || hip->func == cmd_tcn;
+}
+
+/*========================================================================
+ * Name:    group_begin
+ * Purpose:    Starts rendering a group.
+ * Args:    Conversion context, group state, group depth.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+group_begin(UnrtfContext *ctx, GroupState *gs, int groupdepth)
+{
+    memset((void *) gs, 0, sizeof(GroupState));
+    gs->groupdepth = groupdepth;
+    gs->paragraph_align = ALIGN_LEFT;
+
+    //if (!coming_pars_that_are_tabular && within_table) {
+    //end_table();
+    //}
+    //else if (coming_pars_that_are_tabular && !within_table) {
+    //begin_table();
+    //}
+    check_for_table(ctx);
+
+    /* Mark our place in the stack */
+    attrstack_push(ctx);
+}
+
+/*========================================================================
+ * Name:    group_open_child
+ * Purpose:    Called before rendering a subgroup.
+ * Args:    Conversion context, state of the enclosing group.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+group_open_child(UnrtfContext *ctx, GroupState *gs)
+{
+    if (!gs->paragraph_begined)
+    {
+        starting_paragraph_align(ctx, gs->paragraph_align);
+        gs->paragraph_begined = TRUE;
+    }
+}
+
+/*========================================================================
+ * Name:    group_word
+ * Purpose:    Produces the output for one word of a group.
+ * Args:    Conversion context, group state, word.
+ * Returns:    FALSE, SKIP_ONE_WORD, TRUE if the rest of the group should
+ *        be ignored, or NEEDS_SIBLINGS when streaming.
+ *=======================================================================*/
+
+static int
+group_word(UnrtfContext *ctx, GroupState *gs, Word *w)
+{
+    const char *s;
+    const char *alias;
+    int terminate_group = FALSE;
+
+
+    s = word_string(w);
+    // If we have hex data and we're getting out of the hex area
+    // flush it.
+    if (ctx->iconv_cur > 0 && s && w->kw != KW_HEX && w->kw != KW_HEX_EXPR)
+    {
+        flush_iconv_input(ctx);
+    }
+
+    if (s)
+    {
+
+        /*--Ignore whitespace in header--------------------*/
+        if (*s == ' ' && ctx->within_header)
+        {
+            /* no op */
+        }
+        else
+            /*--Handle word -----------------------------------*/
+            if (s[0] != '\\')
+            {
+                starting_body(ctx);
+                starting_text(ctx);
+
+                if (!gs->paragraph_begined)
                 {
-                    starting_body();
-                    starting_text();
+                    starting_paragraph_align(ctx, gs->paragraph_align);
+                    gs->paragraph_begined = TRUE;
+                }
 
-                    if (!paragraph_begined)
+                /*----------------------------------------*/
+                if (ctx->within_picture)
+                {
+                    if (ctx->within_picture_depth == 0)
+                    {
+                        ctx->within_picture_depth = gs->groupdepth;
+                    }
+                    starting_body(ctx);
+                    if (!gs->pictfile && !ctx->nopict_mode)
                     {
-                        starting_paragraph_align(paragraph_align);
-                        paragraph_begined = TRUE;
+                        char *ext = NULL;
+                        switch (ctx->picture_type)
+                        {
+                        case PICT_WB:
+                            ext = "bmp";
+                            break;
+                        case PICT_WM:
+                            ext = "wmf";
+                            break;
+                        case PICT_MAC:
+                            ext = "pict";
+                            break;
+                        case PICT_JPEG:
+                            ext = "jpg";
+                            break;
+                        case PICT_PNG:
+                            ext = "png";
+                            break;
+                        case PICT_DI:
+                            ext = "dib";
+                            break; /* Device independent bitmap=??? */
+                        case PICT_PM:
+                            ext = "pmm";
+                            break; /* OS/2 metafile=??? */
+                        case PICT_EMF:
+                            ext = "emf";
+                            break;  /* Enhanced MetaFile */
+                        }
+                        sprintf(ctx->picture_path, "pict%03d.%s",
+                                ctx->picture_file_number++, ext);
+                        gs->pictfile = fopen(ctx->picture_path, "wb");
                     }
 
-                    /*----------------------------------------*/
-                    if (within_picture)
+                    if (s[0] != ' ')
                     {
-                        if (within_picture_depth == 0)
+                        const char *s2;
+                        if (safe_printf(ctx, 0, op->comment_begin))
                         {
-                            within_picture_depth = groupdepth;
+                            fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                         }
-                        starting_body();
-                        if (!pictfile && !nopict_mode)
+                        outbuf_printf(ctx->out, "picture data found, ");
+                        if (ctx->picture_wmetafile_type_str)
                         {
-                            char *ext = NULL;
-                            switch (picture_type)
-                            {
-                            case PICT_WB:
-                                ext = "bmp";
-                                break;
-                            case PICT_WM:
-                                ext = "wmf";
-                                break;
-                            case PICT_MAC:
-                                ext = "pict";
-                                break;
-                            case PICT_JPEG:
-                                ext = "jpg";
-                                break;
-                            case PICT_PNG:
-                                ext = "png";
-                                break;
-                            case PICT_DI:
-                                ext = "dib";
-                                break; /* Device independent bitmap=??? */
-                            case PICT_PM:
-                                ext = "pmm";
-                                break; /* OS/2 metafile=??? */
-                            case PICT_EMF:
-                                ext = "emf";
-                                break;  /* Enhanced MetaFile */
-                            }
-                            sprintf(picture_path, "pict%03d.%s",
-                                    picture_file_number++, ext);
-                            pictfile = fopen(picture_path, "wb");
+                            outbuf_printf(ctx->out, "WMF type is %s, ",
+                                   ctx->picture_wmetafile_type_str);
                         }
-
-                        if (s[0] != ' ')
+                        outbuf_printf(ctx->out, "picture dimensions are %d by %d, depth %d",
+                               ctx->picture_width, ctx->picture_height, ctx->picture_bits_per_pixel);
+                        if (safe_printf(ctx, 0, op->comment_end))
                         {
-                            const char *s2;
-                            if (safe_printf(0, op->comment_begin))
-                            {
-                                fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
-                            }
-                            printf("picture data found, ");
-                            if (picture_wmetafile_type_str)
-                            {
-                                printf("WMF type is %s, ",
-                                       picture_wmetafile_type_str);
-                            }
-                            printf("picture dimensions are %d by %d, depth %d",
-                                   picture_width, picture_height, picture_bits_per_pixel);
-                            if (safe_printf(0, op->comment_end))
-                            {
-                                fprintf(stderr, TOO_MANY_ARGS, "comment_end");
-                            }
-                            if (picture_width && picture_height && picture_bits_per_pixel)
+                            fprintf(stderr, TOO_MANY_ARGS, "comment_end");
+                        }
+                        if (ctx->picture_width && ctx->picture_height && ctx->picture_bits_per_pixel)
+                        {
+                            s2 = s;
+                            /* Convert hex char pairs. Guard against odd byte count from garbled file */
+                            while (*s2 && *(s2 + 1))
                             {
-                                s2 = s;
-                                /* Convert hex char pairs. Guard against odd byte count from garbled file */
-                                while (*s2 && *(s2 + 1))
+                                unsigned int tmp, value;
+                                tmp = tolower(*s2++);
+                                if (tmp > '9')
                                 {
-                                    unsigned int tmp, value;
-                                    tmp = tolower(*s2++);
-                                    if (tmp > '9')
-                                    {
-                                        tmp -= ('a' - 10);
-                                    }
-                                    else
-                                    {
-                                        tmp -= '0';
-                                    }
-                                    value = 16 * tmp;
-                                    tmp = tolower(*s2++);
-                                    if (tmp > '9')
-                                    {
-                                        tmp -= ('a' - 10);
-                                    }
-                                    else
-                                    {
-                                        tmp -= '0';
-                                    }
-                                    value += tmp;
-                                    if (pictfile)
-                                    {
-                                        fprintf(pictfile, "%c", value);
-                                    }
+                                    tmp -= ('a' - 10);
+                                }
+                                else
+                                {
+                                    tmp -= '0';
+                                }
+                                value = 16 * tmp;
+                                tmp = tolower(*s2++);
+                                if (tmp > '9')
+                                {
+                                    tmp -= ('a' - 10);
+                                }
+                                else
+                                {
+                                    tmp -= '0';
+                                }
+                                value += tmp;
+                                if (gs->pictfile)
+                                {
+                                    fprintf(gs->pictfile, "%c", value);
                                 }
                             }
                         }
                     }
-                    /*----------------------------------------*/
-                    else
-                    {
-                        total_chars_this_line += strlen(s);
+                }
+                /*----------------------------------------*/
+                else
+                {
+                    ctx->total_chars_this_line += strlen(s);
 
-                        if (op->word_begin)
-                            if (safe_printf(0, op->word_begin))
-                            {
-                                fprintf(stderr, TOO_MANY_ARGS, "word_begin");
-                            }
+                    if (op->word_begin)
+                        if (safe_printf(ctx, 0, op->word_begin))
+                        {
+                            fprintf(stderr, TOO_MANY_ARGS, "word_begin");
+                        }
 
-                        print_with_special_exprs(s);
+                    print_with_special_exprs(ctx, s);
 
-                        if (op->word_end)
-                            if (safe_printf(0, op->word_end))
-                            {
-                                fprintf(stderr, TOO_MANY_ARGS, "word_end");
-                            }
-                    }
+                    if (op->word_end)
+                        if (safe_printf(ctx, 0, op->word_end))
+                        {
+                            fprintf(stderr, TOO_MANY_ARGS, "word_end");
+                        }
+                }
 
 
-                }
-            /* output an escaped backslash */
-            /* do we need special handling for latex? */
-            /* we do for troff where we want the string for 92 */
-                else if (*(s + 1) == '\\')
-                {
-                    s++;
-                    if ((alias = get_alias(op, 92)) != NULL)
-                    {
-                        printf("%s", alias);
-                    }
-                    else
-                    {
-                        putchar('\\');
-                    }
-                }
-                else if (*(s + 1) == '{')
+            }
+        /* output an escaped backslash */
+        /* do we need special handling for latex? */
+        /* we do for troff where we want the string for 92 */
+            else if (*(s + 1) == '\\')
+            {
+                s++;
+                if ((alias = get_alias(op, 92)) != NULL)
                 {
-                    s++;
-                    putchar('{');
+                    outbuf_puts(ctx->out, alias);
                 }
-                else if (*(s + 1) == '}')
+                else
                 {
-                    s++;
-                    putchar('}');
+                    outbuf_putc(ctx->out, '\\');
                 }
-            /*---Handle RTF keywords---------------------------*/
-                else
+            }
+            else if (*(s + 1) == '{')
+            {
+                s++;
+                outbuf_putc(ctx->out, '{');
+            }
+            else if (*(s + 1) == '}')
+            {
+                s++;
+                outbuf_putc(ctx->out, '}');
+            }
+        /*---Handle RTF keywords---------------------------*/
+            else
+            {
+                Keyword kw = (Keyword) w->kw;
+
+                s++;
+                /* The keywords handled here take no parameter; with one
+                 * they are looked up in the command table like the rest */
+                switch (w->has_param ? KW_NONE : kw)
                 {
-                    s++;
-                    /*----Paragraph alignment----------------------------------------------------*/
-                    if (!strcmp("ql", s))
-                    {
-                        paragraph_align = ALIGN_LEFT;
-                    }
-                    else if (!strcmp("qr", s))
-                    {
-                        paragraph_align = ALIGN_RIGHT;
-                    }
-                    else if (!strcmp("qj", s))
+                /*----Paragraph alignment----------------------------------------------------*/
+                case KW_HEX:
+                    accumulate_iconv_run(ctx, s + 1);
+                    break;
+                case KW_HEX_EXPR:
+                    if (s[1] && s[2])
                     {
-                        paragraph_align = ALIGN_JUSTIFY;
+                        accumulate_iconv_input(ctx, h2toi(&s[1]));
                     }
-                    else if (!strcmp("qc", s))
+                    break;
+                case KW_UNICODE:
+                    print_unicode_run(ctx, s + 1);
+                    break;
+                case KW_QL:
+                    gs->paragraph_align = ALIGN_LEFT;
+                    break;
+                case KW_QR:
+                    gs->paragraph_align = ALIGN_RIGHT;
+                    break;
+                case KW_QJ:
+                    gs->paragraph_align = ALIGN_JUSTIFY;
+                    break;
+                case KW_QC:
+                    gs->paragraph_align = ALIGN_CENTER;
+                    break;
+                case KW_PARD:
+                    /* Clear out all font attributes.
+                     */
+                    attr_pop_all(ctx);
+
+                    if (ctx->coming_pars_that_are_tabular)
                     {
-                        paragraph_align = ALIGN_CENTER;
+                        --ctx->coming_pars_that_are_tabular;
                     }
-                    else if (!strcmp("pard", s))
-                    {
-                        /* Clear out all font attributes.
-                         */
-                        attr_pop_all();
 
-                        if (coming_pars_that_are_tabular)
+                    /* Clear out all paragraph attributes.
+                     */
+                    ending_paragraph_align(ctx, gs->paragraph_align);
+                    gs->paragraph_align = ALIGN_LEFT;
+                    gs->paragraph_begined = FALSE;
+                    break;
+                /*----Table keywords---------------------------------------------------------*/
+                case KW_CELL:
+
+                    gs->is_cell_group = TRUE;
+                    if (!ctx->have_printed_cell_begin)
+                    {
+                        /* Need this with empty cells */
+                        if (safe_printf(ctx, 0, op->table_cell_begin))
                         {
-                            --coming_pars_that_are_tabular;
+                            fprintf(stderr, TOO_MANY_ARGS, "table_cell_begin");
                         }
-
-                        /* Clear out all paragraph attributes.
-                         */
-                        ending_paragraph_align(paragraph_align);
-                        paragraph_align = ALIGN_LEFT;
-                        paragraph_begined = FALSE;
+                        attrstack_express_all(ctx);
                     }
-                    /*----Table keywords---------------------------------------------------------*/
-                    else if (!strcmp(s, "cell"))
+                    attr_pop_all(ctx);
+                    if (safe_printf(ctx, 0, op->table_cell_end))
                     {
+                        fprintf(stderr, TOO_MANY_ARGS, "table_cell_end");
+                    }
+                    ctx->have_printed_cell_begin = FALSE;
+                    ctx->have_printed_cell_end = TRUE;
+                    break;
+                case KW_ROW:
 
-                        is_cell_group = TRUE;
-                        if (!have_printed_cell_begin)
-                        {
-                            /* Need this with empty cells */
-                            if (safe_printf(0, op->table_cell_begin))
-                            {
-                                fprintf(stderr, TOO_MANY_ARGS, "table_cell_begin");
-                            }
-                            attrstack_express_all();
-                        }
-                        attr_pop_all();
-                        if (safe_printf(0, op->table_cell_end))
+                    if (ctx->within_table)
+                    {
+                        if (safe_printf(ctx, 0, op->table_row_end))
                         {
-                            fprintf(stderr, TOO_MANY_ARGS, "table_cell_end");
+                            fprintf(stderr, TOO_MANY_ARGS, "table_row_end");
                         }
-                        have_printed_cell_begin = FALSE;
-                        have_printed_cell_end = TRUE;
+                        ctx->have_printed_row_begin = FALSE;
+                        ctx->have_printed_row_end = TRUE;
                     }
-                    else if (!strcmp(s, "row"))
+                    else
                     {
-
-                        if (within_table)
+                        if (debug_mode)
                         {
-                            if (safe_printf(0, op->table_row_end))
+                            if (safe_printf(ctx, 0, op->comment_begin))
                             {
-                                fprintf(stderr, TOO_MANY_ARGS, "table_row_end");
+                                fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
                             }
-                            have_printed_row_begin = FALSE;
-                            have_printed_row_end = TRUE;
-                        }
-                        else
-                        {
-                            if (debug_mode)
+                            outbuf_printf(ctx->out, "end of table row");
+                            if (safe_printf(ctx, 0, op->comment_end))
                             {
-                                if (safe_printf(0, op->comment_begin))
-                                {
-                                    fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
-                                }
-                                printf("end of table row");
-                                if (safe_printf(0, op->comment_end))
-                                {
-                                    fprintf(stderr, TOO_MANY_ARGS, "comment_end");
-                                }
+                                fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                             }
                         }
                     }
+                    break;
 
-                    /*----Special chars---------------------------------------------------------*/
-                    else if (*s == '\'' && s[1] && s[2])
-                    {
-                        /* \'XX is a hex char code expression */
-
-                        int ch = h2toi(&s[1]);
-                        accumulate_iconv_input(ch);
-                    }
-                    else
-                        /*----Search the RTF command hash-------------------------------------------*/
+                default:
+                /*----Search the RTF command table------------------------------------------*/
+                {
+                    HashItem *hip = find_command(ctx, kw, s);
+                    if (hip)
                     {
-                        int have_param = FALSE, param = 0;
-                        HashItem *hip = find_command(s, &have_param, &param);
-                        if (hip)
+                        if (hip->func)
                         {
-                            int terminate_group;
-
-                            if (hip->func)
+                            /* Handlers which read the following words
+                             * get them as a tree */
+                            if (gs->streaming && needs_siblings(hip))
                             {
-                                terminate_group = hip->func(w, paragraph_align, have_param, param);
-                                /* daved - 0.19.4 - unicode support may need to skip only one word */
-                                if (terminate_group == SKIP_ONE_WORD)
-                                {
-                                    w = w->next;
-                                }
-                                else if (terminate_group)
-                                    while (w)
-                                    {
-                                        w = w->next;
-                                    }
+                                return NEEDS_SIBLINGS;
                             }
+                            /* daved - 0.19.4 - unicode support may need to skip only one word */
+                            terminate_group = hip->func(ctx, w, gs->paragraph_align, w->has_param, w->param);
+                        }
 
-                            if (hip->debug_print && debug_mode)
+                        if (hip->debug_print && debug_mode)
+                        {
+                            if (safe_printf(ctx, 0, op->comment_begin))
                             {
-                                if (safe_printf(0, op->comment_begin))
-                                {
-                                    fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
-                                }
-                                printf("%s", hip->debug_print);
-                                if (safe_printf(0, op->comment_end))
-                                {
-                                    fprintf(stderr, TOO_MANY_ARGS, "comment_end");
-                                }
+                                fprintf(stderr, TOO_MANY_ARGS, "comment_begin");
+                            }
+                            outbuf_puts(ctx->out, hip->debug_print);
+                            if (safe_printf(ctx, 0, op->comment_end))
+                            {
+                                fprintf(stderr, TOO_MANY_ARGS, "comment_end");
                             }
-
                         }
+
                     }
                 }
-            /*-------------------------------------------------------------------------*/
-        }
-        else
-        {
-
-            Word *child;
-
-            child = w->child;
-
-            if (!paragraph_begined)
-            {
-                starting_paragraph_align(paragraph_align);
-                paragraph_begined = TRUE;
+                }
             }
+        /*-------------------------------------------------------------------------*/
+    }
+    else
+    {
 
-            if (child)
-            {
-                word_print_core(child, groupdepth + 1);
-            }
-        }
+        group_open_child(ctx, gs);
 
-        if (w)
+        if (w->child)
         {
-            w = w->next;
+            word_print_core(ctx, w->child, gs->groupdepth + 1);
         }
     }
 
-    if (within_picture && within_picture_depth == groupdepth)
+    return terminate_group;
+}
+
+/*========================================================================
+ * Name:    group_end
+ * Purpose:    Finishes rendering a group: closes its picture file, undoes
+ *        its attributes and restores the encoding.
+ * Args:    Conversion context, group state.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+group_end(UnrtfContext *ctx, GroupState *gs)
+{
+    if (ctx->within_picture && ctx->within_picture_depth == gs->groupdepth)
     {
-        within_picture_depth = 0;
-        if (pictfile)
+        ctx->within_picture_depth = 0;
+        if (gs->pictfile)
         {
-            fclose(pictfile);
-            if (safe_printf(0, op->imagelink_begin))
+            fclose(gs->pictfile);
+            if (safe_printf(ctx, 0, op->imagelink_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "imagelink_begin");
             }
-            printf("%s", picture_path);
-            if (safe_printf(0, op->imagelink_end))
+            outbuf_puts(ctx->out, ctx->picture_path);
+            if (safe_printf(ctx, 0, op->imagelink_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "imagelink_end");
             }
         }
-        within_picture = FALSE;
+        ctx->within_picture = FALSE;
     }
 
     /* Undo font attributes UNLESS we're doing table cells
      * since they would appear between </td> and </tr>.
      */
 
-    if (!is_cell_group)
+    if (!gs->is_cell_group)
     {
-        attr_pop_all();
+        attr_pop_all(ctx);
     }
     else
     {
-        attr_drop_all();
+        attr_drop_all(ctx);
     }
 
     /* Undo paragraph alignment
      */
-    if (paragraph_begined)
+    if (gs->paragraph_begined)
     {
-        ending_paragraph_align(paragraph_align);
+        ending_paragraph_align(ctx, gs->paragraph_align);
     }
 
-    attrstack_drop();
+    attrstack_drop(ctx);
 
     // Flush iconv input
-    flush_iconv_input();
-    iconv_cur = 0;
+    flush_iconv_input(ctx);
+    ctx->iconv_cur = 0;
 
     // If there is an encoding in the stacks, restore it, else
     // restore default.
-    desc = my_iconv_close(desc);
-    char *encoding = attr_get_param(ATTR_ENCODING);
+    char *encoding = attr_get_param(ctx, ATTR_ENCODING);
     if (!encoding || !*encoding)
     {
-        encoding = default_encoding;
+        encoding = ctx->default_encoding;
     }
-    desc = my_iconv_open(output_encoding, encoding);
-    set_current_encoding(encoding);
+    select_encoding(ctx, encoding);
+
+    free_collection(gs->opt);
 }
 
+/*========================================================================
+ * Name:    group_print_words
+ * Purpose:    Produces the output for a list of words of a group.
+ * Args:    Conversion context, group state, words.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+group_print_words(UnrtfContext *ctx, GroupState *gs, Word *w)
+{
+    int terminate_group;
+
+    while (w)
+    {
+        terminate_group = group_word(ctx, gs, w);
+        if (terminate_group == SKIP_ONE_WORD)
+        {
+            w = w->next;
+        }
+        else if (terminate_group)
+        {
+            break;
+        }
+
+        if (w)
+        {
+            w = w->next;
+        }
+    }
+}
 
 /*========================================================================
- * Name:
- * Purpose:
- * Args:    None.
+ * Name:    word_print_core
+ * Purpose:    Recursive routine to produce the output in the target
+ *        format given on a tree of words.
+ * Args:    Conversion context, Word* (the tree), group depth.
  * Returns:    None.
  *=======================================================================*/
 
-void
-word_print(Word *w)
+static void
+word_print_core(UnrtfContext *ctx, Word *w, int groupdepth)
 {
+    GroupState gs;
+
+    if (groupdepth > MAX_GROUP_DEPTH)
+    {
+        warning_handler("Max group depth reached");
+        return;
+    }
     CHECK_PARAM_NOT_NULL(w);
 
+    group_begin(ctx, &gs, groupdepth);
+    group_print_words(ctx, &gs, w);
+    group_end(ctx, &gs);
+}
+
+/*========================================================================
+ * Name:    stream_skip_group
+ * Purpose:    Reads and discards words up to the end of the current group.
+ * Args:    Conversion context, number of groups to close.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+stream_skip_group(UnrtfContext *ctx, int depth)
+{
+    while (depth > 0 && word_read_next(ctx))
+    {
+        if (ctx->input_str[0] == '{')
+        {
+            depth++;
+        }
+        else if (ctx->input_str[0] == '}')
+        {
+            depth--;
+        }
+    }
+}
+
+/*========================================================================
+ * Name:    stream_group
+ * Purpose:    Streaming counterpart of word_print_core: renders a group
+ *        while its words are read, without building the Word tree.
+ *        The words following a command that inspects them (see
+ *        needs_siblings) are read as a tree up to the end of the
+ *        group. Redundant attribute commands are dropped as
+ *        optimize_word() would.
+ * Args:    Conversion context, group depth. The first word of the
+ *        group has already been read.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+stream_group(UnrtfContext *ctx, int groupdepth)
+{
+    GroupState gs;
+    Word w;
+    Word *head;
+    const char *s, *last;
+    int i, terminate_group;
+
+    if (groupdepth > MAX_GROUP_DEPTH)
+    {
+        warning_handler("Max group depth reached");
+        stream_skip_group(ctx, ctx->input_str[0] == '{' ? 2 : 1);
+        return;
+    }
+
+    group_begin(ctx, &gs, groupdepth);
+    gs.streaming = TRUE;
+    w.next = NULL;
+    w.child = NULL;
+
+    do
+    {
+        s = ctx->input_str;
+        if (s[0] == '}')
+        {
+            break;
+        }
+
+        if (s[0] == '{')
+        {
+            if (gs.skip_next)
+            {
+                gs.skip_next = FALSE;
+                stream_skip_group(ctx, 1);
+                continue;
+            }
+            group_open_child(ctx, &gs);
+            if (!word_read_next(ctx))
+            {
+                break;
+            }
+            /* An empty group is not rendered at all */
+            if (ctx->input_str[0] != '}')
+            {
+                stream_group(ctx, groupdepth + 1);
+            }
+            continue;
+        }
+
+        w.str = s;
+        w.kw = ctx->kw;
+        w.has_param = ctx->has_param;
+        w.param = ctx->param;
+        if ((i = optimize_tag(&w)) >= 0)
+        {
+            last = get_from_collection(gs.opt, i);
+            if (last && !strcmp(last, s))
+            {
+                continue;
+            }
+            gs.opt = add_to_collection(gs.opt, i, hash_store(ctx, ctx->input_str));
+        }
+
+        if (gs.skip_next)
+        {
+            gs.skip_next = FALSE;
+            continue;
+        }
+
+        terminate_group = group_word(ctx, &gs, &w);
+        if (terminate_group == NEEDS_SIBLINGS)
+        {
+            /* The group's Words are given back as soon as it is printed */
+            ArenaMark mark = arena_mark(&ctx->words);
+            head = word_new_token(ctx);
+            head->next = optimize_words(word_read_group(ctx), groupdepth, &gs.opt);
+            gs.streaming = FALSE;
+            group_print_words(ctx, &gs, head);
+            arena_release(&ctx->words, mark);
+            group_end(ctx, &gs);
+            return;
+        }
+        if (terminate_group == SKIP_ONE_WORD)
+        {
+            gs.skip_next = TRUE;
+        }
+        else if (terminate_group)
+        {
+            stream_skip_group(ctx, 1);
+            break;
+        }
+    }
+    while (word_read_next(ctx));
+
+    group_end(ctx, &gs);
+}
+
+
+/*========================================================================
+ * Name:    print_document_begin, print_document_end
+ * Purpose:    Output before and after the body of the document.
+ * Args:    Conversion context.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+print_document_begin(UnrtfContext *ctx)
+{
     if (!inline_mode)
     {
-        if (safe_printf(0, op->document_begin))
+        if (safe_printf(ctx, 0, op->document_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "document_begin");
         }
-        if (safe_printf(0, op->header_begin))
+        if (safe_printf(ctx, 0, op->header_begin))
         {
             fprintf(stderr, TOO_MANY_ARGS, "header_begin");
         }
-        if (safe_printf(0, op->utf8_encoding))
+        if (safe_printf(ctx, 0, op->utf8_encoding))
         {
             fprintf(stderr, TOO_MANY_ARGS, "utf8_encoding");
         }
@@ -4511,25 +4725,71 @@ word_print(Word *w)
 
     if (!quiet) 
     {
-        print_banner();
+        print_banner(ctx);
     }
 
-    within_header = TRUE;
-    have_printed_body = FALSE;
-    within_table = FALSE;
-    simulate_allcaps = FALSE;
-    word_print_core(w, 1);
-    end_table();
+    ctx->within_header = TRUE;
+    ctx->have_printed_body = FALSE;
+    ctx->within_table = FALSE;
+    ctx->simulate_allcaps = FALSE;
+}
+
+static void
+print_document_end(UnrtfContext *ctx)
+{
+    end_table(ctx);
 
     if (!inline_mode)
     {
-        if (safe_printf(0, op->body_end))
+        if (safe_printf(ctx, 0, op->body_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "body_end");
         }
-        if (safe_printf(0, op->document_end))
+        if (safe_printf(ctx, 0, op->document_end))
         {
             fprintf(stderr, TOO_MANY_ARGS, "document_end");
         }
     }
 }
+
+
+/*========================================================================
+ * Name:    word_print
+ * Purpose:    Produces the output for a tree of words.
+ * Args:    Conversion context, Word* (the tree).
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+word_print(UnrtfContext *ctx, Word *w)
+{
+    CHECK_PARAM_NOT_NULL(w);
+
+    print_document_begin(ctx);
+    word_print_core(ctx, w, 1);
+    print_document_end(ctx);
+}
+
+
+/*========================================================================
+ * Name:    word_print_stream
+ * Purpose:    Produces the output while reading the document, see
+ *        word_read_begin(). Memory use is bounded by the largest group
+ *        that has to be read as a tree, not by the document size.
+ * Args:    Conversion context.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+word_print_stream(UnrtfContext *ctx)
+{
+    /* Nothing at all is printed for an empty document */
+    if (!word_read_next(ctx) || ctx->input_str[0] == '}')
+    {
+        return;
+    }
+
+    print_document_begin(ctx);
+    stream_group(ctx, 1);
+    print_document_end(ctx);
+}
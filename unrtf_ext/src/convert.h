@@ -47,8 +47,22 @@ enum
 	CHARSET_CP850,
 };
 
-extern void convert_reset();
-extern void word_print(Word *);
+extern void word_print(UnrtfContext *, Word *);
+extern void word_print_stream(UnrtfContext *);
+extern void convert_skip_sets(KeywordSet *groups, KeywordSet *starred);
+
+/* Destinations that can be left out of the output */
+enum
+{
+	DROP_HEADERS = 1,
+	DROP_FOOTERS = 2,
+	DROP_FOOTNOTES = 4,
+	DROP_ANNOTATIONS = 8,
+	DROP_INDEX_ENTRIES = 16,	/* \xe */
+	DROP_TOC_ENTRIES = 32,	/* \tc */
+};
+
+extern void convert_drop_set(KeywordSet *set, unsigned int drop);
 #define FONT_GREEK  "cp1253"
 #define FONT_SYMBOL "SYMBOL"
 
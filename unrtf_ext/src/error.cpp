@@ -48,6 +48,7 @@
 
 #include "defs.h"
 #include "main.h"
+#include "error.h"
 
 
 
@@ -69,7 +70,8 @@ usage()
 
 /*========================================================================
  * Name:	error_handler
- * Purpose:	Prints error message and other useful info, then exits.
+ * Purpose:	Aborts the current conversion by throwing a ConversionError;
+ *		the caller of the conversion reports it with the line number.
  * Args:	Message.
  * Returns:	None.
  *=======================================================================*/
@@ -77,12 +79,7 @@ usage()
 void
 error_handler(char *message)
 {
-#if 1
-	fprintf(stderr, "Error (line %d): %s\n", lineno, message);
-#else
-	fprintf(stderr, "Error: %s\n", message);
-#endif
-	exit(10);
+	throw ConversionError(message);
 }
 
 
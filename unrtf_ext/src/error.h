@@ -37,12 +37,23 @@
  *--------------------------------------------------------------------*/
 
 #include <stdio.h>
+#include <stdexcept>
 
 #define CHECK_PARAM_NOT_NULL(XX) { if ((XX)==NULL) { fprintf (stderr, "internal error: null pointer param in %s at %d\n", __FILE__, __LINE__); exit (1); }}
 
 #define CHECK_MALLOC_SUCCESS(XX) { if ((XX)==NULL) { fprintf (stderr, "internal error: cannot allocate memory in %s at %d\n", __FILE__, __LINE__); exit (1); }}
 
 
+/* Thrown by error_handler. The conversion entry points in lib.cpp
+ * fill in the line number and report it. */
+class ConversionError : public std::runtime_error
+{
+public:
+	explicit ConversionError(const char *message)
+		: std::runtime_error(message), lineno(0) {}
+	int lineno;
+};
+
 extern void usage(void);
 extern void error_handler(char *);
 extern void warning_handler(char *);
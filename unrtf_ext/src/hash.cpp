@@ -26,109 +26,256 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <atomic>
 
 #include "error.h"
 #include "main.h"
 #include "malloc.h"
+#include "hash.h"
+#include "context.h"
 
 
-typedef struct _hi
+/* One slot of the open addressing table; str is NULL in empty slots.
+   The strings themselves live in ctx->strings. */
+typedef struct _hs
 {
-	struct _hi *next;
-	char str[1];
-} HashItem;
+	const char *str;
+	unsigned int hash;
+	unsigned int len;
+} HashSlot;
 
+/* The table starts with this many slots and doubles when half full */
+#define HASH_MIN_SLOTS 1024
+/* A table grown beyond this is given back when the conversion is over,
+   so one huge document does not pin its table in a long-lived worker */
+#define HASH_KEEP_SLOTS 65536
+
+/* Totals of the conversions released so far, all threads together */
+static std::atomic<unsigned long> total_lookups(0);
+static std::atomic<unsigned long> total_stored(0);
+static std::atomic<unsigned long> total_probes(0);
+static std::atomic<unsigned long> total_bytes(0);
+static std::atomic<unsigned long> total_conversions(0);
+static std::atomic<unsigned long> max_entries(0);
 
-/* Index by first char of string not \ */
-static HashItem *hash[256];
 
 /*========================================================================
  * Name:	hash_stats
  * Purpose:	Return the number of words stored. This is all words,
  * 			including commands to RTF, NOT the number of printed words in
  * 			a given document.
- * Args:	None.
+ * Args:	Conversion context.
  * Returns:	Number of words stored.
  *=======================================================================*/
 
 unsigned long
-hash_stats()
+hash_stats(UnrtfContext *ctx)
 {
-	int i;
-	unsigned long total = 0;
-	HashItem *hi;
-	for (i = 0; i < 256; i++)
+	return ctx->hash_count;
+}
+
+
+
+/*========================================================================
+ * Name:	hash_global_stats
+ * Purpose:	Reports the counters of every conversion finished so far,
+ *		in this process.
+ * Args:	Structure to fill.
+ * Returns:	None.
+ *=======================================================================*/
+
+void
+hash_global_stats(HashStats *stats)
+{
+	stats->lookups = total_lookups;
+	stats->stored = total_stored;
+	stats->probes = total_probes;
+	stats->bytes = total_bytes;
+	stats->conversions = total_conversions;
+	stats->max_entries = max_entries;
+}
+
+
+
+/*========================================================================
+ * Name:	hash_string
+ * Purpose:	FNV-1a hash of a 0-terminated string, measuring it on the
+ *		way.
+ * Args:	String, where to put its length.
+ * Returns:	Hash.
+ *=======================================================================*/
+
+static unsigned int
+hash_string(const char *str, unsigned int *len)
+{
+	const unsigned char *p = (const unsigned char *) str;
+	unsigned int h = 2166136261u;
+
+	while (*p)
 	{
-		hi = hash[i];
-		while (hi)
-		{
-			total++;
-			hi = hi->next;
-		}
+		h = (h ^ *p++) * 16777619u;
 	}
-	return total;
+	*len = (unsigned int) (p - (const unsigned char *) str);
+	return h;
 }
 
 
 
 /*========================================================================
- * Name:	hashitem_new
- * Purpose:	Creates a new linked list item for the hash table.
- * Args:	String.
- * Returns:	HashItem.
+ * Name:	hash_grow
+ * Purpose:	Doubles the table (or creates it), moving the slots in use.
+ * Args:	Conversion context.
+ * Returns:	None.
  *=======================================================================*/
 
-static HashItem *
-hashitem_new(char *str)
+static void
+hash_grow(UnrtfContext *ctx)
 {
-	HashItem *hi;
+	unsigned long size = ctx->hash_size ? ctx->hash_size * 2 : HASH_MIN_SLOTS;
+	unsigned long i, j;
+	HashSlot *slots;
 
-	/* We already have a char[1], so allocating strlen() does
-	   yield space for the ending 0 */
-	unsigned int l = sizeof(HashItem) + strlen(str);
-	hi = (HashItem *) my_malloc(l);
-	if (!hi)
+	slots = (HashSlot *) my_malloc(size * sizeof(HashSlot));
+	if (!slots)
 	{
 		error_handler("Out of memory");
 	}
-	strcpy(hi->str, str);
-	hi->next = NULL;
+	memset(slots, 0, size * sizeof(HashSlot));
 
-	return hi;
+	for (i = 0; i < ctx->hash_size; i++)
+	{
+		if (ctx->hash[i].str)
+		{
+			j = ctx->hash[i].hash & (size - 1);
+			while (slots[j].str)
+			{
+				j = (j + 1) & (size - 1);
+			}
+			slots[j] = ctx->hash[i];
+		}
+	}
+	if (ctx->hash)
+	{
+		my_free((char *) ctx->hash);
+	}
+	ctx->hash = slots;
+	ctx->hash_size = size;
 }
 
 
+
 /*========================================================================
  * Name:	hash_store
  * Purpose:	Given a string, find or store it and return the address of
  *              the copy.
- * Args:	String.
+ * Args:	Conversion context, string.
  * Returns:	Address of readonly clone.
  *=======================================================================*/
 
 const char *
-hash_store(char *str)
+hash_store(UnrtfContext *ctx, char *str)
 {
-	unsigned char ch = (unsigned char) * str;
-	HashItem *hi;
+	unsigned int len;
+	unsigned int h = hash_string(str, &len);
+	unsigned long i;
+	HashSlot *slot;
 
-	if (ch == '\\' && *(str + 1))
+	if (2 * (ctx->hash_count + 1) > ctx->hash_size)
 	{
-		ch = *(str + 1);
+		hash_grow(ctx);
 	}
-	hi = hash[ch];
-	while (hi)
+	ctx->hash_lookups++;
+
+	/* Linear probing; the table is at most half full, so an empty
+	   slot is always reached */
+	for (i = h & (ctx->hash_size - 1);; i = (i + 1) & (ctx->hash_size - 1))
 	{
-		if (!strcmp(hi->str, str))
+		slot = &ctx->hash[i];
+		ctx->hash_probes++;
+		if (!slot->str)
+		{
+			break;
+		}
+		if (slot->hash == h && slot->len == len && !memcmp(slot->str, str, len))
 		{
-			return hi->str;
+			return slot->str;
 		}
-		hi = hi->next;
 	}
+
 	/* not in hash */
-	hi = hashitem_new(str);
-	hi->next = hash[ch];
-	hash[ch] = hi;
-	return hi->str;
+	slot->str = arena_strdup(&ctx->strings, str, len);
+	slot->hash = h;
+	slot->len = len;
+	ctx->hash_count++;
+	ctx->hash_bytes += len + 1;
+	return slot->str;
 }
 
+
+
+/*========================================================================
+ * Name:	hash_free
+ * Purpose:	Releases every string stored for a conversion, and adds its
+ *		counters to the process totals. Addresses returned by
+ *		hash_store() become invalid.
+ * Args:	Conversion context.
+ * Returns:	None.
+ *=======================================================================*/
+
+void
+hash_free(UnrtfContext *ctx)
+{
+	unsigned long seen;
+
+	if (ctx->hash_lookups)
+	{
+		total_lookups += ctx->hash_lookups;
+		total_stored += ctx->hash_count;
+		total_probes += ctx->hash_probes;
+		total_bytes += ctx->hash_bytes;
+		total_conversions++;
+		seen = max_entries;
+		while (ctx->hash_count > seen
+		       && !max_entries.compare_exchange_weak(seen, ctx->hash_count))
+		{
+		}
+	}
+
+	if (ctx->hash_size > HASH_KEEP_SLOTS)
+	{
+		my_free((char *) ctx->hash);
+		ctx->hash = NULL;
+		ctx->hash_size = 0;
+	}
+	else if (ctx->hash)
+	{
+		memset(ctx->hash, 0, ctx->hash_size * sizeof(HashSlot));
+	}
+	ctx->hash_count = 0;
+	ctx->hash_lookups = 0;
+	ctx->hash_probes = 0;
+	ctx->hash_bytes = 0;
+	arena_reset(&ctx->strings);
+}
+
+
+
+/*========================================================================
+ * Name:	hash_destroy
+ * Purpose:	Releases the table itself, when the context goes away.
+ * Args:	Conversion context.
+ * Returns:	None.
+ *=======================================================================*/
+
+void
+hash_destroy(UnrtfContext *ctx)
+{
+	hash_free(ctx);
+	if (ctx->hash)
+	{
+		my_free((char *) ctx->hash);
+		ctx->hash = NULL;
+		ctx->hash_size = 0;
+	}
+	arena_free(&ctx->strings);
+}
@@ -30,7 +30,8 @@
  * Purpose: Shared string storage. This yields an approximate average 35%
  *   improvement of memory used for string storage against original file
  *   size (372 random rtfs from the internets, 200 MB). Some shrink a
- *   lot, some actually inflate.
+ *   lot, some actually inflate. The storage belongs to one conversion
+ *   and is released with it.
  *----------------------------------------------------------------------
  * Changes:
  * 29 Mar 05, daved@physiol.usyd.edu.au: changes requested by ZT Smith
@@ -41,8 +42,26 @@
  *--------------------------------------------------------------------*/
 
 
-extern unsigned long hash_stats(void);
+typedef struct _unrtf_context UnrtfContext;
+
+/* Counters of all the conversions released so far */
+typedef struct
+{
+	unsigned long lookups;		/* hash_store() calls */
+	unsigned long stored;		/* strings copied */
+	unsigned long probes;		/* slots looked at */
+	unsigned long bytes;		/* string bytes copied */
+	unsigned long conversions;
+	unsigned long max_entries;	/* largest table of one conversion */
+} HashStats;
+
+extern unsigned long hash_stats(UnrtfContext *);
+extern void hash_global_stats(HashStats *);
 /* Store/find string, returns address of stored copy */
-extern const char *hash_store(char *);
+extern const char *hash_store(UnrtfContext *, char *);
+/* Release all strings stored for the context */
+extern void hash_free(UnrtfContext *);
+/* Same, and release the table itself */
+extern void hash_destroy(UnrtfContext *);
 
 #endif /* _HASH_H_INCLUDED_ */
@@ -0,0 +1,185 @@
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "keywords.h"
+
+/* The perfect hash is "hash and displace": the FNV-1a hash of a name
+ * picks one of KW_BUCKETS buckets with its low bits, and a slot with the
+ * others plus the displacement chosen for that bucket. The
+ * displacements are searched by the compiler, biggest buckets first,
+ * so that no two names share a slot.
+ */
+
+#define KW_BUCKETS 128
+#define KW_SLOTS 512
+
+static_assert(KW_SLOTS >= 2 * KW_NAMED, "too many keywords for KW_SLOTS");
+
+#define X(id, name) name,
+static constexpr const char *names[KW_NAMED] = { "", UNRTF_KEYWORDS(X) };
+#undef X
+
+#define X(id, name) sizeof(name) - 1,
+static constexpr unsigned char lengths[KW_NAMED] = { 0, UNRTF_KEYWORDS(X) };
+#undef X
+
+static constexpr unsigned int
+kw_hash(const char *s, size_t len)
+{
+    unsigned int h = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ (unsigned char) s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static constexpr unsigned int
+kw_slot(unsigned int h, unsigned int displacement)
+{
+    return ((h / KW_BUCKETS) + displacement) % KW_SLOTS;
+}
+
+typedef struct
+{
+    unsigned short displacement[KW_BUCKETS];
+    unsigned char slot[KW_SLOTS];   /* Keyword, KW_NONE when empty */
+    bool complete;
+} PerfectHash;
+
+static_assert(KW_NAMED <= 256, "PerfectHash.slot holds Keywords in bytes");
+
+static constexpr PerfectHash
+build_perfect_hash()
+{
+    PerfectHash t = {};
+    unsigned int h[KW_NAMED] = {};
+    unsigned int bucket_size[KW_BUCKETS] = {};
+    unsigned int biggest = 0;
+
+    for (int k = 1; k < KW_NAMED; k++)
+    {
+        h[k] = kw_hash(names[k], lengths[k]);
+        if (++bucket_size[h[k] % KW_BUCKETS] > biggest)
+        {
+            biggest = bucket_size[h[k] % KW_BUCKETS];
+        }
+    }
+
+    t.complete = true;
+    for (unsigned int size = biggest; size > 0; size--)
+    {
+        for (unsigned int b = 0; b < KW_BUCKETS; b++)
+        {
+            if (bucket_size[b] != size)
+            {
+                continue;
+            }
+            unsigned int d = 0;
+            for (; d < KW_SLOTS; d++)
+            {
+                bool fits = true;
+                int k = 1;
+                for (; k < KW_NAMED && fits; k++)
+                {
+                    if (h[k] % KW_BUCKETS == b)
+                    {
+                        unsigned char &slot = t.slot[kw_slot(h[k], d)];
+                        if (slot != KW_NONE)
+                        {
+                            fits = false;
+                        }
+                        else
+                        {
+                            slot = (unsigned char) k;
+                        }
+                    }
+                }
+                if (fits)
+                {
+                    break;
+                }
+                /* Take back what this bucket got so far */
+                for (int j = 1; j < k - 1; j++)
+                {
+                    if (h[j] % KW_BUCKETS == b)
+                    {
+                        t.slot[kw_slot(h[j], d)] = KW_NONE;
+                    }
+                }
+            }
+            if (d == KW_SLOTS)
+            {
+                t.complete = false;
+            }
+            t.displacement[b] = (unsigned short) d;
+        }
+    }
+    return t;
+}
+
+static constexpr PerfectHash perfect_hash = build_perfect_hash();
+
+static_assert(perfect_hash.complete, "no perfect hash found, change KW_BUCKETS or KW_SLOTS");
+
+/*========================================================================
+ * Name:    keyword_lookup
+ * Purpose:    Finds the control word with the given name.
+ * Args:    Name (not terminated), length.
+ * Returns:    Keyword, or KW_NONE.
+ *=======================================================================*/
+
+Keyword
+keyword_lookup(const char *name, size_t len)
+{
+    unsigned int h = kw_hash(name, len);
+    int k = perfect_hash.slot[kw_slot(h, perfect_hash.displacement[h % KW_BUCKETS])];
+
+    if (k != KW_NONE && lengths[k] == len && !memcmp(names[k], name, len))
+    {
+        return (Keyword) k;
+    }
+    return KW_NONE;
+}
+
+/*========================================================================
+ * Name:    keyword_name
+ * Purpose:    Gives the name of a control word.
+ * Args:    Keyword.
+ * Returns:    Name, "" for KW_NONE and the Keywords without a name.
+ *=======================================================================*/
+
+const char *
+keyword_name(Keyword k)
+{
+    return k < KW_NAMED ? names[k] : "";
+}
+
+/*========================================================================
+ * Name:    keyword_parse
+ * Purpose:    Splits a control word (without its backslash) into name and
+ *             numeric parameter, and looks the name up.
+ *             ex: "cmd" "cmd123" "cmd-2"
+ * Args:    Control word, parameter existence flag (output), parameter
+ *          value if the flag is set (output).
+ * Returns:    Keyword, or KW_NONE.
+ *=======================================================================*/
+
+Keyword
+keyword_parse(const char *s, int *has_param, int *param)
+{
+    const char *p = s;
+
+    while (*p && !isdigit((unsigned char) *p) && *p != '-')
+    {
+        p++;
+    }
+    *has_param = *p != 0;
+    if (*has_param)
+    {
+        *param = atoi(p);
+    }
+    return keyword_lookup(s, p - s);
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Every RTF control word the converter acts on, as X(ID, name). Each
+ * one gets a KW_ID value; keyword_lookup() finds it from its name
+ * through a perfect hash built at compile time (keywords.cpp), so
+ * looking up a control word costs one hash and one compare.
+ * Order does not matter.
+ */
+#define UNRTF_KEYWORDS(X) \
+    /* Control symbols */              \
+    X(STAR, "*")                       \
+    X(OPTIONAL_HYPHEN, "-")            \
+    X(NONBREAKING_HYPHEN, "_")         \
+    X(NONBREAKING_SPACE, "~")          \
+    /* Handled in the parser */        \
+    X(UC, "uc")                        \
+    /* Handled in group_word() */      \
+    X(QL, "ql")                        \
+    X(QR, "qr")                        \
+    X(QJ, "qj")                        \
+    X(QC, "qc")                        \
+    X(PARD, "pard")                    \
+    X(CELL, "cell")                    \
+    X(ROW, "row")                      \
+    /* Fields, tables and info */      \
+    X(FLDINST, "fldinst")              \
+    X(FLDRSLT, "fldrslt")              \
+    X(FCHARSET, "fcharset")            \
+    X(CPG, "cpg")                      \
+    X(RED, "red")                      \
+    X(GREEN, "green")                  \
+    X(BLUE, "blue")                    \
+    X(TITLE, "title")                  \
+    X(KEYWORDS, "keywords")            \
+    X(AUTHOR, "author")                \
+    X(COMMENT, "comment")              \
+    X(NOFPAGES, "nofpages")            \
+    X(NOFWORDS, "nofwords")            \
+    X(NOFCHARS, "nofchars")            \
+    X(CREATIM, "creatim")              \
+    X(PRINTIM, "printim")              \
+    X(BUPTIM, "buptim")                \
+    X(REVTIM, "revtim")                \
+    X(HLINKBASE, "hlinkbase")          \
+    X(YR, "yr")                        \
+    X(MO, "mo")                        \
+    X(DY, "dy")                        \
+    X(HR, "hr")                        \
+    X(MIN, "min")                      \
+    /* Only known to be dropped */     \
+    X(ANNOTATION, "annotation")        \
+    X(FOOTNOTE, "footnote")            \
+    /* Command table of convert.cpp */ \
+    X(ANSI, "ansi")                    \
+    X(ANSICPG, "ansicpg")              \
+    X(B, "b")                          \
+    X(BULLET, "bullet")                \
+    X(BIN, "bin")                      \
+    X(BLIPUID, "blipuid")              \
+    X(CAPS, "caps")                    \
+    X(CB, "cb")                        \
+    X(CF, "cf")                        \
+    X(COLORTBL, "colortbl")            \
+    X(COLS, "cols")                    \
+    X(COLUMN, "column")                \
+    X(CBPAT, "cbpat")                  \
+    X(CELLX, "cellx")                  \
+    X(CFPAT, "cfpat")                  \
+    X(CGRID, "cgrid")                  \
+    X(CHARRSID, "charrsid")            \
+    X(CLBGBCROSS, "clbgbcross")        \
+    X(CLBGBDIAG, "clbgbdiag")          \
+    X(CLBGBKBDIAG, "clbgbkbdiag")      \
+    X(CLBGBKCROSS, "clbgbkcross")      \
+    X(CLBGBKDCROSS, "clbgbkdcross")    \
+    X(CLBGBKFDIAG, "clbgbkfdiag")      \
+    X(CLBGBKHOR, "clbgbkhor")          \
+    X(CLBGBKVERT, "clbgbkvert")        \
+    X(CLBGDCROSS, "clbgdcross")        \
+    X(CLBGFDIAG, "clbgfdiag")          \
+    X(CLBGHORIZ, "clbghoriz")          \
+    X(CLBGVERT, "clbgvert")            \
+    X(CLBRDRB, "clbrdrb")              \
+    X(CLBRDRL, "clbrdrl")              \
+    X(CLBRDRR, "clbrdrr")              \
+    X(CLBRDRT, "clbrdrt")              \
+    X(CLCBPAT, "clcbpat")              \
+    X(CLCFPAT, "clcfpat")              \
+    X(CLMGF, "clmgf")                  \
+    X(CLMRG, "clmrg")                  \
+    X(CLSHDNG, "clshdng")              \
+    X(CS, "cs")                        \
+    X(DEFF, "deff")                    \
+    X(DN, "dn")                        \
+    X(EMDASH, "emdash")                \
+    X(ENDASH, "endash")                \
+    X(EMBO, "embo")                    \
+    X(EXPAND, "expand")                \
+    X(EXPND, "expnd")                  \
+    X(EMFBLIP, "emfblip")              \
+    X(F, "f")                          \
+    X(FDECOR, "fdecor")                \
+    X(FMODERN, "fmodern")              \
+    X(FNIL, "fnil")                    \
+    X(FONTTBL, "fonttbl")              \
+    X(FROMAN, "froman")                \
+    X(FS, "fs")                        \
+    X(FSCRIPT, "fscript")              \
+    X(FSWISS, "fswiss")                \
+    X(FTECH, "ftech")                  \
+    X(FIELD, "field")                  \
+    X(FOOTER, "footer")                \
+    X(FOOTERF, "footerf")              \
+    X(FOOTERL, "footerl")              \
+    X(FOOTERR, "footerr")              \
+    X(HIGHLIGHT, "highlight")          \
+    X(HEADER, "header")                \
+    X(HEADERF, "headerf")              \
+    X(HEADERL, "headerl")              \
+    X(HEADERR, "headerr")              \
+    X(HL, "hl")                        \
+    X(I, "i")                          \
+    X(INFO, "info")                    \
+    X(INSRSID, "insrsid")              \
+    X(INTBL, "intbl")                  \
+    X(IMPR, "impr")                    \
+    X(JPEGBLIP, "jpegblip")            \
+    X(LDBLQUOTE, "ldblquote")          \
+    X(LINE, "line")                    \
+    X(LQUOTE, "lquote")                \
+    X(MAC, "mac")                      \
+    X(MACPICT, "macpict")              \
+    X(NOSUPERSUB, "nosupersub")        \
+    X(NONSHPPICT, "nonshppict")        \
+    X(OUTL, "outl")                    \
+    X(PAGE, "page")                    \
+    X(PAR, "par")                      \
+    X(PC, "pc")                        \
+    X(PCA, "pca")                      \
+    X(PICH, "pich")                    \
+    X(PICT, "pict")                    \
+    X(PICPROP, "picprop")              \
+    X(PICW, "picw")                    \
+    X(PLAIN, "plain")                  \
+    X(PNGBLIP, "pngblip")              \
+    X(PNMETAFILE, "pnmetafile")        \
+    X(RDBLQUOTE, "rdblquote")          \
+    X(RQUOTE, "rquote")                \
+    X(RTF, "rtf")                      \
+    X(S, "s")                          \
+    X(SECT, "sect")                    \
+    X(SCAPS, "scaps")                  \
+    X(SUPER, "super")                  \
+    X(SUB, "sub")                      \
+    X(SHAD, "shad")                    \
+    X(STRIKE, "strike")                \
+    X(STRIKED, "striked")              \
+    X(STRIKEDL, "strikedl")            \
+    X(STYLESHEET, "stylesheet")        \
+    X(SHP, "shp")                      \
+    X(SHPPICT, "shppict")              \
+    X(TAB, "tab")                      \
+    X(TC, "tc")                        \
+    X(TCN, "tcn")                      \
+    X(TROWD, "trowd")                  \
+    X(U, "u")                          \
+    X(UL, "ul")                        \
+    X(UP, "up")                        \
+    X(ULD, "uld")                      \
+    X(ULDASH, "uldash")                \
+    X(ULDASHD, "uldashd")              \
+    X(ULDASHDD, "uldashdd")            \
+    X(ULDB, "uldb")                    \
+    X(ULNONE, "ulnone")                \
+    X(ULTH, "ulth")                    \
+    X(ULTHD, "ulthd")                  \
+    X(ULTHDASH, "ulthdash")            \
+    X(ULW, "ulw")                      \
+    X(ULWAVE, "ulwave")                \
+    X(V, "v")                          \
+    X(WBMBITSPIXEL, "wbmbitspixel")    \
+    X(WMETAFILE, "wmetafile")          \
+    X(XE, "xe")
+
+typedef enum
+{
+    KW_NONE = 0,            /* not a control word we know */
+#define X(id, name) KW_##id,
+    UNRTF_KEYWORDS(X)
+#undef X
+    KW_NAMED,               /* the Keywords above have a name */
+
+    /* Given by the parser to runs of \'XX bytes, to the \'XX
+     * expressions it leaves alone (not hexadecimal, or zero) and to runs
+     * of \uN characters; they have no name, so keyword_lookup() never
+     * returns them. They have no entry in commands[]: group_word() prints
+     * them itself, and cmd_maybe_ignore() takes a KW_UNICODE run as a
+     * known \u. */
+    KW_HEX = KW_NAMED,
+    KW_HEX_EXPR,
+    KW_UNICODE,
+
+    KW_COUNT
+} Keyword;
+
+extern Keyword keyword_lookup(const char *name, size_t len);
+extern const char *keyword_name(Keyword);
+extern Keyword keyword_parse(const char *s, int *has_param, int *param);
+
+/* A set of Keywords, one bit each */
+typedef struct
+{
+    unsigned char bits[(KW_COUNT + 7) / 8];
+} KeywordSet;
+
+static inline void
+keyword_set_add(KeywordSet *set, Keyword k)
+{
+    set->bits[k / 8] |= 1 << (k % 8);
+}
+
+static inline int
+keyword_set_has(const KeywordSet *set, Keyword k)
+{
+    return set->bits[k / 8] & (1 << (k % 8));
+}
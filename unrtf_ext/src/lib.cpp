@@ -5,6 +5,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "defs.h"
 #include "error.h"
@@ -20,11 +28,12 @@
 #include "main.h"
 #include "util.h"
 #include "fontentry.h"
+#include "outbuf.h"
+#include "context.h"
+#include "lib.h"
 
-int nopict_mode = TRUE; /* TRUE => Do not write \pict's to files */
 int dump_mode = FALSE;   /* TRUE => Output a dump of the RTF word tree */
 int debug_mode = FALSE;  /* TRUE => Output debug comments within HTML */
-int lineno;      /* Used for error reporting and final line count. */
 int simple_mode = FALSE; /* TRUE => Output HTML without SPAN/DIV tags -- This would
                     probably be more useful if we could pull out <font> tags
                     as well. */
@@ -35,9 +44,6 @@ int verbose_mode = FALSE;  /* TRUE => Output additional informations about unrtf
 int no_remap_mode = FALSE; /* don't remap codepoints */
 int quiet = FALSE;       /* TRUE => don't output header comments */
 
-FontEntry font_table[MAX_FONTS];
-int total_fonts = 0;
-
 OutputPersonality *op = NULL;
 
 OutputPersonality *
@@ -61,20 +67,320 @@ get_config(char *name, OutputPersonality *op)
 }
 
 
-int unrtf(FILE * fp, bool nopict_mode_) {
+/* The search path and the output personality are shared by all
+ * conversions; they are set up once, by whichever thread gets here
+ * first, and only read afterwards. */
+static std::once_flag config_once;
+
+static void load_default_config() {
     search_path = DEFAULT_UNRTF_SEARCH_PATH;
     if (op == NULL)
     {
         op = get_config(DEFAULT_OUTPUT, op);
     }
+}
 
-    nopict_mode = nopict_mode_;
-    convert_reset();
+/* Names of the destinations that can be dropped */
+static const struct {
+    const char * name;
+    unsigned int flag;
+} drop_names[] = {
+    { "header", DROP_HEADERS },
+    { "footer", DROP_FOOTERS },
+    { "footnote", DROP_FOOTNOTES },
+    { "annotation", DROP_ANNOTATIONS },
+    { "xe", DROP_INDEX_ENTRIES },
+    { "tc", DROP_TOC_ENTRIES },
+};
 
-    total_fonts = 0;
-    Word * word = word_read(fp);
-    word = optimize_word(word, 1);
-    word_print(word);
-    word_free(word);
+/* Returns 0 for an unknown name */
+unsigned int unrtf_drop_flag(const char * name) {
+    for (size_t i = 0; i < sizeof(drop_names) / sizeof(drop_names[0]); i++)
+    {
+        if (!strcmp(name, drop_names[i].name))
+        {
+            return drop_names[i].flag;
+        }
+    }
+    return 0;
+}
+
+/* Without streaming the whole Word tree is built before anything is
+ * printed; with it the document is rendered as it is read. The dropped
+ * destinations are skipped by the parser. */
+void unrtf_convert(UnrtfContext * ctx, const char * data, size_t len,
+                   bool nopict_mode_, bool streaming, unsigned int drop, OutputBuffer * out) {
+    std::call_once(config_once, load_default_config);
+
+    context_reset(ctx, out, nopict_mode_);
+    convert_drop_set(&ctx->drop_groups, drop);
+    /* The fallbacks of \uN characters are only needed when they cannot
+       be printed */
+    ctx->unicode_runs = op->utf8_output || op->unisymbol_print;
+    try
+    {
+        if (streaming)
+        {
+            word_read_begin(ctx, data, len);
+            word_print_stream(ctx);
+        }
+        else
+        {
+            Word * word = word_read(ctx, data, len);
+            if (word != NULL)
+            {
+                word = optimize_word(word, 1);
+                word_print(ctx, word);
+            }
+        }
+        outbuf_flush(out);
+    }
+    catch (ConversionError & e)
+    {
+        e.lineno = ctx->lineno;
+        throw;
+    }
+}
+
+int unrtf_memory(const char * data, size_t len, bool nopict_mode_, bool streaming,
+                 unsigned int drop, OutputBuffer * out) {
+    UnrtfContext * ctx = context_create(out, nopict_mode_);
+    try
+    {
+        unrtf_convert(ctx, data, len, nopict_mode_, streaming, drop, out);
+    }
+    catch (...)
+    {
+        context_free(ctx);
+        throw;
+    }
+    context_free(ctx);
     return 42;
 }
+
+/* The rest of an input file, held in memory for the parser */
+typedef struct
+{
+    char * map;     /* mmap'ed region, or NULL */
+    size_t map_len;
+    char * buf;     /* malloc'ed copy, or NULL */
+    const char * data;
+    size_t len;
+} InputFile;
+
+/* Regular files are mapped; anything else (pipes, fmemopen streams...)
+ * is read into a buffer. */
+static void input_load(FILE * fp, InputFile * in) {
+    struct stat st;
+    off_t pos;
+    size_t size = 0;
+    size_t n;
+
+    memset(in, 0, sizeof(*in));
+
+    pos = ftello(fp);
+    int fd = fileno(fp);
+    if (fd >= 0 && pos >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > pos)
+    {
+        void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            in->map = (char *) map;
+            in->map_len = st.st_size;
+            in->data = in->map + pos;
+            in->len = st.st_size - pos;
+            return;
+        }
+    }
+
+    while (!feof(fp))
+    {
+        if (in->len == size)
+        {
+            size = size ? size * 2 : 65536;
+            char * buf = (char *) realloc(in->buf, size);
+            if (buf == NULL)
+            {
+                free(in->buf);
+                error_handler("out of memory reading input");
+            }
+            in->buf = buf;
+        }
+        n = fread(in->buf + in->len, 1, size - in->len, fp);
+        if (n == 0 && ferror(fp))
+        {
+            free(in->buf);
+            error_handler("cannot read input");
+        }
+        in->len += n;
+    }
+    in->data = in->buf;
+}
+
+static void input_release(InputFile * in) {
+    if (in->map)
+    {
+        munmap(in->map, in->map_len);
+    }
+    free(in->buf);
+}
+
+int unrtf_to_buffer(FILE * fp, bool nopict_mode_, OutputBuffer * out) {
+    InputFile in;
+    int return_value;
+
+    input_load(fp, &in);
+    try
+    {
+        return_value = unrtf_memory(in.data, in.len, nopict_mode_, false, 0, out);
+    }
+    catch (...)
+    {
+        input_release(&in);
+        throw;
+    }
+    input_release(&in);
+    return return_value;
+}
+
+/* Converts a document held in memory and writes it to stdout as it is
+ * rendered, or the error to stderr */
+int unrtf_print(const char * data, size_t len, bool nopict_mode_) {
+    OutputBuffer out;
+    int return_value;
+    fflush(stdout);
+    outbuf_init_fd(&out, fileno(stdout), 0);
+    try
+    {
+        return_value = unrtf_memory(data, len, nopict_mode_, false, 0, &out);
+    }
+    catch (ConversionError & e)
+    {
+        fprintf(stderr, "Error (line %d): %s\n", e.lineno, e.what());
+        outbuf_free(&out);
+        return 10;
+    }
+    outbuf_free(&out);
+    return return_value;
+}
+
+int unrtf(FILE * fp, bool nopict_mode_) {
+    InputFile in;
+    int return_value;
+    try
+    {
+        input_load(fp, &in);
+    }
+    catch (ConversionError & e)
+    {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 10;
+    }
+    return_value = unrtf_print(in.data, in.len, nopict_mode_);
+    input_release(&in);
+    return return_value;
+}
+
+/* Body of one unrtf_many() thread: takes the next job until none is
+ * left, reusing one context for all of them. Nothing may leave a
+ * thread, so every error is recorded in the job it happened in. */
+static void unrtf_many_worker(UnrtfJob * jobs, size_t count,
+                              std::atomic<size_t> * next, bool nopict_mode_, bool streaming,
+                              unsigned int drop) {
+    UnrtfContext * ctx = NULL;
+    std::string ctx_error;
+    size_t i;
+    try
+    {
+        ctx = context_create(NULL, nopict_mode_);
+    }
+    catch (std::exception & e)
+    {
+        ctx_error = e.what();
+    }
+    while ((i = (*next)++) < count)
+    {
+        UnrtfJob * job = &jobs[i];
+        outbuf_init(&job->out);
+        job->failed = FALSE;
+        job->lineno = 0;
+        job->error[0] = 0;
+        if (ctx == NULL)
+        {
+            job->failed = TRUE;
+            snprintf(job->error, sizeof(job->error), "%s", ctx_error.c_str());
+            continue;
+        }
+        try
+        {
+            unrtf_convert(ctx, job->data, job->len, nopict_mode_, streaming, drop, &job->out);
+        }
+        catch (ConversionError & e)
+        {
+            job->failed = TRUE;
+            job->lineno = e.lineno;
+            snprintf(job->error, sizeof(job->error), "%s", e.what());
+            outbuf_free(&job->out);
+        }
+        catch (std::exception & e)
+        {
+            job->failed = TRUE;
+            job->lineno = ctx->lineno;
+            snprintf(job->error, sizeof(job->error), "%s", e.what());
+            outbuf_free(&job->out);
+        }
+    }
+    if (ctx != NULL)
+    {
+        context_free(ctx);
+    }
+}
+
+/* Throws ConversionError if the threads cannot be started; the ones
+ * already running are stopped and joined first. */
+void unrtf_many(UnrtfJob * jobs, size_t count, int threads, bool nopict_mode_, bool streaming,
+                unsigned int drop) {
+    std::atomic<size_t> next(0);
+
+    std::call_once(config_once, load_default_config);
+
+    if (threads <= 0)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    if ((size_t) threads > count)
+    {
+        threads = count;
+    }
+    if (threads <= 1)
+    {
+        unrtf_many_worker(jobs, count, &next, nopict_mode_, streaming, drop);
+        return;
+    }
+
+    std::vector<std::thread> pool;
+    std::string error;
+    try
+    {
+        /* Reserved first, so that no started thread is lost to a
+           failing push_back() */
+        pool.reserve(threads);
+        for (int t = 0; t < threads; t++)
+        {
+            pool.push_back(std::thread(unrtf_many_worker, jobs, count, &next, nopict_mode_, streaming, drop));
+        }
+    }
+    catch (std::exception & e)
+    {
+        error = std::string("cannot start conversion threads: ") + e.what();
+        next = count;
+    }
+    for (auto & thread : pool)
+    {
+        thread.join();
+    }
+    if (!error.empty())
+    {
+        throw ConversionError(error.c_str());
+    }
+}
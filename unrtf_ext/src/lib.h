@@ -2,8 +2,8 @@
 #include <stdio.h>
 
 #include "output.h"
+#include "outbuf.h"
 
-extern int lineno;
 extern int debug_mode;
 extern int simple_mode;
 extern int inline_mode;
@@ -14,4 +14,29 @@ extern int no_remap_mode;
 extern OutputPersonality *op;
 
 OutputPersonality * get_config(char *name, OutputPersonality *op);
+
+typedef struct _unrtf_context UnrtfContext;
+
+/* One document of an unrtf_many() batch */
+typedef struct
+{
+    const char * data;  /* input, not owned */
+    size_t len;
+    OutputBuffer out;   /* rendered document, empty if failed */
+    int failed;
+    int lineno;         /* line of the error if failed */
+    char error[256];
+} UnrtfJob;
+
 int unrtf(FILE * fp, bool no_pict_mode_);
+int unrtf_print(const char * data, size_t len, bool no_pict_mode_);
+int unrtf_to_buffer(FILE * fp, bool no_pict_mode_, OutputBuffer * out);
+int unrtf_memory(const char * data, size_t len, bool no_pict_mode_, bool streaming,
+                 unsigned int drop, OutputBuffer * out);
+void unrtf_convert(UnrtfContext * ctx, const char * data, size_t len,
+                   bool no_pict_mode_, bool streaming, unsigned int drop, OutputBuffer * out);
+void unrtf_many(UnrtfJob * jobs, size_t count, int threads, bool no_pict_mode_,
+                bool streaming, unsigned int drop);
+
+/* drop: destinations left out of the output, from unrtf_drop_flag() */
+unsigned int unrtf_drop_flag(const char * name);
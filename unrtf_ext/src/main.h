@@ -37,7 +37,6 @@
  *--------------------------------------------------------------------*/
 
 
-extern int lineno;
 extern int debug_mode;
 extern int simple_mode;
 extern int inline_mode;
@@ -26,11 +26,13 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <atomic>
 
 #include "error.h"
 #include "malloc.h"
 
-static unsigned long count = 0;
+/* Updated from every converting thread */
+static std::atomic<unsigned long> count(0);
 
 /*========================================================================
  * Name:    my_malloc
@@ -16,6 +16,8 @@
 #include <cstdlib>
 #include <errno.h>
 
+#include <mutex>
+
 #include "malloc.h"
 #include "my_iconv.h"
 #include "util.h"
@@ -63,52 +65,100 @@ get_code_str(FILE *f, iconv_t desc)
     return obuf;
 }
 
-my_iconv_t
-my_iconv_open(const char *tocode, const char *fromcode)
+/* Charmap files are compiled once per target encoding and shared by all
+ * descriptors, which only read them; names without a charmap file are
+ * remembered too, so that they are not searched for again. */
+typedef struct _charmap
+{
+    struct _charmap *next;
+    char *fromcode;
+    char *tocode;
+    char **char_table;      /* NULL when there is no usable charmap */
+} Charmap;
+
+static Charmap *charmaps;
+static std::mutex charmaps_lock;
+
+static char **
+compile_charmap(const char *tocode, const char *fromcode)
 {
     FILE *f;
-    my_iconv_t cd = MY_ICONV_T_CLEAR;
+    char **char_table = NULL;
     int c, i;
-    /*      fprintf(stderr, "my_iconv_open: from %s to %s\n", fromcode, tocode);*/
-    if ((cd.desc = iconv_open(tocode, fromcode)) == (iconv_t) - 1)
+
+    char *path = search_in_path(fromcode, "charmap");
+    if (path == NULL)
     {
-        char *path = search_in_path(fromcode, "charmap");
-        if (path == NULL)
-        {
-            return cd;
-        }
-        if ((f = fopen(path, "r")) == NULL && verbose_mode)
+        return NULL;
+    }
+    if ((f = fopen(path, "r")) == NULL && verbose_mode)
+    {
+        fprintf(stderr, "failed to open charmap file %s\n", path);
+    }
+
+    if (f != NULL)
+    {
+        /* Open iconv utf8->tocode conversion */
+        iconv_t desc;
+        if ((desc = iconv_open(tocode, "UTF-8")) == (iconv_t) - 1)
         {
-            fprintf(stderr, "failed to open charmap file %s\n", path);
+            fclose(f);
+            my_free(path);
+            return NULL;
         }
+        char_table = (char **)my_malloc(char_table_size *
+                                        sizeof(char *));
+        memset((void *) char_table, 0, char_table_size * sizeof(char *));
+        c = fgetc(f);
 
-        if (f != NULL)
+        for (i = 0; i < char_table_size && c != EOF; i++)
         {
-            /* Open iconv utf8->tocode conversion */
-            iconv_t desc;
-            if ((desc = iconv_open(tocode, "UTF-8")) == (iconv_t) - 1)
+            if (c == '<')
             {
-                fclose(f);
-                return cd;
+                char_table[i] = get_code_str(f, desc);
             }
-            cd.char_table = (char **)my_malloc(char_table_size *
-                                               sizeof(char *));
+            leave_line(f);//read up to including \n or eof
             c = fgetc(f);
+        }
+        iconv_close(desc);
+        fclose(f);
+    }
 
-            for (i = 0; i < char_table_size && c != EOF; i++)
-            {
-                if (c == '<')
-                {
-                    cd.char_table[i] = get_code_str(f, desc);
-                }
-                leave_line(f);//read up to including \n or eof
-                c = fgetc(f);
-            }
-            iconv_close(desc);
-            fclose(f);
+    my_free(path);
+    return char_table;
+}
+
+static char **
+load_charmap(const char *tocode, const char *fromcode)
+{
+    std::lock_guard<std::mutex> lock(charmaps_lock);
+    Charmap *m;
+
+    for (m = charmaps; m; m = m->next)
+    {
+        if (!strcmp(m->fromcode, fromcode) && !strcmp(m->tocode, tocode))
+        {
+            return m->char_table;
         }
+    }
 
-        my_free(path);
+    m = (Charmap *) my_malloc(sizeof(Charmap));
+    m->fromcode = my_strdup(const_cast<char*>(fromcode));
+    m->tocode = my_strdup(const_cast<char*>(tocode));
+    m->char_table = compile_charmap(tocode, fromcode);
+    m->next = charmaps;
+    charmaps = m;
+    return m->char_table;
+}
+
+my_iconv_t
+my_iconv_open(const char *tocode, const char *fromcode)
+{
+    my_iconv_t cd = MY_ICONV_T_CLEAR;
+    /*      fprintf(stderr, "my_iconv_open: from %s to %s\n", fromcode, tocode);*/
+    if ((cd.desc = iconv_open(tocode, fromcode)) == (iconv_t) - 1)
+    {
+        cd.char_table = load_charmap(tocode, fromcode);
     }
 
     return cd;
@@ -164,24 +214,22 @@ my_iconv(my_iconv_t cd, char **inbuf, size_t *inbytesleft, char **outbuf, size_t
     return result;
 }
 
-my_iconv_t
-my_iconv_close(my_iconv_t cd)
+/* Brings a descriptor back to its initial shift state, as if it had
+   just been opened. Charmap tables have no state. */
+void
+my_iconv_reset(my_iconv_t cd)
 {
-    int i;
-
-    if (cd.char_table != NULL)
+    if (cd.desc != (iconv_t) - 1)
     {
-        for (i = 0; i < char_table_size; i++)
-        {
-            if (cd.char_table[i] != NULL)
-            {
-                my_free(cd.char_table[i]);
-            }
-        }
-
-        my_free(reinterpret_cast<char*>(cd.char_table));
-        cd.char_table = NULL;
+        iconv(cd.desc, NULL, NULL, NULL, NULL);
     }
+}
+
+my_iconv_t
+my_iconv_close(my_iconv_t cd)
+{
+    /* The charmap table is shared, see load_charmap() */
+    cd.char_table = NULL;
 
     if (cd.desc != (iconv_t) - 1)
     {
@@ -45,7 +45,7 @@
 typedef struct
 {
 	iconv_t desc;
-	char **char_table;
+	char **char_table;	/* charmap, shared and read only */
 } my_iconv_t;
 
 #define MY_ICONV_T_CLEAR {(iconv_t) -1, NULL}
@@ -54,6 +54,7 @@ my_iconv_t my_iconv_open(const char *tocode, const char *fromcode);
 
 size_t my_iconv(my_iconv_t cd, char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft);
 
+void my_iconv_reset(my_iconv_t cd);
 my_iconv_t my_iconv_close(my_iconv_t cd);
 
 int my_iconv_is_valid(my_iconv_t cd);
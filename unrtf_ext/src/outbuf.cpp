@@ -0,0 +1,248 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cstdint>
+#include <cerrno>
+
+#include <unistd.h>
+
+#include "error.h"
+#include "outbuf.h"
+
+#define OUTBUF_MIN_SIZE 4096
+
+/*========================================================================
+ * Name:    outbuf_init
+ * Purpose:    Prepares an empty output buffer. Storage is allocated on
+ *             the first write.
+ * Args:    Buffer.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+outbuf_init(OutputBuffer *b)
+{
+    CHECK_PARAM_NOT_NULL(b);
+
+    b->data = NULL;
+    b->len = 0;
+    b->size = 0;
+    b->sink = NULL;
+    b->sink_arg = NULL;
+    b->chunk = 0;
+}
+
+/*========================================================================
+ * Name:    outbuf_init_sink
+ * Purpose:    Prepares an empty output buffer passing its content on to
+ *             a sink every chunk bytes.
+ * Args:    Buffer, sink, its argument, chunk size (at least 1).
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+outbuf_init_sink(OutputBuffer *b, OutputSink sink, void *arg, size_t chunk)
+{
+    outbuf_init(b);
+    b->sink = sink;
+    b->sink_arg = arg;
+    b->chunk = chunk ? chunk : 1;
+}
+
+/* Sink of outbuf_init_fd(), the descriptor is the argument */
+static int
+fd_sink(void *arg, const char *data, size_t len)
+{
+    int fd = (int) (intptr_t) arg;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*========================================================================
+ * Name:    outbuf_init_fd
+ * Purpose:    Prepares an empty output buffer writing to a file
+ *             descriptor in large batches.
+ * Args:    Buffer, descriptor, batch size (0 for OUTBUF_FD_CHUNK).
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+outbuf_init_fd(OutputBuffer *b, int fd, size_t chunk)
+{
+    outbuf_init_sink(b, fd_sink, (void *) (intptr_t) fd, chunk ? chunk : OUTBUF_FD_CHUNK);
+}
+
+/*========================================================================
+ * Name:    outbuf_flush
+ * Purpose:    Hands what the buffer holds to its sink, if it has one.
+ *             A failing sink ends the conversion.
+ * Args:    Buffer.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+outbuf_flush(OutputBuffer *b)
+{
+    CHECK_PARAM_NOT_NULL(b);
+
+    if (b->sink == NULL || b->len == 0)
+    {
+        return;
+    }
+    int failed = b->sink(b->sink_arg, b->data, b->len);
+    b->len = 0;
+    b->data[0] = 0;
+    if (failed)
+    {
+        error_handler("cannot deliver output");
+    }
+}
+
+/*========================================================================
+ * Name:    outbuf_free
+ * Purpose:    Releases the storage of an output buffer.
+ * Args:    Buffer.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+outbuf_free(OutputBuffer *b)
+{
+    CHECK_PARAM_NOT_NULL(b);
+
+    free(b->data);
+    outbuf_init(b);
+}
+
+/*========================================================================
+ * Name:    outbuf_reserve
+ * Purpose:    Makes sure at least n more bytes (plus a terminating 0)
+ *             fit in the buffer, doubling its size as needed.
+ * Args:    Buffer, byte count.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+outbuf_reserve(OutputBuffer *b, size_t n)
+{
+    size_t need = b->len + n + 1;
+    size_t size;
+    char *data;
+
+    if (need <= b->size)
+    {
+        return;
+    }
+
+    size = b->size ? b->size : OUTBUF_MIN_SIZE;
+    while (size < need)
+    {
+        size *= 2;
+    }
+
+    data = static_cast<char*>(realloc(b->data, size));
+    if (data == NULL)
+    {
+        error_handler("out of memory in output buffer");
+    }
+    b->data = data;
+    b->size = size;
+}
+
+/*========================================================================
+ * Name:    outbuf_write
+ * Purpose:    Appends bytes to an output buffer. The content is kept 0
+ *             terminated.
+ * Args:    Buffer, bytes, byte count.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+outbuf_write(OutputBuffer *b, const char *s, size_t n)
+{
+    CHECK_PARAM_NOT_NULL(b);
+
+    outbuf_reserve(b, n);
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = 0;
+    if (b->sink && b->len >= b->chunk)
+    {
+        outbuf_flush(b);
+    }
+}
+
+/*========================================================================
+ * Name:    outbuf_puts, outbuf_putc
+ * Purpose:    Appends a string or a single character to an output buffer.
+ * Args:    Buffer, string or character.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+outbuf_puts(OutputBuffer *b, const char *s)
+{
+    outbuf_write(b, s, strlen(s));
+}
+
+void
+outbuf_putc(OutputBuffer *b, int ch)
+{
+    char c = ch;
+    outbuf_write(b, &c, 1);
+}
+
+/*========================================================================
+ * Name:    outbuf_printf
+ * Purpose:    Formatted output to an output buffer. The text is formatted
+ *             directly into the buffer tail.
+ * Args:    Buffer, format, arguments.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+outbuf_printf(OutputBuffer *b, const char *fmt, ...)
+{
+    va_list arguments;
+    int n;
+
+    CHECK_PARAM_NOT_NULL(b);
+
+    outbuf_reserve(b, 64);
+    va_start(arguments, fmt);
+    n = vsnprintf(b->data + b->len, b->size - b->len, fmt, arguments);
+    va_end(arguments);
+    if (n < 0)
+    {
+        b->data[b->len] = 0;
+        return;
+    }
+
+    if ((size_t) n >= b->size - b->len)
+    {
+        outbuf_reserve(b, n);
+        va_start(arguments, fmt);
+        vsnprintf(b->data + b->len, b->size - b->len, fmt, arguments);
+        va_end(arguments);
+    }
+    b->len += n;
+    if (b->sink && b->len >= b->chunk)
+    {
+        outbuf_flush(b);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Where the output goes once a buffer holds a chunk of it: gets the
+ * bytes, returns 0 on success */
+typedef int (*OutputSink)(void *arg, const char *data, size_t len);
+
+/* Growable in-memory buffer receiving everything the renderer writes.
+ * Without a sink the whole document is kept in memory; with one, the
+ * buffer is handed to the sink whenever it holds chunk bytes, and by
+ * outbuf_flush() at the end. */
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t size;
+    OutputSink sink;        /* NULL: keep everything */
+    void *sink_arg;
+    size_t chunk;
+} OutputBuffer;
+
+#define OUTPUT_BUFFER_CLEAR {NULL, 0, 0, NULL, NULL, 0}
+
+/* Chunk size of outbuf_init_fd() when none is given */
+#define OUTBUF_FD_CHUNK (256 * 1024)
+
+extern void outbuf_init(OutputBuffer *);
+extern void outbuf_init_sink(OutputBuffer *, OutputSink, void *arg, size_t chunk);
+extern void outbuf_init_fd(OutputBuffer *, int fd, size_t chunk);
+extern void outbuf_flush(OutputBuffer *);
+extern void outbuf_free(OutputBuffer *);
+extern void outbuf_write(OutputBuffer *, const char *, size_t);
+extern void outbuf_puts(OutputBuffer *, const char *);
+extern void outbuf_putc(OutputBuffer *, int);
+extern void outbuf_printf(OutputBuffer *, const char *, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
@@ -23,10 +23,13 @@
 #include <config.h>
 #endif
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <mutex>
+
 #include <arpa/inet.h>
 
 #include "malloc.h"
@@ -37,6 +40,99 @@
 #include "convert.h"
 #include "attr.h"
 #include "util.h"
+#include "unicode.h"
+#include "user.h"
+#include "context.h"
+
+/* Aliases of the code points below ALIAS_DENSE (which covers the
+ * punctuation, arrows and mathematical symbols of the shipped
+ * personalities) are looked up directly; the few others are kept in a
+ * small open addressing table. */
+#define ALIAS_DENSE 0x2400
+
+typedef struct
+{
+    int nr;
+    char *text;             /* NULL in empty slots */
+} AliasSlot;
+
+struct _alias_table
+{
+    char *dense[ALIAS_DENSE];
+    AliasSlot *sparse;
+    unsigned long sparse_mask;
+};
+
+static inline unsigned long
+alias_hash(int nr)
+{
+    return (unsigned int) nr * 2654435761u;
+}
+
+/* The compiled strings of a personality, by address */
+struct _template_table
+{
+    Template *slot;         /* source is NULL in empty slots */
+    unsigned long mask;
+};
+
+static inline unsigned long
+template_hash(const char *string)
+{
+    return (unsigned long) ((uintptr_t) string >> 3) * 2654435761u;
+}
+
+/* The character tables of all personalities are built by whichever
+ * conversion needs them first */
+static std::mutex char_tables_lock;
+
+/*========================================================================
+ * Name:    free_alias_table
+ * Purpose:    Drops the compiled aliases of a personality; its alias
+ *        collection is kept.
+ * Args:    OutputPersonality.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+free_alias_table(OutputPersonality *op)
+{
+    if (op->alias_table)
+    {
+        my_free((char *) op->alias_table->sparse);
+        my_free((char *) op->alias_table);
+        op->alias_table = NULL;
+    }
+}
+
+/*========================================================================
+ * Name:    free_templates
+ * Purpose:    Drops the compiled strings of a personality.
+ * Args:    OutputPersonality.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+free_templates(OutputPersonality *op)
+{
+    TemplateTable *t = op->templates;
+    unsigned long i;
+
+    if (t)
+    {
+        for (i = 0; i <= t->mask; i++)
+        {
+            if (t->slot[i].source)
+            {
+                my_free(t->slot[i].text);
+                my_free((char *) t->slot[i].slot_at);
+            }
+        }
+        my_free((char *) t->slot);
+        my_free((char *) t);
+        op->templates = NULL;
+    }
+}
 
 /*========================================================================
  * Name:    op_create
@@ -73,35 +169,38 @@ op_free(OutputPersonality *op)
 {
     CHECK_PARAM_NOT_NULL(op);
 
+    free_alias_table(op);
+    free_templates(op);
+    while (op->char_tables)
+    {
+        CharTable *t = op->char_tables;
+        op->char_tables = t->next;
+        for (int ch = 0; ch < 256; ch++)
+        {
+            if (t->text[ch])
+            {
+                my_free(t->text[ch]);
+            }
+        }
+        my_free(t->encoding);
+        my_free((char *) t);
+    }
     my_free(reinterpret_cast<char*>(op));
 }
 
 
 /*========================================================================
- * Name:    op_translate_char
+ * Name:    translate_byte
  * Purpose:    Native encoding value->Unicode number as int
  *    Then transform as specified by op (ie, entity, &#xxx;...)
- *    Currently this is only called with values < 255 (single byte chars or
- *    computation of Symbol code point in fields).
- *    We cache a local iconv descriptor for efficiency.
- * Args:    OutputPersonality, encoding, character.
- * Returns:    malloced string to be freed by caller.
+ * Args:    OutputPersonality, iconv descriptor to UTF-32BE, character.
+ * Returns:    malloced string, or NULL when the byte does not convert.
  *=======================================================================*/
-const char *
-op_translate_char(OutputPersonality *op, char *encoding, int ch)
+static char *
+translate_byte(OutputPersonality *op, my_iconv_t desc, int ch)
 {
-    static my_iconv_t m_desc = MY_ICONV_T_CLEAR;
-    static char *m_encoding = NULL;
     char *result = NULL;
 
-    CHECK_PARAM_NOT_NULL(op);
-
-    if (ch < 0 || ch > 255)
-    {
-        fprintf(stderr, "op_translate_char called with bad char 0x%x\n",
-                ch);
-        return NULL;
-    }
     if (no_remap_mode == TRUE && ch < 256)
     {
         /* Kept for historical reason, makes no sense in a multi-encoding
@@ -115,24 +214,6 @@ op_translate_char(OutputPersonality *op, char *encoding, int ch)
     }
     else
     {
-        if (!m_encoding || strcasecmp(encoding, m_encoding))
-        {
-            // Using UTF-32BE to avoid BOM
-            if (my_iconv_is_valid(m_desc))
-            {
-                my_iconv_close(m_desc);
-            }
-            m_desc = my_iconv_open("UTF-32BE", encoding);
-            if (!my_iconv_is_valid(m_desc))
-            {
-                return NULL;
-            }
-            if (m_encoding)
-            {
-                my_free(m_encoding);
-            }
-            m_encoding = my_strdup(encoding);
-        }
         size_t inbytes = 1, outbytes = 4;
         char inbuf[1];
         uint32_t outbuf;
@@ -140,7 +221,11 @@ op_translate_char(OutputPersonality *op, char *encoding, int ch)
         int unicode;
         inbuf[0] = ch;
 
-        if (my_iconv(m_desc, &icp, &inbytes, &ocp, &outbytes) == -1)
+        if (!my_iconv_is_valid(desc))
+        {
+            return NULL;
+        }
+        if (my_iconv(desc, &icp, &inbytes, &ocp, &outbytes) == -1)
         {
             /*            fprintf(stderr, "unrtf: iconv error %s->UTF-32BE for 0x%x\n",
                       encoding, ch);*/
@@ -157,10 +242,18 @@ op_translate_char(OutputPersonality *op, char *encoding, int ch)
         /* Output Unicode value as decided by output personality */
         result = get_alias(op, unicode); /* Try for ie, entity */
         if (result)
-            result = strdup(result);
+            result = my_strdup(result);
         if (result == NULL)
         {
-            if (ch > 127 && op->unisymbol_print)
+            if (ch > 127 && op->utf8_output)
+            {
+                result = my_malloc(5);
+                if (result)
+                {
+                    result[unicode_to_utf8_buf(unicode, result)] = 0;
+                }
+            }
+            else if (ch > 127 && op->unisymbol_print)
             {
                 result = assemble_string(op->unisymbol_print, unicode);
             }
@@ -180,13 +273,96 @@ op_translate_char(OutputPersonality *op, char *encoding, int ch)
     return result;
 }
 
+/*========================================================================
+ * Name:    op_char_table
+ * Purpose:    Gives the translation of every byte of an encoding, built
+ *        on first use with a single iconv descriptor and kept with the
+ *        personality, so that conversions print plain text without
+ *        calling iconv or allocating.
+ * Args:    OutputPersonality, encoding.
+ * Returns:    Translation table, valid as long as the personality.
+ *=======================================================================*/
+const CharTable *
+op_char_table(OutputPersonality *op, const char *encoding)
+{
+    std::lock_guard<std::mutex> lock(char_tables_lock);
+    CharTable *t;
+    my_iconv_t desc = MY_ICONV_T_CLEAR;
+    int ch;
+
+    CHECK_PARAM_NOT_NULL(op);
+
+    for (t = op->char_tables; t; t = t->next)
+    {
+        if (!strcasecmp(encoding, t->encoding))
+        {
+            return t;
+        }
+    }
+
+    t = (CharTable *) my_malloc(sizeof(CharTable));
+    if (!t)
+    {
+        error_handler("cannot allocate character table");
+    }
+    memset((void *) t, 0, sizeof(CharTable));
+    t->encoding = my_strdup(const_cast<char*>(encoding));
+
+    if (no_remap_mode != TRUE)
+    {
+        // Using UTF-32BE to avoid BOM
+        desc = my_iconv_open("UTF-32BE", encoding);
+    }
+    for (ch = 0; ch < 256; ch++)
+    {
+        t->text[ch] = translate_byte(op, desc, ch);
+        if (t->text[ch])
+        {
+            t->len[ch] = strlen(t->text[ch]);
+            t->plain[ch] = ch >= 0x20 && ch < 0x80 && t->len[ch] == 1 && t->text[ch][0] == ch;
+        }
+    }
+    desc = my_iconv_close(desc);
+
+    t->next = op->char_tables;
+    op->char_tables = t;
+    return t;
+}
+
+/*========================================================================
+ * Name:    op_translate_char
+ * Purpose:    Native encoding value->Unicode number as int
+ *    Then transform as specified by op (ie, entity, &#xxx;...)
+ *    Currently this is only called with values < 255 (single byte chars or
+ *    computation of Symbol code point in fields).
+ *    The result comes from the table of op_char_table().
+ * Args:    OutputPersonality, encoding, character.
+ * Returns:    malloced string to be freed by caller.
+ *=======================================================================*/
+const char *
+op_translate_char(OutputPersonality *op, char *encoding, int ch)
+{
+    const CharTable *t;
+
+    CHECK_PARAM_NOT_NULL(op);
+
+    if (ch < 0 || ch > 255)
+    {
+        fprintf(stderr, "op_translate_char called with bad char 0x%x\n",
+                ch);
+        return NULL;
+    }
+    t = op_char_table(op, encoding);
+    return t->text[ch] ? my_strdup(t->text[ch]) : NULL;
+}
+
 /*========================================================================
  * Name:    op_translate_buffer
  * Purpose:    Translate buffer built out of \' commands in convert.c
  *   The data comes in as UTF-32BE, which we change to unicode positions
  *   (just the byte order), then transform according to outputpersonality
- *   TOBEDONE: have a way to specify direct UTF-8 output for a personality
- *    (then produce utf-8 in convert.c and do nothing special here.
+ *   Personalities with utf8_output get UTF-8 from convert.c instead,
+ *    see op_print_utf8().
  *
  * Args:    OutputPersonality, encoding, character.
  * Returns:    malloced string.
@@ -256,16 +432,58 @@ op_translate_buffer(OutputPersonality *op, char *buffer, int bytescnt)
     return out;
 }
 
+/*========================================================================
+ * Name:    op_print_utf8
+ * Purpose:    Prints text converted to UTF-8 by convert.c, for
+ *        personalities with utf8_output: characters without an alias
+ *        are copied as they are, in runs. Output stops at a null
+ *        character, as it does with op_translate_buffer().
+ * Args:    OutputPersonality, output buffer, UTF-8 text, its length.
+ * Returns:    None.
+ *=======================================================================*/
+void
+op_print_utf8(OutputPersonality *op, OutputBuffer *out, const char *buffer, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) buffer;
+    const unsigned char *end = p + len;
+    const unsigned char *run = p;
+
+    while (p < end && *p)
+    {
+        const unsigned char *next = p + 1;
+        int unicode = *p;
+        const char *alias;
+
+        if (unicode >= 0xC0)
+        {
+            int more = unicode >= 0xF0 ? 3 : unicode >= 0xE0 ? 2 : 1;
+            unicode &= 0x3F >> more;
+            while (more-- && next < end)
+            {
+                unicode = (unicode << 6) | (*next++ & 0x3F);
+            }
+        }
+        if ((alias = get_alias(op, unicode)) != NULL)
+        {
+            outbuf_write(out, (const char *) run, p - run);
+            outbuf_puts(out, alias);
+            run = next;
+        }
+        p = next;
+    }
+    outbuf_write(out, (const char *) run, p - run);
+}
+
 /*========================================================================
  * Name:    op_begin_std_fontsize
  * Purpose:    Prints whatever is necessary to perform a change in the
  *        current font size.
- * Args:    OutputPersonality, desired size.
+ * Args:    Conversion context, OutputPersonality, desired size.
  * Returns:    None.
  *=======================================================================*/
 
 void
-op_begin_std_fontsize(OutputPersonality *op, int size)
+op_begin_std_fontsize(UnrtfContext *ctx, OutputPersonality *op, int size)
 {
     int found_std_expr = FALSE;
 
@@ -278,7 +496,7 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
     case 8:
         if (op->fontsize8_begin)
         {
-            if (safe_printf(0, op->fontsize8_begin))
+            if (safe_printf(ctx, 0, op->fontsize8_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize8_begin");
             }
@@ -288,7 +506,7 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
     case 10:
         if (op->fontsize10_begin)
         {
-            if (safe_printf(0, op->fontsize10_begin))
+            if (safe_printf(ctx, 0, op->fontsize10_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize10_begin");
             }
@@ -298,7 +516,7 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
     case 12:
         if (op->fontsize12_begin)
         {
-            if (safe_printf(0, op->fontsize12_begin))
+            if (safe_printf(ctx, 0, op->fontsize12_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize12_begin");
             }
@@ -308,7 +526,7 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
     case 14:
         if (op->fontsize14_begin)
         {
-            if (safe_printf(0, op->fontsize14_begin))
+            if (safe_printf(ctx, 0, op->fontsize14_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize14_begin");
             }
@@ -318,7 +536,7 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
     case 18:
         if (op->fontsize18_begin)
         {
-            if (safe_printf(0, op->fontsize18_begin))
+            if (safe_printf(ctx, 0, op->fontsize18_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize18_begin");
             }
@@ -328,7 +546,7 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
     case 24:
         if (op->fontsize24_begin)
         {
-            if (safe_printf(0, op->fontsize24_begin))
+            if (safe_printf(ctx, 0, op->fontsize24_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize24_begin");
             }
@@ -338,7 +556,7 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
     case 36:
         if (op->fontsize36_begin)
         {
-            if (safe_printf(0, op->fontsize36_begin))
+            if (safe_printf(ctx, 0, op->fontsize36_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize36_begin");
             }
@@ -348,7 +566,7 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
     case 48:
         if (op->fontsize48_begin)
         {
-            if (safe_printf(0, op->fontsize48_begin))
+            if (safe_printf(ctx, 0, op->fontsize48_begin))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize48_begin");
             }
@@ -366,7 +584,7 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
         {
             char expr[16];
             sprintf(expr, "%d", size);
-            if (safe_printf(1, op->fontsize_begin, expr))
+            if (safe_printf(ctx, 1, op->fontsize_begin, expr))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize_begin");
             }
@@ -379,56 +597,56 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
              */
             if (size < 9 && op->fontsize8_begin)
             {
-                if (safe_printf(0, op->fontsize8_begin))
+                if (safe_printf(ctx, 0, op->fontsize8_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize8_begin");
                 }
             }
             else if (size < 11 && op->fontsize10_begin)
             {
-                if (safe_printf(0, op->fontsize10_begin))
+                if (safe_printf(ctx, 0, op->fontsize10_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize10_begin");
                 }
             }
             else if (size < 13 && op->fontsize12_begin)
             {
-                if (safe_printf(0, op->fontsize12_begin))
+                if (safe_printf(ctx, 0, op->fontsize12_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize12_begin");
                 }
             }
             else if (size < 16 && op->fontsize14_begin)
             {
-                if (safe_printf(0, op->fontsize14_begin))
+                if (safe_printf(ctx, 0, op->fontsize14_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize14_begin");
                 }
             }
             else if (size < 21 && op->fontsize18_begin)
             {
-                if (safe_printf(0, op->fontsize18_begin))
+                if (safe_printf(ctx, 0, op->fontsize18_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize18_begin");
                 }
             }
             else if (size < 30 && op->fontsize24_begin)
             {
-                if (safe_printf(0, op->fontsize24_begin))
+                if (safe_printf(ctx, 0, op->fontsize24_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize24_begin");
                 }
             }
             else if (size < 42 && op->fontsize36_begin)
             {
-                if (safe_printf(0, op->fontsize36_begin))
+                if (safe_printf(ctx, 0, op->fontsize36_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize36_begin");
                 }
             }
             else if (size > 40 && op->fontsize48_begin)
             {
-                if (safe_printf(0, op->fontsize48_begin))
+                if (safe_printf(ctx, 0, op->fontsize48_begin))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize48_begin");
                 }
@@ -440,35 +658,35 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
                  */
                 if (op->fontsize12_begin)
                 {
-                    if (safe_printf(0, op->fontsize12_begin))
+                    if (safe_printf(ctx, 0, op->fontsize12_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize12_begin");
                     }
                 }
                 else if (op->fontsize14_begin)
                 {
-                    if (safe_printf(0, op->fontsize14_begin))
+                    if (safe_printf(ctx, 0, op->fontsize14_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize14_begin");
                     }
                 }
                 else if (op->fontsize10_begin)
                 {
-                    if (safe_printf(0, op->fontsize10_begin))
+                    if (safe_printf(ctx, 0, op->fontsize10_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize10_begin");
                     }
                 }
                 else if (op->fontsize18_begin)
                 {
-                    if (safe_printf(0, op->fontsize18_begin))
+                    if (safe_printf(ctx, 0, op->fontsize18_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize18_begin");
                     }
                 }
                 else if (op->fontsize8_begin)
                 {
-                    if (safe_printf(0, op->fontsize8_begin))
+                    if (safe_printf(ctx, 0, op->fontsize8_begin))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize8_begin");
                     }
@@ -487,12 +705,12 @@ op_begin_std_fontsize(OutputPersonality *op, int size)
  * Name:    op_end_std_fontsize
  * Purpose:    Prints whatever is necessary to perform a change in the
  *        current font size.
- * Args:    OutputPersonality, desired size.
+ * Args:    Conversion context, OutputPersonality, desired size.
  * Returns:    None.
  *=======================================================================*/
 
 void
-op_end_std_fontsize(OutputPersonality *op, int size)
+op_end_std_fontsize(UnrtfContext *ctx, OutputPersonality *op, int size)
 {
     int found_std_expr = FALSE;
 
@@ -505,7 +723,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
     case 8:
         if (op->fontsize8_end)
         {
-            if (safe_printf(0, op->fontsize8_end))
+            if (safe_printf(ctx, 0, op->fontsize8_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize8_end");
             }
@@ -515,7 +733,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
     case 10:
         if (op->fontsize10_end)
         {
-            if (safe_printf(0, op->fontsize10_end))
+            if (safe_printf(ctx, 0, op->fontsize10_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize10_end");
             }
@@ -525,7 +743,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
     case 12:
         if (op->fontsize12_end)
         {
-            if (safe_printf(0, op->fontsize12_end))
+            if (safe_printf(ctx, 0, op->fontsize12_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize12_end");
             }
@@ -535,7 +753,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
     case 14:
         if (op->fontsize14_end)
         {
-            if (safe_printf(0, op->fontsize14_end))
+            if (safe_printf(ctx, 0, op->fontsize14_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize14_end");
             }
@@ -545,7 +763,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
     case 18:
         if (op->fontsize18_end)
         {
-            if (safe_printf(0, op->fontsize18_end))
+            if (safe_printf(ctx, 0, op->fontsize18_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize18_end");
             }
@@ -555,7 +773,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
     case 24:
         if (op->fontsize24_end)
         {
-            if (safe_printf(0, op->fontsize24_end))
+            if (safe_printf(ctx, 0, op->fontsize24_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize24_end");
             }
@@ -565,7 +783,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
     case 36:
         if (op->fontsize36_end)
         {
-            if (safe_printf(0, op->fontsize36_end))
+            if (safe_printf(ctx, 0, op->fontsize36_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize36_end");
             }
@@ -575,7 +793,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
     case 48:
         if (op->fontsize48_end)
         {
-            if (safe_printf(0, op->fontsize48_end))
+            if (safe_printf(ctx, 0, op->fontsize48_end))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize48_end");
             }
@@ -593,7 +811,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
         {
             char expr[16];
             sprintf(expr, "%d", size);
-            if (safe_printf(1, op->fontsize_end, expr))
+            if (safe_printf(ctx, 1, op->fontsize_end, expr))
             {
                 fprintf(stderr, TOO_MANY_ARGS, "fontsize_end");
             }
@@ -606,56 +824,56 @@ op_end_std_fontsize(OutputPersonality *op, int size)
              */
             if (size < 9 && op->fontsize8_end)
             {
-                if (safe_printf(0, op->fontsize8_end))
+                if (safe_printf(ctx, 0, op->fontsize8_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize8_end");
                 }
             }
             else if (size < 11 && op->fontsize10_end)
             {
-                if (safe_printf(0, op->fontsize10_end))
+                if (safe_printf(ctx, 0, op->fontsize10_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize10_end");
                 }
             }
             else if (size < 13 && op->fontsize12_end)
             {
-                if (safe_printf(0, op->fontsize12_end))
+                if (safe_printf(ctx, 0, op->fontsize12_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize12_end");
                 }
             }
             else if (size < 16 && op->fontsize14_end)
             {
-                if (safe_printf(0, op->fontsize14_end))
+                if (safe_printf(ctx, 0, op->fontsize14_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize14_end");
                 }
             }
             else if (size < 21 && op->fontsize18_end)
             {
-                if (safe_printf(0, op->fontsize18_end))
+                if (safe_printf(ctx, 0, op->fontsize18_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize18_end");
                 }
             }
             else if (size < 30 && op->fontsize24_end)
             {
-                if (safe_printf(0, op->fontsize24_end))
+                if (safe_printf(ctx, 0, op->fontsize24_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize24_end");
                 }
             }
             else if (size < 42 && op->fontsize36_end)
             {
-                if (safe_printf(0, op->fontsize36_end))
+                if (safe_printf(ctx, 0, op->fontsize36_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize36_end");
                 }
             }
             else if (size > 40 && op->fontsize48_end)
             {
-                if (safe_printf(0, op->fontsize48_end))
+                if (safe_printf(ctx, 0, op->fontsize48_end))
                 {
                     fprintf(stderr, TOO_MANY_ARGS, "fontsize48_end");
                 }
@@ -667,35 +885,35 @@ op_end_std_fontsize(OutputPersonality *op, int size)
                  */
                 if (op->fontsize12_end)
                 {
-                    if (safe_printf(0, op->fontsize12_end))
+                    if (safe_printf(ctx, 0, op->fontsize12_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize12_end");
                     }
                 }
                 else if (op->fontsize14_end)
                 {
-                    if (safe_printf(0, op->fontsize14_end))
+                    if (safe_printf(ctx, 0, op->fontsize14_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize14_end");
                     }
                 }
                 else if (op->fontsize10_end)
                 {
-                    if (safe_printf(0, op->fontsize10_end))
+                    if (safe_printf(ctx, 0, op->fontsize10_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize10_end");
                     }
                 }
                 else if (op->fontsize18_end)
                 {
-                    if (safe_printf(0, op->fontsize18_end))
+                    if (safe_printf(ctx, 0, op->fontsize18_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize18_end");
                     }
                 }
                 else if (op->fontsize8_end)
                 {
-                    if (safe_printf(0, op->fontsize8_end))
+                    if (safe_printf(ctx, 0, op->fontsize8_end))
                     {
                         fprintf(stderr, TOO_MANY_ARGS, "fontsize8_end");
                     }
@@ -712,7 +930,8 @@ op_end_std_fontsize(OutputPersonality *op, int size)
 #if 1 /* AK3 - AF */
 /*========================================================================
  * Name:    add_alias
- * Purpose:    Adds alias (text) for a char number nr.
+ * Purpose:    Adds alias (text) for a char number nr. A compiled alias
+ *        table is dropped, until op_compile_aliases() is called again.
  * Args:    OutputPersonality, char's number, alias.
  * Returns:    None.
  *=======================================================================*/
@@ -720,6 +939,7 @@ op_end_std_fontsize(OutputPersonality *op, int size)
 void
 add_alias(OutputPersonality *op, int nr, char *text)
 {
+    free_alias_table(op);
     op->aliases = (Aliases *)add_to_collection((Collection *)op->aliases, nr, text);
 }
 
@@ -733,7 +953,223 @@ add_alias(OutputPersonality *op, int nr, char *text)
 char *
 get_alias(OutputPersonality *op, int nr)
 {
-    return const_cast<char*>(get_from_collection((Collection *)op->aliases, nr)); // XXX(szborows) this can really be dangerous...
+    AliasTable *t = op->alias_table;
+    unsigned long i;
+
+    if (t == NULL)
+    {
+        return const_cast<char*>(get_from_collection((Collection *)op->aliases, nr)); // XXX(szborows) this can really be dangerous...
+    }
+    if (nr >= 0 && nr < ALIAS_DENSE)
+    {
+        return t->dense[nr];
+    }
+    for (i = alias_hash(nr) & t->sparse_mask; t->sparse[i].text; i = (i + 1) & t->sparse_mask)
+    {
+        if (t->sparse[i].nr == nr)
+        {
+            return t->sparse[i].text;
+        }
+    }
+    return NULL;
+}
+
+/*========================================================================
+ * Name:    op_compile_aliases
+ * Purpose:    Builds the lookup table of the aliases defined so far.
+ *        The personality must not be in use by a conversion.
+ * Args:    OutputPersonality.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+op_compile_aliases(OutputPersonality *op)
+{
+    AliasTable *t;
+    Collection *c;
+    unsigned long size = 16;
+    unsigned long sparse = 0;
+    unsigned long i;
+
+    free_alias_table(op);
+
+    t = (AliasTable *) my_malloc(sizeof(AliasTable));
+    if (!t)
+    {
+        error_handler("cannot allocate alias table");
+    }
+    memset((void *) t, 0, sizeof(AliasTable));
+
+    for (c = (Collection *)op->aliases; c; c = c->next)
+    {
+        if (c->nr < 0 || c->nr >= ALIAS_DENSE)
+        {
+            sparse++;
+        }
+    }
+    while (size < 2 * sparse)
+    {
+        size *= 2;
+    }
+    t->sparse = (AliasSlot *) my_malloc(size * sizeof(AliasSlot));
+    if (!t->sparse)
+    {
+        my_free((char *) t);
+        error_handler("cannot allocate alias table");
+    }
+    memset((void *) t->sparse, 0, size * sizeof(AliasSlot));
+    t->sparse_mask = size - 1;
+
+    /* add_to_collection() keeps one entry per number, holding its last
+       definition */
+    for (c = (Collection *)op->aliases; c; c = c->next)
+    {
+        if (c->nr >= 0 && c->nr < ALIAS_DENSE)
+        {
+            t->dense[c->nr] = const_cast<char*>(c->text);
+            continue;
+        }
+        for (i = alias_hash(c->nr) & t->sparse_mask; t->sparse[i].text; i = (i + 1) & t->sparse_mask)
+            ;
+        t->sparse[i].nr = c->nr;
+        t->sparse[i].text = const_cast<char*>(c->text);
+    }
+
+    op->alias_table = t;
 }
 #endif
 
+/*========================================================================
+ * Name:    compile_template
+ * Purpose:    Splits a personality string at its parameters, the way
+ *        safe_printf() reads it: a % not preceded by a backslash is a
+ *        parameter, a backslash followed by % is dropped.
+ * Args:    String, template to fill.
+ * Returns:    None.
+ *=======================================================================*/
+
+static void
+compile_template(const char *string, Template *t)
+{
+    size_t i, n = strlen(string);
+
+    t->source = string;
+    t->text = my_malloc(n + 1);
+    t->slot_at = (size_t *) my_malloc((n + 1) * sizeof(size_t));
+    if (!t->text || !t->slot_at)
+    {
+        error_handler("cannot allocate output template");
+    }
+    t->len = 0;
+    t->slots = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (string[i] == '%' && (i == 0 || string[i - 1] != '\\'))
+        {
+            t->slot_at[t->slots++] = t->len;
+        }
+        else if (string[i] != '\\' || string[i + 1] != '%')
+        {
+            t->text[t->len++] = string[i];
+        }
+    }
+    t->text[t->len] = 0;
+}
+
+/*========================================================================
+ * Name:    op_compile_templates
+ * Purpose:    Compiles every string of a personality for safe_printf(),
+ *        so that printing it does not scan it again. The personality
+ *        must not be in use by a conversion.
+ * Args:    OutputPersonality.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+op_compile_templates(OutputPersonality *op)
+{
+    struct definition
+    {
+        char *name;
+        char **variable;
+    } defs[] = DEFS_ARRAY(op);
+    TemplateTable *t;
+    unsigned long size = 16;
+    unsigned long count = 0;
+    unsigned long i;
+    int d;
+
+    free_templates(op);
+
+    for (d = 0; defs[d].name; d++)
+    {
+        count++;
+    }
+    while (size < 2 * count)
+    {
+        size *= 2;
+    }
+
+    t = (TemplateTable *) my_malloc(sizeof(TemplateTable));
+    if (!t)
+    {
+        error_handler("cannot allocate template table");
+    }
+    t->slot = (Template *) my_malloc(size * sizeof(Template));
+    if (!t->slot)
+    {
+        my_free((char *) t);
+        error_handler("cannot allocate template table");
+    }
+    memset((void *) t->slot, 0, size * sizeof(Template));
+    t->mask = size - 1;
+    op->templates = t;
+
+    for (d = 0; defs[d].name; d++)
+    {
+        const char *string = *defs[d].variable;
+        if (!string)
+        {
+            continue;
+        }
+        for (i = template_hash(string) & t->mask; t->slot[i].source; i = (i + 1) & t->mask)
+        {
+            if (t->slot[i].source == string)
+            {
+                break;
+            }
+        }
+        if (!t->slot[i].source)
+        {
+            compile_template(string, &t->slot[i]);
+        }
+    }
+}
+
+/*========================================================================
+ * Name:    op_find_template
+ * Purpose:    Finds the compiled form of a personality string.
+ * Args:    OutputPersonality, string (compared by address).
+ * Returns:    Template, or NULL if the string was not compiled.
+ *=======================================================================*/
+
+const Template *
+op_find_template(OutputPersonality *op, const char *string)
+{
+    TemplateTable *t = op->templates;
+    unsigned long i;
+
+    if (!t)
+    {
+        return NULL;
+    }
+    for (i = template_hash(string) & t->mask; t->slot[i].source; i = (i + 1) & t->mask)
+    {
+        if (t->slot[i].source == string)
+        {
+            return &t->slot[i];
+        }
+    }
+    return NULL;
+}
+
@@ -38,10 +38,38 @@
  *--------------------------------------------------------------------*/
 
 #include "attr.h"
+#include "outbuf.h"
 #include "my_iconv.h"
 
 typedef Collection Aliases;
 
+/* Aliases compiled for lookup, see op_compile_aliases() */
+typedef struct _alias_table AliasTable;
+
+/* A personality string split at its % parameters, see
+ * op_compile_templates() */
+typedef struct
+{
+	const char *source;	/* the personality string */
+	char *text;		/* literal text, \% escapes removed */
+	size_t len;
+	int slots;		/* number of parameters */
+	size_t *slot_at;	/* offset in text of each parameter */
+} Template;
+
+typedef struct _template_table TemplateTable;
+
+/* What op_translate_char() gives for every byte of one encoding, see
+ * op_char_table() */
+typedef struct _char_table
+{
+	struct _char_table *next;
+	char *encoding;
+	char *text[256];	/* NULL when the byte has no translation */
+	unsigned int len[256];
+	unsigned char plain[256];	/* 1 for printable ASCII output as is */
+} CharTable;
+
 typedef struct
 {
 	char *comment_begin;
@@ -244,7 +272,12 @@ typedef struct
 	int simulate_word_underline : 1;
 	char *unisymbol_print;
 	char *utf8_encoding;
+	char *utf8_output;	/* defined when the output is UTF-8: characters
+				   without an alias are written as they are */
 	Aliases *aliases;
+	AliasTable *alias_table;
+	CharTable *char_tables;
+	TemplateTable *templates;
 }
 OutputPersonality;
 
@@ -252,14 +285,20 @@ OutputPersonality;
 extern OutputPersonality *op_create(void);
 extern void op_free(OutputPersonality *);
 extern const char *op_translate_char(OutputPersonality *op, char *encoding, int ch);
+extern const CharTable *op_char_table(OutputPersonality *op, const char *encoding);
 extern char *op_translate_buffer(OutputPersonality *op, char *buffer,
                                  int bytescnt);
+extern void op_print_utf8(OutputPersonality *op, OutputBuffer *out,
+                          const char *buffer, size_t len);
 
-extern void op_begin_std_fontsize(OutputPersonality *, int);
-extern void op_end_std_fontsize(OutputPersonality *, int);
+extern void op_begin_std_fontsize(UnrtfContext *, OutputPersonality *, int);
+extern void op_end_std_fontsize(UnrtfContext *, OutputPersonality *, int);
 
 void add_alias(OutputPersonality *op, int nr, char *text);
 char *get_alias(OutputPersonality *op, int nr);
+void op_compile_aliases(OutputPersonality *op);
+void op_compile_templates(OutputPersonality *op);
+const Template *op_find_template(OutputPersonality *op, const char *string);
 
 
 #endif /* _OUTPUT_H_INCLUDED_ */
@@ -35,473 +35,829 @@
 #include "error.h"
 #include "word.h"
 #include "hash.h"
+#include "context.h"
+#include "scan.h"
+#include "keywords.h"
+#include "util.h"
+#include "unicode.h"
 
 
+/* The tokenizer works on the whole input held in memory (a mapped file
+ * or a Python buffer), between ctx->in_cur and ctx->in_end. Runs of
+ * plain text are found with scan_text() and copied in one go; the word
+ * buffer is kept in the conversion context and reused from word to word.
+ */
 
-/* local to getchar stuff */
-static int ungot_char = -1;
-static int ungot_char2 = -1;
-static int ungot_char3 = -1;
+
+#define WORD_BUF_LEN 64
 
 
 /*========================================================================
- * Name:    my_unget_char
- * Purpose:    My own unget routine, handling up to 3 ungot characters.
- * Args:    Character.
+ * Name:    reserve_word_buffer
+ * Purpose:    Makes the word buffer large enough for n characters plus
+ *        the terminating 0. This allows us to remove the limit on
+ *        word length.
+ * Args:    Conversion context, character count.
  * Returns:    None.
  *=======================================================================*/
 
-static void my_unget_char(int ch)
+static void
+reserve_word_buffer(UnrtfContext *ctx, unsigned long n)
 {
-    if (ungot_char >= 0 && ungot_char2 >= 0 && ungot_char3 >= 0)
+    char *new_ptr;
+    unsigned long new_length;
+
+    if (n < ctx->current_max_length)
     {
-        error_handler("More than 3 ungot chars");
+        return;
+    }
+
+    new_length = ctx->current_max_length ? ctx->current_max_length : WORD_BUF_LEN;
+    while (new_length <= n)
+    {
+        new_length *= 2;
+    }
+    new_ptr = my_malloc(new_length);
+    if (!new_ptr)
+    {
+        error_handler("Out of memory while resizing buffer");
     }
 
-    ungot_char3 = ungot_char2;
-    ungot_char2 = ungot_char;
-    ungot_char = ch;
+    if (ctx->input_str)
+    {
+        memcpy(new_ptr, ctx->input_str, ctx->current_max_length);
+        my_free(ctx->input_str);
+    }
+    ctx->input_str = new_ptr;
+    ctx->current_max_length = new_length;
 }
 
 
-static int last_returned_ch = 0;
+/*========================================================================
+ * Name:    next_char
+ * Purpose:    Gets the next input character. Carriage returns are
+ *        dropped and tabs read as spaces.
+ * Args:    Conversion context.
+ * Returns:    Character, or EOF.
+ *=======================================================================*/
 
+static inline int
+next_char(UnrtfContext *ctx)
+{
+    int ch;
 
-#define READ_BUF_LEN 2048
-static int buffer_size = 0;
-static char *read_buf = NULL;
-static int read_buf_end = 0;
-static int read_buf_index = 0;
+    do
+    {
+        if (ctx->in_cur >= ctx->in_end)
+        {
+            return EOF;
+        }
+        ch = (unsigned char) *ctx->in_cur++;
+    }
+    while (ch == '\r');
 
+    if (ch == '\n')
+    {
+        ctx->lineno++;
+    }
+    else if (ch == '\t')
+    {
+        ch = ' ';
+    }
+    return ch;
+}
 
 
+/*========================================================================
+ * Name:    control_symbol
+ * Purpose:    Classifies a control symbol or \'XX word, already in the
+ *        word buffer, like keyword_parse() does.
+ * Args:    Conversion context, number of characters in the word.
+ * Returns:    Number of characters in the word.
+ *=======================================================================*/
+
+static int
+control_symbol(UnrtfContext *ctx, int len)
+{
+    ctx->kw = keyword_parse(ctx->input_str + 1, &ctx->has_param, &ctx->param);
+    return len;
+}
 
 
 /*========================================================================
- * Name:    my_getchar
- * Purpose:    Gets a character: either an ungot one, or a buffered one.
- * Args:    Input file.
- * Returns:    Character, or EOF.
+ * Name:    read_control_word
+ * Purpose:    Reads a control word or control symbol; the backslash has
+ *        already been consumed. The keyword and numeric parameter are
+ *        left in ctx->kw, ctx->has_param and ctx->param.
+ * Args:    Conversion context.
+ * Returns:    Number of characters in the word.
  *=======================================================================*/
 
-static int my_getchar(FILE *f)
+static int
+read_control_word(UnrtfContext *ctx)
 {
-    int ch;
+    const char *mark = ctx->in_cur;
+    int ch, ch2;
+    unsigned long ix;
+    unsigned long name_end = 0;
+    int has_numeric_param = FALSE;
 
-    CHECK_PARAM_NOT_NULL(f);
+    ch2 = next_char(ctx);
 
-    if (ungot_char >= 0)
+    /* Look for two-character command words.
+     */
+    switch (ch2)
     {
-        ch = ungot_char;
-        ungot_char = ungot_char2;
-        ungot_char2 = ungot_char3;
-        ungot_char3 = -1;
-        last_returned_ch = ch;
-        if (ch > 255)
-        {
-            fprintf(stderr, "returning bad ch = '%c' (0%o)\n",
-                    ch, ch);
-        }
-        return ch;
+    case '\n':
+        /* Convert \(newline) into \par here */
+        strcpy(ctx->input_str, "\\par");
+        return control_symbol(ctx, 4);
+    case '~':
+    case '{':
+    case '}':
+    case '\\':
+    case '_':
+    case '-':
+        ctx->input_str[0] = '\\';
+        ctx->input_str[1] = ch2;
+        ctx->input_str[2] = 0;
+        return control_symbol(ctx, 2);
+    case '\'':
+        /* Preserve \'## expressions that read_hex_run() left (not
+         * hexadecimal, or zero) for later.
+         */
+        ctx->input_str[0] = '\\';
+        ctx->input_str[1] = '\'';
+        ctx->input_str[2] = next_char(ctx);
+        ctx->input_str[3] = next_char(ctx);
+        ctx->input_str[4] = 0;
+        ctx->kw = KW_HEX_EXPR;
+        ctx->has_param = FALSE;
+        ctx->param = 0;
+        return 4;
     }
-    do
+
+    ix = 1;
+    ctx->input_str[0] = '\\';
+    ch = ch2;
+
+    while (ch != EOF)
     {
-        if (read_buf_index >= read_buf_end)
+        /* Several chars always end a control word, and we need to
+         * save them. A semicolon also ends it and is saved.
+         */
+        if (ch == '{' || ch == '}' || ch == '\\' || ch == ';')
         {
-            if (!read_buf)
-            {
-                buffer_size = READ_BUF_LEN;
-                read_buf = my_malloc(buffer_size);
-                if (!read_buf)
-                {
-                    buffer_size /= 4;
-                    read_buf = my_malloc(buffer_size);
-                    if (!read_buf)
-                    {
-                        error_handler("Cannot allocate read buffer");
-                    }
-                }
-            }
-            read_buf_end = fread(read_buf, 1, buffer_size, f);
-            read_buf_index = 0;
-            if (!read_buf_end)
-            {
-                return EOF;
-            }
+            ctx->in_cur = mark;
+            break;
         }
-        ch = read_buf [read_buf_index++];
 
-        if (ch == '\n')
+        /* A newline or a space ends a command word; we don't save it.
+         */
+        if (ch == '\n' || ch == ' ')
         {
-            lineno++;
-            /* Convert \(newline) into \par here */
-            if (last_returned_ch == '\\')
-            {
-                my_unget_char(' ');
-                my_unget_char('r');
-                my_unget_char('a');
-                ch = 'p';
-                break;
-            }
+            break;
         }
+
+        /* Identify a control word's numeric parameter.
+         */
+        if (!has_numeric_param && (isdigit(ch) || ch == '-'))
+        {
+            has_numeric_param = TRUE;
+            name_end = ix;
+        }
+        else if (has_numeric_param && !isdigit(ch))
+        {
+            ctx->in_cur = mark;
+            break;
+        }
+
+        reserve_word_buffer(ctx, ix + 1);
+        ctx->input_str[ix++] = ch;
+        mark = ctx->in_cur;
+        ch = next_char(ctx);
     }
-    while (ch == '\r' /* || ch=='\n' */);
 
-    if (ch == '\t')
+    ctx->input_str[ix] = 0;
+
+    ctx->has_param = has_numeric_param;
+    if (has_numeric_param)
     {
-        ch = ' ';
+        ctx->kw = keyword_lookup(ctx->input_str + 1, name_end - 1);
+        ctx->param = atoi(ctx->input_str + name_end);
+    }
+    else
+    {
+        ctx->kw = keyword_lookup(ctx->input_str + 1, ix - 1);
     }
 
-    last_returned_ch = ch;
-    if (ch > 255)
+    /* Binary data is skipped unread */
+    if (ctx->kw == KW_BIN && isdigit((unsigned char) ctx->input_str[4]))
     {
-        fprintf(stderr, "returning bad ch '%c' (0%o)\n", ch, ch);
-        exit(1);
+        unsigned long n = strtoul(ctx->input_str + 4, NULL, 10);
+        if (n > (unsigned long) (ctx->in_end - ctx->in_cur))
+        {
+            n = ctx->in_end - ctx->in_cur;
+        }
+        ctx->in_cur += n;
     }
-    return ch;
+
+    return ix;
 }
 
 
 /*========================================================================
- * Name:    my_skip
- * Purpose:    Skips the given number of characters.
- * Args:    Input file, number of characters.
- * Returns:    None.
+ * Name:    hex_byte
+ * Purpose:    Decodes the \'XX expression at p.
+ * Args:    Position, end of the input.
+ * Returns:    Byte value, or 0 if there is no such expression (or it
+ *        stands for a zero byte).
  *=======================================================================*/
 
-static void my_skip(FILE *f, long n)
+static inline int
+hex_byte(const char *p, const char *end)
 {
-    n += read_buf_index;
-    if (n >= 0 && n < read_buf_end)
+    if (end - p < 4 || p[0] != '\\' || p[1] != '\'' ||
+        !isxdigit((unsigned char) p[2]) || !isxdigit((unsigned char) p[3]))
     {
-        read_buf_index = (int)n;
-        return;
+        return 0;
+    }
+    return h2toi(p + 2);
+}
+
+
+/*========================================================================
+ * Name:    read_hex_run
+ * Purpose:    Reads consecutive \'XX expressions, possibly separated by
+ *        line breaks, as one word: "\'" followed by the bytes they
+ *        stand for. Codepage text is mostly made of them, and the
+ *        renderer hands the whole run to iconv at once.
+ * Args:    Conversion context, position of the first backslash, most
+ *        bytes to read (1 for the fallback of a \u character, which
+ *        the renderer skips as one word).
+ * Returns:    Number of characters in the word, or zero if p is not a
+ *        \'XX expression.
+ *=======================================================================*/
+
+static int
+read_hex_run(UnrtfContext *ctx, const char *p, unsigned long max)
+{
+    const char *end = ctx->in_end;
+    unsigned long ix = 2;
+    int lines = 0;
+    int ch;
+
+    while (ix - 2 < max && (ch = hex_byte(p, end)) != 0)
+    {
+        reserve_word_buffer(ctx, ix + 1);
+        ctx->input_str[ix++] = ch;
+        p += 4;
+        ctx->in_cur = p;
+        ctx->lineno += lines;
+        lines = 0;
+        while (p < end && (*p == '\r' || *p == '\n'))
+        {
+            lines += *p++ == '\n';
+        }
     }
-    read_buf_end = read_buf_index = 0;
-    if (fseek(f, n - read_buf_end, SEEK_CUR))
+    if (ix == 2)
     {
-        error_handler("Cannot seek");
+        return 0;
     }
-    return;
+    ctx->input_str[0] = '\\';
+    ctx->input_str[1] = '\'';
+    ctx->input_str[ix] = 0;
+    ctx->kw = KW_HEX;
+    return ix;
 }
 
-/* local to read_word */
-static char *input_str = NULL;
-static unsigned long current_max_length = 1;
 
+/*========================================================================
+ * Name:    uc_count
+ * Purpose:    Gives the \ucN count of the current group: the length of
+ *        the fallback following each \uN character.
+ * Args:    Conversion context.
+ * Returns:    Pointer to the count.
+ *=======================================================================*/
+
+static inline int *
+uc_count(UnrtfContext *ctx)
+{
+    return &ctx->uc[ctx->group_depth < UC_DEPTHS ? ctx->group_depth : UC_DEPTHS - 1];
+}
 
 
 /*========================================================================
- * Name:    expand_word_buffer
- * Purpose:    Expands the buffer used to store an incoming word.
- *        This allows us to remove the limit on word length.
- * Args:    None.
+ * Name:    skip_fallback
+ * Purpose:    Moves past the fallback of a \uN character: n characters,
+ *        where a \'XX expression or a control word counts as one. A
+ *        brace ends the fallback early.
+ * Args:    Conversion context, fallback length.
  * Returns:    None.
  *=======================================================================*/
 
-static int
-expand_word_buffer()
+static void
+skip_fallback(UnrtfContext *ctx, int n)
 {
-    char *new_ptr;
-    unsigned long old_length;
-    if (!input_str)
-    {
-        error_handler("No input buffer allocated");
-    }
-    old_length = current_max_length;
-    current_max_length *= 2;
-    new_ptr = my_malloc(current_max_length);
-    if (!new_ptr)
+    const char *p = ctx->in_cur;
+    const char *end = ctx->in_end;
+
+    while (n > 0 && p < end && *p != '{' && *p != '}')
     {
-        error_handler("Out of memory while resizing buffer");
+        if (*p == '\r' || *p == '\n')
+        {
+            ctx->lineno += *p++ == '\n';
+            continue;
+        }
+        if (*p == '\\' && end - p > 1)
+        {
+            p++;
+            if (*p == '\'')
+            {
+                p += end - p > 3 ? 3 : end - p;
+            }
+            else if (isalpha((unsigned char) *p))
+            {
+                while (p < end && isalpha((unsigned char) *p))
+                {
+                    p++;
+                }
+                if (p < end && *p == '-')
+                {
+                    p++;
+                }
+                while (p < end && isdigit((unsigned char) *p))
+                {
+                    p++;
+                }
+                if (p < end && (*p == ' ' || *p == '\t' || *p == '\n'))
+                {
+                    ctx->lineno += *p++ == '\n';
+                }
+            }
+            else
+            {
+                ctx->lineno += *p++ == '\n';
+            }
+        }
+        else
+        {
+            p++;
+        }
+        n--;
     }
-
-    memcpy(new_ptr, input_str, old_length);
-    my_free(input_str);
-    input_str = new_ptr;
-    return TRUE;
+    ctx->in_cur = p;
 }
 
 
+/*========================================================================
+ * Name:    unicode_char
+ * Purpose:    Reads the \uN control word at p, as read_control_word()
+ *        would, when it is a character read_unicode_run() can take.
+ * Args:    Conversion context, position, code point (output).
+ * Returns:    Position after the control word, or NULL.
+ *=======================================================================*/
+
+static const char *
+unicode_char(UnrtfContext *ctx, const char *p, long *cp)
+{
+    const char *end = ctx->in_end;
+    const char *digits;
+    int negative;
+
+    if (end - p < 3 || p[0] != '\\' || p[1] != 'u')
+    {
+        return NULL;
+    }
+    p += 2;
+    negative = *p == '-';
+    if (negative)
+    {
+        p++;
+    }
+    *cp = 0;
+    for (digits = p; p < end && isdigit((unsigned char) *p) && p - digits < 7; p++)
+    {
+        *cp = *cp * 10 + (*p - '0');
+    }
+    /* Odd spellings are left to read_control_word() */
+    if (p == digits || (p < end && (isdigit((unsigned char) *p) || *p == '\t' || *p == '\r' || *p == '\n')))
+    {
+        return NULL;
+    }
+    if (negative && *cp > 0)
+    {
+        *cp = 65536 - *cp;
+    }
+    if (*cp <= 0 || *cp >= 0x110000)
+    {
+        return NULL;
+    }
+    return p < end && *p == ' ' ? p + 1 : p;
+}
 
 
 /*========================================================================
- * Name:    read_word
- * Purpose:    The core of the parser, this reads a word.
- * Args:    Input file.
- * Returns:    Number of characters in the word, or zero.
- * Note:    The word buffer is static and local to this file.
+ * Name:    next_unicode_char
+ * Purpose:    Skips the fallback of the \uN character just read, then
+ *        reads the \uN character directly following it, if any.
+ * Args:    Conversion context, code point (output).
+ * Returns:    TRUE if a character was read.
  *=======================================================================*/
 
 static int
-read_word(FILE *f)
+next_unicode_char(UnrtfContext *ctx, long *cp)
 {
-    int ch, ch2;
-    unsigned long ix = 0;
-    int have_whitespace = FALSE;
-    int is_control_word = FALSE;
-    int has_numeric_param = FALSE; /* if is_control_word==TRUE */
-    int need_unget = FALSE;
+    const char *end = ctx->in_end;
+    const char *p, *q;
+    int lines = 0;
 
-    CHECK_PARAM_NOT_NULL(f);
+    skip_fallback(ctx, *uc_count(ctx));
 
-    if (input_str == NULL) 
+    /* Line breaks between the characters are not words */
+    p = ctx->in_cur;
+    while (p < end && (*p == '\r' || *p == '\n'))
     {
-        /* Get some storage for a word.
-         */
-        current_max_length = 10; /* XX */
-        input_str = my_malloc(current_max_length);
-        if (!input_str)
-        {
-            error_handler("Cannot allocate word storage");
-        }
+        lines += *p++ == '\n';
     }
-
-    do
+    if ((q = unicode_char(ctx, p, cp)) == NULL)
     {
-        ch = my_getchar(f);
+        return FALSE;
     }
-    while (ch == '\n');
+    ctx->in_cur = q;
+    ctx->lineno += lines;
+    return TRUE;
+}
 
-    if (ch == ' ')
+
+/*========================================================================
+ * Name:    read_unicode_run
+ * Purpose:    Called after a \uN control word is read. Reads it and the
+ *        \uN characters directly following as one word: "\u" and
+ *        their UTF-8 encoding. Their fallbacks (\ucN) are skipped, so
+ *        the renderer prints the word as it is. Surrogate pairs are
+ *        combined, lone surrogates become U+FFFD.
+ * Args:    Conversion context.
+ * Returns:    Number of characters in the word, or zero if the \uN
+ *        word is not a character (it is then left as it is).
+ *=======================================================================*/
+
+static int
+read_unicode_run(UnrtfContext *ctx)
+{
+    long cp = ctx->param < 0 ? ctx->param + 65536L : ctx->param;
+    long next;
+    unsigned long ix = 2;
+    int more, paired;
+
+    if (cp <= 0 || cp >= 0x110000)
     {
-        /* Compress multiple space chars down to one.
-         */
-        while (ch == ' ')
+        return 0;
+    }
+    more = next_unicode_char(ctx, &next);
+    for (;;)
+    {
+        cp = unicode_from_utf16(cp, more ? next : -1, &paired);
+        if (paired)
         {
-            ch = my_getchar(f);
-            have_whitespace = TRUE;
+            more = next_unicode_char(ctx, &next);
         }
-        if (have_whitespace)
+        reserve_word_buffer(ctx, ix + 4);
+        ix += unicode_to_utf8_buf(cp, ctx->input_str + ix);
+        if (!more)
         {
-            my_unget_char(ch);
-            input_str[0] = ' ';
-            input_str[1] = 0;
-            return 1;
+            break;
         }
+        cp = next;
+        more = next_unicode_char(ctx, &next);
     }
+    ctx->input_str[0] = '\\';
+    ctx->input_str[1] = 'u';
+    ctx->input_str[ix] = 0;
+    ctx->kw = KW_UNICODE;
+    ctx->has_param = FALSE;
+    ctx->param = 0;
+    return ix;
+}
 
-    switch (ch)
-    {
-    case EOF:
-        return 0;
 
-    case '\\':
-        ch2 = my_getchar(f);
+/*========================================================================
+ * Name:    skip_group
+ * Purpose:    Moves past the group starting at p without tokenizing it,
+ *        counting its lines. scan_group() jumps to each backslash or
+ *        brace; escaped braces, \'XX and \bin data are stepped over
+ *        the way read_word() would read them.
+ * Args:    Conversion context, position inside the group.
+ * Returns:    Position of the matching closing brace, or the end of the
+ *        input.
+ *=======================================================================*/
 
-        /* Look for two-character command words.
-         */
-        switch (ch2)
+static const char *
+skip_group(UnrtfContext *ctx, const char *p)
+{
+    const char *end = ctx->in_end;
+    unsigned long lines = 0;
+    int depth = 1;
+
+    while ((p = scan_group(p, end, &lines)) < end)
+    {
+        switch (*p++)
         {
-        case '\n':
-            strcpy(input_str, "\\par");
-            return 4;
-        case '~':
         case '{':
+            depth++;
+            break;
         case '}':
+            if (--depth == 0)
+            {
+                ctx->lineno += lines;
+                return p - 1;
+            }
+            break;
         case '\\':
-        case '_':
-        case '-':
-            input_str[0] = '\\';
-            input_str[1] = ch2;
-            input_str[2] = 0;
-            return 2;
-        case '\'':
-            /* Preserve \'## expressions (hex char exprs) for later.
-             */
-            input_str[0] = '\\';
-            input_str[1] = '\'';
-            ix = 2;
-            if (ix == current_max_length)
+            if (p == end)
             {
-                if (!expand_word_buffer())
-                {
-                    error_handler("Word too long");
-                }
+                break;
+            }
+            if (*p == '\'')
+            {
+                p += end - p > 3 ? 3 : end - p;
             }
-            ch = my_getchar(f);
-            input_str[ix++] = ch;
-            if (ix == current_max_length)
+            else if (end - p > 3 && !memcmp(p, "bin", 3) && isdigit((unsigned char) p[3]))
             {
-                if (!expand_word_buffer())
+                unsigned long n = strtoul(p + 3, (char **) &p, 10);
+                if (p < end && *p == ' ')
                 {
-                    error_handler("Word too long");
+                    p++;
                 }
+                p += n > (unsigned long) (end - p) ? end - p : n;
             }
-            ch = my_getchar(f);
-            input_str[ix++] = ch;
-            if (ix == current_max_length)
+            else if (!isalpha((unsigned char) *p))
             {
-                if (!expand_word_buffer())
+                if (*p == '\n')
                 {
-                    error_handler("Word too long");
+                    lines++;
                 }
+                p++;
             }
-            input_str[ix] = 0;
-            return ix;
+            break;
         }
+    }
+    ctx->lineno += lines;
+    return end;
+}
 
-        is_control_word = TRUE;
-        ix = 1;
-        input_str[0] = ch;
-        ch = ch2;
-        break;
 
-    case '\t':
-        /* In RTF, a tab char is the same as \tab.
-         */
-        strcpy(input_str, "\\tab");
-        return 4;
+/* What read_word() does with a group */
+enum
+{
+    KEEP_GROUP,
+    SKIP_GROUP,     /* left out of the document */
+    SKIP_CONTENTS   /* only its first word is kept */
+};
 
-    case '{':
-    case '}':
-    case ';':
-        input_str[0] = ch;
-        input_str[1] = 0;
-        return 1;
+/*========================================================================
+ * Name:    group_skip
+ * Purpose:    Tells whether the group starting at p is read, from its
+ *        first control word. The groups of the drop set of the context
+ *        (pictures when they are not wanted, see convert_drop_set())
+ *        are left out. Those of the skip sets (see convert_skip_sets())
+ *        render to nothing: they are kept as their first word alone, so
+ *        that the renderer still opens and closes them.
+ * Args:    Conversion context, position after the opening brace.
+ * Returns:    KEEP_GROUP, SKIP_GROUP or SKIP_CONTENTS.
+ *=======================================================================*/
 
-    }
+static int
+group_skip(UnrtfContext *ctx, const char *p)
+{
+    const char *end = ctx->in_end;
+    const KeywordSet *set = &ctx->skip_groups;
+    const char *name;
+    Keyword kw;
 
-    while (ch != EOF)
+    while (p < end && (*p == '\r' || *p == '\n'))
     {
-        /* Several chars always ends a word, and we need to save them.
-         */
-        if (ch == '\t' || ch == '{' || ch == '}' || ch == '\\')
+        p++;
+    }
+    if (end - p >= 2 && p[0] == '\\' && p[1] == '*')
+    {
+        /* {\* is dropped whole by the renderer unless a known
+         * control word follows */
+        set = &ctx->skip_starred;
+        p += 2;
+        while (p < end && (*p == '\r' || *p == '\n'))
         {
-            need_unget = TRUE;
-            break;
+            p++;
         }
+    }
+    if (end - p < 2 || p[0] != '\\' || !isalpha((unsigned char) p[1]))
+    {
+        return KEEP_GROUP;
+    }
+    name = ++p;
+    while (p < end && isalpha((unsigned char) *p))
+    {
+        p++;
+    }
+    kw = keyword_lookup(name, p - name);
+    if (keyword_set_has(&ctx->drop_groups, kw))
+    {
+        return SKIP_GROUP;
+    }
+    return keyword_set_has(set, kw) ? SKIP_CONTENTS : KEEP_GROUP;
+}
 
-        /* A newline always ends a command word; we don't save it.
-         * A newline is ignored if this is not a command word.
-         */
-        if (ch == '\n')
+
+/*========================================================================
+ * Name:    read_word
+ * Purpose:    The core of the parser, this reads a word.
+ * Args:    Conversion context.
+ * Returns:    Number of characters in the word, or zero.
+ * Note:    The word buffer is kept in the conversion context.
+ *=======================================================================*/
+
+static int
+read_word(UnrtfContext *ctx)
+{
+    const char *p = ctx->in_cur;
+    const char *end = ctx->in_end;
+    const char *q;
+    unsigned long ix = 0;
+    int after_u = ctx->kw == KW_U;
+
+    /* Room for any word that is not a control word or plain text */
+    reserve_word_buffer(ctx, 4);
+    ctx->kw = KW_NONE;
+    ctx->has_param = FALSE;
+    ctx->param = 0;
+
+    for (;;)
+    {
+        while (p < end && (*p == '\n' || *p == '\r'))
         {
-            if (is_control_word)
+            if (*p == '\n')
             {
-                break;
+                ctx->lineno++;
             }
-            ch = my_getchar(f);
-            continue;
+            p++;
         }
-
-        /* A semicolon always ends a command word; we do save it.
-         * A semicolon never ends a regular word.
-         */
-        if (ch == ';')
+        if (p == end)
         {
-            if (is_control_word)
-            {
-                need_unget = TRUE;
-                break;
-            }
+            ctx->in_cur = p;
+            return 0;
         }
-
-        /* In this parser, a space character terminates
-         * any word, and if it does not follow a command,
-         * then it is a word in itself.
-         */
-        if (ch == ' ')
+        if (*p != '{')
         {
-            if (!is_control_word)
-            {
-                need_unget = TRUE;
-            }
             break;
         }
+        ctx->skip_contents = group_skip(ctx, p + 1);
+        if (ctx->skip_contents != SKIP_GROUP)
+        {
+            break;
+        }
+        ctx->skip_contents = FALSE;
+        p = skip_group(ctx, p + 1);
+        if (p < end)
+        {
+            p++;
+        }
+    }
 
-        /* Identify a control word's numeric parameter.
+    switch (*p)
+    {
+    case ' ':
+    case '\t':
+        /* Compress multiple space chars down to one.
          */
-        if (is_control_word)
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
         {
-            if (!has_numeric_param && (isdigit(ch) || ch == '-'))
-            {
-                has_numeric_param = TRUE;
-            }
-            else if (has_numeric_param && !isdigit(ch))
-            {
-                if (ch != ' ')
-                {
-                    need_unget = TRUE;
-                }
-                break;
-            }
+            p++;
         }
+        ctx->in_cur = p;
+        ctx->input_str[0] = ' ';
+        ctx->input_str[1] = 0;
+        return 1;
 
-        input_str[ix++] = ch;
-        if (ix == current_max_length)
+    case '\\':
+        if ((ix = read_hex_run(ctx, p, after_u ? 1 : (unsigned long) -1)) > 0)
         {
-            if (!expand_word_buffer())
-            {
-                error_handler("Word too long");
-            }
+            return ix;
         }
-        ch = my_getchar(f);
-    }
+        ctx->in_cur = p + 1;
+        ix = read_control_word(ctx);
+        if (ctx->skip_contents)
+        {
+            ctx->skip_contents = FALSE;
+            ctx->in_cur = skip_group(ctx, ctx->in_cur);
+        }
+        else if (ctx->kw == KW_U && ctx->has_param && ctx->unicode_runs)
+        {
+            int n = read_unicode_run(ctx);
+            return n ? n : ix;
+        }
+        else if (ctx->kw == KW_UC && ctx->has_param)
+        {
+            *uc_count(ctx) = ctx->param > 0 ? ctx->param : 0;
+        }
+        return ix;
 
-    if (need_unget)
-    {
-        my_unget_char(ch);
-    }
+    case '{':
+        /* A group starts with the \ucN count of its parent */
+        ix = *uc_count(ctx);
+        ctx->group_depth++;
+        *uc_count(ctx) = ix;
+        ctx->in_cur = p + 1;
+        ctx->input_str[0] = *p;
+        ctx->input_str[1] = 0;
+        return 1;
 
-    input_str[ix] = 0;
+    case '}':
+        if (ctx->group_depth > 0)
+        {
+            ctx->group_depth--;
+        }
+        /* fall through */
+    case ';':
+        ctx->in_cur = p + 1;
+        ctx->input_str[0] = *p;
+        ctx->input_str[1] = 0;
+        return 1;
+    }
 
-    if (!memcmp(input_str, "\\bin", 4) && isdigit(input_str[4]))
+    /* Plain text: a space, tab, brace or backslash ends the word and is
+     * left for the next one. A newline is ignored.
+     */
+    for (;;)
     {
-        my_skip(f, atoi(input_str + 4));
+        q = scan_text(p, end);
+        reserve_word_buffer(ctx, ix + (q - p));
+        memcpy(ctx->input_str + ix, p, q - p);
+        ix += q - p;
+        p = q;
+        if (p < end && (*p == '\r' || *p == '\n'))
+        {
+            if (*p == '\n')
+            {
+                ctx->lineno++;
+            }
+            p++;
+            continue;
+        }
+        break;
     }
 
+    ctx->in_cur = p;
+    ctx->input_str[ix] = 0;
     return ix;
 }
 
 
 
 /*========================================================================
- * Name:    word_read
+ * Name:    word_read_group
  * Purpose:    This is the recursive metareader which pieces together the
- *            structure of Word objects.
- * Args:    Input file.
+ *            structure of Word objects. It reads up to the end of the
+ *            current group.
+ * Args:    Conversion context.
  * Returns:    Tree of Word objects.
  *=======================================================================*/
 
 Word *
-word_read(FILE *f)
+word_read_group(UnrtfContext *ctx)
 {
     Word *prev_word = NULL;
     Word *first_word = NULL;
     Word *new_word = NULL;  /* temp */
 
-    CHECK_PARAM_NOT_NULL(f);
-
     do
     {
-        if (!read_word(f))
+        if (!read_word(ctx))
         {
             return first_word;
         }
 
-        if (input_str[0] == '{')
+        if (ctx->input_str[0] == '{')
         {
             /* Process subwords */
 
             /* Create a dummy word to point to a sublist */
-            new_word = word_new(NULL);
+            new_word = word_new(ctx, NULL);
             if (!new_word)
             {
                 error_handler("Cannot allocate word");
             }
 
             /* Get the sublist */
-            new_word->child = word_read(f);
+            new_word->child = word_read_group(ctx);
 
         }
-        else if (input_str[0] == '}')
+        else if (ctx->input_str[0] == '}')
         {
             return first_word;
         }
         else
         {
-            new_word = word_new(input_str);
+            new_word = word_new_token(ctx);
         }
 
         if (prev_word)
@@ -515,10 +871,80 @@ word_read(FILE *f)
         }
 
         prev_word = new_word;
-
-        /* Free up the memory allocated by read_word. */
-        my_free(input_str);
-        input_str = NULL;
     }
     while (1);
 }
+
+
+
+/*========================================================================
+ * Name:    word_new_token
+ * Purpose:    Instantiates a Word holding the word just read, with its
+ *            keyword and numeric parameter.
+ * Args:    Conversion context.
+ * Returns:    Word*.
+ *=======================================================================*/
+
+Word *
+word_new_token(UnrtfContext *ctx)
+{
+    Word *w = word_new(ctx, ctx->input_str);
+
+    w->kw = ctx->kw;
+    w->has_param = ctx->has_param;
+    w->param = ctx->param;
+    return w;
+}
+
+
+
+/*========================================================================
+ * Name:    word_read_begin
+ * Purpose:    Sets the document held in memory that word_read_next and
+ *            word_read_group read from.
+ * Args:    Conversion context, document data and length.
+ * Returns:    None.
+ *=======================================================================*/
+
+void
+word_read_begin(UnrtfContext *ctx, const char *data, size_t len)
+{
+    CHECK_PARAM_NOT_NULL(ctx);
+
+    ctx->in_cur = data;
+    ctx->in_end = data + len;
+}
+
+
+
+/*========================================================================
+ * Name:    word_read_next
+ * Purpose:    Reads one word, for callers processing the document as it
+ *            is read. Groups are seen as "{" and "}" words.
+ * Args:    Conversion context.
+ * Returns:    Number of characters in the word (kept in ctx->input_str
+ *            until the next read), or zero at the end of the document.
+ *=======================================================================*/
+
+int
+word_read_next(UnrtfContext *ctx)
+{
+    return read_word(ctx);
+}
+
+
+
+/*========================================================================
+ * Name:    word_read
+ * Purpose:    Parses a document held in memory into a tree of Word
+ *            objects.
+ * Args:    Conversion context, document data and length.
+ * Returns:    Tree of Word objects.
+ *=======================================================================*/
+
+Word *
+word_read(UnrtfContext *ctx, const char *data, size_t len)
+{
+    word_read_begin(ctx, data, len);
+    return word_read_group(ctx);
+}
@@ -39,7 +39,11 @@
 #include "word.h"
 #include <stdio.h>
 
-extern Word *word_read(FILE *);
+extern Word *word_read(UnrtfContext *, const char *, size_t);
+extern void word_read_begin(UnrtfContext *, const char *, size_t);
+extern int word_read_next(UnrtfContext *);
+extern Word *word_new_token(UnrtfContext *);
+extern Word *word_read_group(UnrtfContext *);
 
 
 #endif /* _PARSE_H_INCLUDED_ */
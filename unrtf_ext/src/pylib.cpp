@@ -1,33 +1,327 @@
-#include <python3.5/Python.h>
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <stdio.h>
 
+#include <string>
+#include <vector>
+
 #include "lib.h"
+#include "hash.h"
+#include "error.h"
 
-namespace {
-const size_t MAX_INPUT_LENGTH = 1024 * 1024 * 256;
-}
+/* _unrtf.Error, raised when a document cannot be converted */
+static PyObject * UnrtfError = NULL;
+
+/* RTF input is taken as bytes from any object supporting the buffer
+ * protocol (bytes, bytearray, memoryview, mmap...) and parsed in place,
+ * with its full length. str is still accepted and used UTF-8 encoded. */
 
 static PyObject * unrtf_(PyObject * self, PyObject * args) {
-    char * input;
+    Py_buffer input;
     int nopict_mode;
-    if (!PyArg_ParseTuple(args, "si", &input, &nopict_mode)) {
+    if (!PyArg_ParseTuple(args, "s*i", &input, &nopict_mode)) {
         return NULL;
     }
 
-    FILE * mfd_in = fmemopen(input, strnlen(input, MAX_INPUT_LENGTH), "r");
-    int return_value = unrtf(mfd_in, !!nopict_mode);
+    int return_value;
+    Py_BEGIN_ALLOW_THREADS
+    return_value = unrtf_print((const char *) input.buf, input.len, !!nopict_mode);
     fflush(stdout);
-    fclose(mfd_in);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&input);
 
     return Py_BuildValue("i", return_value);
 }
 
+/* The drop argument: an iterable of destination names (see
+   unrtf_drop_flag()), or None */
+static int parse_drop(PyObject * names, unsigned int * drop) {
+    *drop = 0;
+    if (names == NULL || names == Py_None) {
+        return 0;
+    }
+    if (PyUnicode_Check(names)) {
+        PyErr_SetString(PyExc_TypeError, "drop must be an iterable of destination names");
+        return -1;
+    }
+    PyObject * it = PyObject_GetIter(names);
+    if (it == NULL) {
+        return -1;
+    }
+    PyObject * name;
+    while ((name = PyIter_Next(it)) != NULL) {
+        const char * s = PyUnicode_Check(name) ? PyUnicode_AsUTF8(name) : NULL;
+        unsigned int flag = s ? unrtf_drop_flag(s) : 0;
+        if (flag == 0) {
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_ValueError, "unknown destination %R", name);
+            }
+            Py_DECREF(name);
+            Py_DECREF(it);
+            return -1;
+        }
+        *drop |= flag;
+        Py_DECREF(name);
+    }
+    Py_DECREF(it);
+    return PyErr_Occurred() ? -1 : 0;
+}
+
+static PyObject * convert_(PyObject * Py_UNUSED(self), PyObject * args, PyObject * kwargs) {
+    static const char * keywords[] = { "data", "nopict", "streaming", "drop", NULL };
+    Py_buffer input;
+    int nopict_mode = 1;
+    int streaming = 0;
+    PyObject * drop_names = NULL;
+    unsigned int drop;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s*|ipO", const_cast<char **>(keywords),
+                                     &input, &nopict_mode, &streaming, &drop_names)) {
+        return NULL;
+    }
+    if (parse_drop(drop_names, &drop) < 0) {
+        PyBuffer_Release(&input);
+        return NULL;
+    }
+
+    OutputBuffer out = OUTPUT_BUFFER_CLEAR;
+    /* The conversion only touches its own context, so other threads
+       may convert at the same time */
+    bool failed = false;
+    int lineno = 0;
+    std::string message;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        unrtf_memory((const char *) input.buf, input.len, !!nopict_mode, !!streaming, drop, &out);
+    } catch (ConversionError & e) {
+        failed = true;
+        lineno = e.lineno;
+        message = e.what();
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&input);
+
+    if (failed) {
+        outbuf_free(&out);
+        PyErr_Format(UnrtfError, "line %d: %s", lineno, message.c_str());
+        return NULL;
+    }
+
+    PyObject * result = PyBytes_FromStringAndSize(out.data ? out.data : "", out.len);
+    outbuf_free(&out);
+    return result;
+}
+
+/* State of a convert_stream() call, seen by its sink */
+typedef struct {
+    PyObject * callback;
+    PyObject * error_type;  /* exception raised by the callback */
+    PyObject * error_value;
+    PyObject * error_traceback;
+} StreamState;
+
+/* Runs on the converting thread, without the GIL */
+static int stream_sink(void * arg, const char * data, size_t len) {
+    StreamState * state = (StreamState *) arg;
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject * result = PyObject_CallFunction(state->callback, "y#", data, (Py_ssize_t) len);
+    if (result == NULL) {
+        PyErr_Fetch(&state->error_type, &state->error_value, &state->error_traceback);
+    }
+    Py_XDECREF(result);
+    PyGILState_Release(gil);
+    return result == NULL ? -1 : 0;
+}
+
+static PyObject * convert_stream_(PyObject * Py_UNUSED(self), PyObject * args, PyObject * kwargs) {
+    static const char * keywords[] = { "data", "callback", "chunk_size", "nopict", "streaming", "drop", NULL };
+    Py_buffer input;
+    PyObject * callback;
+    Py_ssize_t chunk_size = 65536;
+    int nopict_mode = 1;
+    int streaming = 0;
+    PyObject * drop_names = NULL;
+    unsigned int drop;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s*O|nipO", const_cast<char **>(keywords),
+                                     &input, &callback, &chunk_size, &nopict_mode, &streaming,
+                                     &drop_names)) {
+        return NULL;
+    }
+    if (parse_drop(drop_names, &drop) < 0) {
+        PyBuffer_Release(&input);
+        return NULL;
+    }
+    if (!PyCallable_Check(callback) || chunk_size <= 0) {
+        PyBuffer_Release(&input);
+        PyErr_SetString(PyExc_ValueError, !PyCallable_Check(callback) ? "callback must be callable"
+                                                                       : "chunk_size must be positive");
+        return NULL;
+    }
+
+    StreamState state = { callback, NULL, NULL, NULL };
+    OutputBuffer out;
+    outbuf_init_sink(&out, stream_sink, &state, chunk_size);
+    bool failed = false;
+    int lineno = 0;
+    std::string message;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        unrtf_memory((const char *) input.buf, input.len, !!nopict_mode, !!streaming, drop, &out);
+    } catch (ConversionError & e) {
+        failed = true;
+        lineno = e.lineno;
+        message = e.what();
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&input);
+    outbuf_free(&out);
+
+    if (state.error_type != NULL) {
+        PyErr_Restore(state.error_type, state.error_value, state.error_traceback);
+        return NULL;
+    }
+    if (failed) {
+        PyErr_Format(UnrtfError, "line %d: %s", lineno, message.c_str());
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * convert_many_(PyObject * Py_UNUSED(self), PyObject * args, PyObject * kwargs) {
+    static const char * keywords[] = { "docs", "threads", "nopict", "streaming", "drop", NULL };
+    PyObject * docs;
+    int threads = 0;
+    int nopict_mode = 1;
+    int streaming = 0;
+    PyObject * drop_names = NULL;
+    unsigned int drop;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iipO", const_cast<char **>(keywords),
+                                     &docs, &threads, &nopict_mode, &streaming, &drop_names)) {
+        return NULL;
+    }
+    if (parse_drop(drop_names, &drop) < 0) {
+        return NULL;
+    }
+
+    PyObject * seq = PySequence_Fast(docs, "docs must be a sequence");
+    if (seq == NULL) {
+        return NULL;
+    }
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    std::vector<UnrtfJob> jobs(count);
+    std::vector<Py_buffer> views(count);
+    Py_ssize_t viewed = 0;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject * doc = PySequence_Fast_GET_ITEM(seq, i);
+        if (PyUnicode_Check(doc)) {
+            Py_ssize_t len;
+            jobs[i].data = PyUnicode_AsUTF8AndSize(doc, &len);
+            jobs[i].len = len;
+            views[i].obj = NULL;
+            if (jobs[i].data == NULL) {
+                break;
+            }
+        } else if (PyObject_GetBuffer(doc, &views[i], PyBUF_SIMPLE) == 0) {
+            jobs[i].data = (const char *) views[i].buf;
+            jobs[i].len = views[i].len;
+        } else {
+            views[i].obj = NULL;
+            break;
+        }
+        viewed = i + 1;
+    }
+
+    /* The documents stay referenced by seq and the views while the
+       pool runs */
+    bool failed = false;
+    std::string message;
+    if (viewed == count) {
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            unrtf_many(jobs.data(), count, threads, !!nopict_mode, !!streaming, drop);
+        } catch (ConversionError & e) {
+            failed = true;
+            message = e.what();
+        }
+        Py_END_ALLOW_THREADS
+    }
+    for (Py_ssize_t i = 0; i < viewed; i++) {
+        if (views[i].obj != NULL) {
+            PyBuffer_Release(&views[i]);
+        }
+    }
+    Py_DECREF(seq);
+    if (viewed != count) {
+        return NULL;
+    }
+    if (failed) {
+        for (Py_ssize_t i = 0; i < count; i++) {
+            outbuf_free(&jobs[i].out);
+        }
+        PyErr_SetString(UnrtfError, message.c_str());
+        return NULL;
+    }
+
+    PyObject * result = PyList_New(count);
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject * item = NULL;
+        if (result != NULL) {
+            if (jobs[i].failed) {
+                item = Py_BuildValue("(ON)", Py_None,
+                                     PyUnicode_FromFormat("line %d: %s", jobs[i].lineno, jobs[i].error));
+            } else {
+                item = Py_BuildValue("(y#O)", jobs[i].out.data ? jobs[i].out.data : "",
+                                     (Py_ssize_t) jobs[i].out.len, Py_None);
+            }
+            if (item == NULL) {
+                Py_CLEAR(result);
+            } else {
+                PyList_SET_ITEM(result, i, item);
+            }
+        }
+        outbuf_free(&jobs[i].out);
+    }
+    return result;
+}
+
+static PyObject * hash_stats_(PyObject * Py_UNUSED(self), PyObject * Py_UNUSED(args)) {
+    HashStats stats;
+    hash_global_stats(&stats);
+    return Py_BuildValue("{sksksksksksk}",
+                         "lookups", stats.lookups,
+                         "stored", stats.stored,
+                         "probes", stats.probes,
+                         "bytes", stats.bytes,
+                         "conversions", stats.conversions,
+                         "max_entries", stats.max_entries);
+}
+
 static PyMethodDef unrtf_methods[] = {
     { "unrtf", (PyCFunction)unrtf_, METH_VARARGS, NULL },
+    { "convert", (PyCFunction)(void (*)(void))convert_, METH_VARARGS | METH_KEYWORDS,
+      "convert(data, nopict=1, streaming=False, drop=None) -> bytes\n\n"
+      "Converts RTF data and returns the rendered output. With streaming the\n"
+      "document is rendered while it is parsed, without building the whole tree.\n"
+      "drop lists destinations left out of the output: header, footer, footnote,\n"
+      "annotation, xe (index entries) and tc (table of contents entries)." },
+    { "convert_stream", (PyCFunction)(void (*)(void))convert_stream_, METH_VARARGS | METH_KEYWORDS,
+      "convert_stream(data, callback, chunk_size=65536, nopict=1, streaming=False,\n"
+      "               drop=None) -> None\n\n"
+      "Converts RTF data, calling callback with the output in bytes chunks of about\n"
+      "chunk_size as it is rendered. An exception raised by callback stops the\n"
+      "conversion and is raised again." },
+    { "convert_many", (PyCFunction)(void (*)(void))convert_many_, METH_VARARGS | METH_KEYWORDS,
+      "convert_many(docs, threads=0, nopict=1, streaming=False, drop=None) -> list\n\n"
+      "Converts a sequence of RTF documents on a pool of threads (0: one per core).\n"
+      "Returns one (output bytes, None) or (None, error message) tuple per document." },
+    { "hash_stats", (PyCFunction)hash_stats_, METH_NOARGS,
+      "hash_stats() -> dict\n\n"
+      "Counters of the string table, summed over every finished conversion:\n"
+      "lookups, stored (distinct strings), probes, bytes, conversions and\n"
+      "max_entries (most strings held by one conversion)." },
     { NULL, NULL, 0, NULL }
 };
 
@@ -43,5 +337,20 @@ static struct PyModuleDef unrtf_module = {
 
 PyMODINIT_FUNC PyInit__unrtf()
 {
-    return PyModule_Create(&unrtf_module);
+    PyObject * m = PyModule_Create(&unrtf_module);
+    if (m == NULL) {
+        return NULL;
+    }
+    UnrtfError = PyErr_NewException("_unrtf.Error", NULL, NULL);
+    if (UnrtfError == NULL || PyModule_AddObject(m, "Error", UnrtfError) < 0) {
+        Py_XDECREF(UnrtfError);
+        Py_DECREF(m);
+        return NULL;
+    }
+    Py_INCREF(UnrtfError);
+#ifdef Py_GIL_DISABLED
+    /* Conversions do not rely on the GIL, see unrtf_to_buffer() */
+    PyUnstable_Module_SetGIL(m, Py_MOD_GIL_NOT_USED);
+#endif
+    return m;
 }
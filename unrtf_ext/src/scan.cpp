@@ -0,0 +1,289 @@
+#include <cstddef>
+
+#include "scan.h"
+
+#ifdef SCAN_HAVE_X86
+#include <immintrin.h>
+#endif
+
+/* 1 for the bytes that end a run of plain text */
+static const unsigned char text_stop[256] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0,  /* \t \n \r */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  /* space */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,  /* \ */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0,  /* { } */
+};
+
+/*========================================================================
+ * Name:    scan_group_scalar
+ * Purpose:    Finds the next backslash or brace, one byte at a time.
+ * Args:    Start and end of the input, newline count (updated).
+ * Returns:    Pointer to the first special byte, or end.
+ *=======================================================================*/
+
+const char *
+scan_group_scalar(const char *p, const char *end, unsigned long *lines)
+{
+    for (; p < end; p++)
+    {
+        switch (*p)
+        {
+        case '\\':
+        case '{':
+        case '}':
+            return p;
+        case '\n':
+            (*lines)++;
+            break;
+        }
+    }
+    return p;
+}
+
+/*========================================================================
+ * Name:    scan_text_scalar
+ * Purpose:    Finds the end of a run of plain text, one byte at a time.
+ * Args:    Start and end of the input.
+ * Returns:    Pointer to the first special byte, or end.
+ *=======================================================================*/
+
+const char *
+scan_text_scalar(const char *p, const char *end)
+{
+    while (p < end && !text_stop[(unsigned char) *p])
+    {
+        p++;
+    }
+    return p;
+}
+
+#ifdef SCAN_HAVE_X86
+
+/*========================================================================
+ * Name:    scan_text_sse2, scan_text_avx2
+ * Purpose:    Same as scan_text_scalar, comparing 16 or 32 bytes at a
+ *             time. The last partial block is left to the scalar loop.
+ * Args:    Start and end of the input.
+ * Returns:    Pointer to the first special byte, or end.
+ *=======================================================================*/
+
+__attribute__((target("sse2")))
+const char *
+scan_text_sse2(const char *p, const char *end)
+{
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i lbrace = _mm_set1_epi8('{');
+    const __m128i rbrace = _mm_set1_epi8('}');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, backslash), _mm_cmpeq_epi8(v, lbrace)),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, rbrace), _mm_cmpeq_epi8(v, space))),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr)),
+                         _mm_cmpeq_epi8(v, lf)));
+        unsigned int mask = _mm_movemask_epi8(hit);
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return scan_text_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+const char *
+scan_text_avx2(const char *p, const char *end)
+{
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i lbrace = _mm256_set1_epi8('{');
+    const __m256i rbrace = _mm256_set1_epi8('}');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, backslash), _mm256_cmpeq_epi8(v, lbrace)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, rbrace), _mm256_cmpeq_epi8(v, space))),
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, cr)),
+                            _mm256_cmpeq_epi8(v, lf)));
+        unsigned int mask = _mm256_movemask_epi8(hit);
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return scan_text_sse2(p, end);
+}
+
+/*========================================================================
+ * Name:    scan_group_sse2, scan_group_avx2
+ * Purpose:    Same as scan_group_scalar, comparing 16 or 32 bytes at a
+ *             time; the newlines of each block are counted from a mask.
+ * Args:    Start and end of the input, newline count (updated).
+ * Returns:    Pointer to the first special byte, or end.
+ *=======================================================================*/
+
+__attribute__((target("sse2")))
+const char *
+scan_group_sse2(const char *p, const char *end, unsigned long *lines)
+{
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i lbrace = _mm_set1_epi8('{');
+    const __m128i rbrace = _mm_set1_epi8('}');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, backslash),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, lbrace), _mm_cmpeq_epi8(v, rbrace)));
+        unsigned int mask = _mm_movemask_epi8(hit);
+        unsigned int newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        if (mask)
+        {
+            *lines += __builtin_popcount(newlines & ((mask & -mask) - 1));
+            return p + __builtin_ctz(mask);
+        }
+        *lines += __builtin_popcount(newlines);
+        p += 16;
+    }
+    return scan_group_scalar(p, end, lines);
+}
+
+__attribute__((target("avx2")))
+const char *
+scan_group_avx2(const char *p, const char *end, unsigned long *lines)
+{
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i lbrace = _mm256_set1_epi8('{');
+    const __m256i rbrace = _mm256_set1_epi8('}');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, backslash),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, lbrace), _mm256_cmpeq_epi8(v, rbrace)));
+        unsigned int mask = _mm256_movemask_epi8(hit);
+        unsigned int newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+        if (mask)
+        {
+            *lines += __builtin_popcount(newlines & ((mask & -mask) - 1));
+            return p + __builtin_ctz(mask);
+        }
+        *lines += __builtin_popcount(newlines);
+        p += 32;
+    }
+    return scan_group_sse2(p, end, lines);
+}
+
+int
+scan_have_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+/* The vector kernels lose to the table loop on short runs (most words
+ * of Latin script text), so a run is only handed over once it is longer
+ * than this. 16 did best of 8, 16, 24 and 32 in bench/scan_bench.cpp. */
+#define SCAN_VECTOR_MIN_RUN 16
+
+/* The kernels are chosen once, when the module is loaded */
+typedef const char *(*ScanKernel)(const char *, const char *);
+typedef const char *(*GroupKernel)(const char *, const char *, unsigned long *);
+
+static ScanKernel
+choose_kernel(const char **name)
+{
+#ifdef SCAN_HAVE_X86
+    if (scan_have_avx2())
+    {
+        *name = "avx2";
+        return scan_text_avx2;
+    }
+    *name = "sse2";
+    return scan_text_sse2;
+#else
+    *name = "scalar";
+    return scan_text_scalar;
+#endif
+}
+
+static GroupKernel
+choose_group_kernel(void)
+{
+#ifdef SCAN_HAVE_X86
+    return scan_have_avx2() ? scan_group_avx2 : scan_group_sse2;
+#else
+    return scan_group_scalar;
+#endif
+}
+
+static const char *kernel_name;
+static const ScanKernel kernel = choose_kernel(&kernel_name);
+static const GroupKernel group_kernel = choose_group_kernel();
+
+/*========================================================================
+ * Name:    scan_text
+ * Purpose:    Finds the end of a run of plain text. Short runs are the
+ *             common case: the first SCAN_VECTOR_MIN_RUN bytes are
+ *             checked inline, and only longer runs reach the vector
+ *             kernel.
+ * Args:    Start and end of the input.
+ * Returns:    Pointer to the first special byte, or end.
+ *=======================================================================*/
+
+const char *
+scan_text(const char *p, const char *end)
+{
+    const char *stop = end - p > SCAN_VECTOR_MIN_RUN ? p + SCAN_VECTOR_MIN_RUN : end;
+
+    while (p < stop)
+    {
+        if (text_stop[(unsigned char) *p])
+        {
+            return p;
+        }
+        p++;
+    }
+    return p < end ? kernel(p, end) : p;
+}
+
+/*========================================================================
+ * Name:    scan_group
+ * Purpose:    Finds the next backslash or brace of a group being skipped.
+ * Args:    Start and end of the input, newline count (updated).
+ * Returns:    Pointer to the first special byte, or end.
+ *=======================================================================*/
+
+const char *
+scan_group(const char *p, const char *end, unsigned long *lines)
+{
+    return group_kernel(p, end, lines);
+}
+
+const char *
+scan_text_kernel_name(void)
+{
+    return kernel_name;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Finding the end of a run of plain text: the next backslash, brace,
+ * space, tab, carriage return or newline. scan_text() hands runs longer
+ * than a few bytes to the widest kernel the CPU supports; the kernels
+ * themselves are exported for unrtf_ext/bench/scan_bench.cpp.
+ */
+
+extern const char *scan_text(const char *p, const char *end);
+extern const char *scan_text_kernel_name(void);
+
+/* Skipping a group: finding the next backslash or brace, counting the
+ * newlines on the way (added to *lines). */
+
+extern const char *scan_group(const char *p, const char *end, unsigned long *lines);
+
+extern const char *scan_text_scalar(const char *p, const char *end);
+extern const char *scan_group_scalar(const char *p, const char *end, unsigned long *lines);
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_HAVE_X86 1
+extern const char *scan_text_sse2(const char *p, const char *end);
+extern const char *scan_text_avx2(const char *p, const char *end);
+extern const char *scan_group_sse2(const char *p, const char *end, unsigned long *lines);
+extern const char *scan_group_avx2(const char *p, const char *end, unsigned long *lines);
+extern int scan_have_avx2(void);
+#endif
@@ -101,6 +101,71 @@ unicode_to_utf8(unsigned int uc)
 	return (char *)string;
 }
 
+/*========================================================================
+ * Name		unicode_to_utf8_buf
+ * Purpose:	Translates unicode number to UTF-8, without allocating
+ * Args:	Unicode number (up to 0x10FFFF), output buffer of at
+ *		least 4 bytes (not null terminated).
+ * Returns:	Number of bytes written, 0 for numbers out of range.
+ *=======================================================================*/
+int
+unicode_to_utf8_buf(unsigned int uc, char *buf)
+{
+	if (uc < 0x80)
+	{
+		buf[0] = (char) uc;
+		return 1;
+	}
+	if (uc < 0x800)
+	{
+		buf[0] = (char) (0xC0 | (uc >> 6));
+		buf[1] = (char) (0x80 | (uc & 0x3F));
+		return 2;
+	}
+	if (uc < 0x10000)
+	{
+		buf[0] = (char) (0xE0 | (uc >> 12));
+		buf[1] = (char) (0x80 | ((uc >> 6) & 0x3F));
+		buf[2] = (char) (0x80 | (uc & 0x3F));
+		return 3;
+	}
+	if (uc < 0x110000)
+	{
+		buf[0] = (char) (0xF0 | (uc >> 18));
+		buf[1] = (char) (0x80 | ((uc >> 12) & 0x3F));
+		buf[2] = (char) (0x80 | ((uc >> 6) & 0x3F));
+		buf[3] = (char) (0x80 | (uc & 0x3F));
+		return 4;
+	}
+	return 0;
+}
+
+/*========================================================================
+ * Name		unicode_from_utf16
+ * Purpose:	Gives the code point of a \uN value, which is a UTF-16 unit.
+ *		A high surrogate is combined with the unit following it when
+ *		that is a low surrogate; any other surrogate is replaced by
+ *		U+FFFD, as it has no UTF-8 encoding.
+ * Args:	Unit, unit following it (-1 for none), flag set when both
+ *		units were used (output).
+ * Returns:	Code point.
+ *=======================================================================*/
+unsigned int
+unicode_from_utf16(unsigned int uc, long next, int *paired)
+{
+	*paired = 0;
+	if (uc < 0xD800 || uc > 0xDFFF)
+	{
+		return uc;
+	}
+	if (uc < 0xDC00 && next >= 0xDC00 && next <= 0xDFFF)
+	{
+		*paired = 1;
+		return 0x10000 + ((uc - 0xD800) << 10) + (next - 0xDC00);
+	}
+	return 0xFFFD;
+}
+
 /*========================================================================
  * Name		get_unicode_int
  * Purpose:	Reads unicode character (in format <UN...N> and translates
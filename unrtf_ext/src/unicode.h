@@ -13,6 +13,11 @@
  *--------------------------------------------------------------------*/
 /* Translate Uxxx or xxx as from charmap file to unicode value as integer */
 extern int get_unicode(char *string);
+/* Translate unicode value to UTF-8 in buf (4 bytes), returns the length */
+extern int unicode_to_utf8_buf(unsigned int uc, char *buf);
+/* Code point of a UTF-16 unit, combined with the next one when they
+   are a surrogate pair; lone surrogates give U+FFFD */
+extern unsigned int unicode_from_utf16(unsigned int uc, long next, int *paired);
 /* Translate charmap line ('<' already read) to unicode or UTF-8 string */
 extern int get_unicode_int(FILE *file);
 extern char *get_unicode_utf8(FILE *file);
@@ -311,6 +311,8 @@ user_init(OutputPersonality *op, char *definitions_file_path)
 		}
 	}
 
+	op_compile_aliases(op);
+	op_compile_templates(op);
 	err = 0;
 out:
 	if (f) {
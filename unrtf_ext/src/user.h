@@ -150,6 +150,7 @@
 	DEFS_ARRAY_ENTRY(chars.nonbreaking_space, op),\
 	DEFS_ARRAY_ENTRY(unisymbol_print, op),\
 	DEFS_ARRAY_ENTRY(utf8_encoding, op),\
+	DEFS_ARRAY_ENTRY(utf8_output, op),\
 	DEFS_ARRAY_ENTRY(fonttable_begin, op),\
 	DEFS_ARRAY_ENTRY(fonttable_end, op),\
 	DEFS_ARRAY_ENTRY(fonttable_fontnr, op),\
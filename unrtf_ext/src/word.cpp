@@ -32,13 +32,11 @@
 #include "parse.h"
 #include "malloc.h"
 #include "main.h"
+#include "outbuf.h"
 #include "error.h"
 #include "word.h"
 #include "hash.h"
-
-
-/* For word_dump */
-static int indent_level = 0;
+#include "context.h"
 
 
 /*========================================================================
@@ -60,77 +58,40 @@ word_string(Word *w)
 
 /*========================================================================
  * Name:	word_new
- * Purpose:	Instantiates a new Word object.
- * Args:	String.
+ * Purpose:	Instantiates a new Word object. Words live in the arena of
+ *		the conversion and are all released with it, in
+ *		context_reset() or context_free().
+ * Args:	Conversion context, string.
  * Returns:	Word*.
  *=======================================================================*/
 
 Word *
-word_new(char *str)
+word_new(UnrtfContext *ctx, char *str)
 {
 	Word *w;
 
-	w = (Word *) my_malloc(sizeof(Word));
-	if (!w)
-	{
-		error_handler("out of memory");
-	}
+	w = (Word *) arena_alloc(&ctx->words, sizeof(Word));
 	memset((void *) w, 0, sizeof(Word));
-	if (!w)
-	{
-		error_handler("cannot allocate a Word");
-	}
 
 	if (str)
 	{
-		w->str = hash_store(str);
+		w->str = hash_store(ctx, str);
 	}
 
 	return w;
 }
 
-/*========================================================================
- * Name:	word_free
- * Purpose:	Deallocates a Word object. This is only called at the end of
- * 			main(), after everything is processed and output complete.
- * Args:	Word.
- * Returns:	None.
- *=======================================================================*/
-
-void word_free(Word *w)
-{
-	Word *prev;
-	Word *w2;
-
-	CHECK_PARAM_NOT_NULL(w);
-
-	while (w)
-	{
-		w2 = w->child;
-		if (w2)
-		{
-			word_free(w2);
-		}
-
-		prev = w;
-		w = w->next;
-		my_free((char *) prev);
-	}
-}
-
-
-
 
 
 /*========================================================================
  * Name:	print_indentation
  * Purpose:	Prints padding for the word_dump routine.
- * Args:	Identation level.
+ * Args:	Conversion context, identation level.
  * Returns:	None.
  *=======================================================================*/
 
 static void
-print_indentation(int level)
+print_indentation(UnrtfContext *ctx, int level)
 {
 	int i;
 
@@ -138,12 +99,12 @@ print_indentation(int level)
 	{
 		for (i = 0; i < level; i += 2)
 		{
-			printf(". ");
+			outbuf_printf(ctx->out, ". ");
 		}
 	}
 	else
 	{
-		printf("\n-----------------------------------------------------------------------\n\n");
+		outbuf_printf(ctx->out, "\n-----------------------------------------------------------------------\n\n");
 	}
 }
 
@@ -153,35 +114,35 @@ print_indentation(int level)
 /*========================================================================
  * Name:	word_dump
  * Purpose:	Recursive diagnostic routine to print out a tree of words.
- * Args:	Word tree.
+ * Args:	Conversion context, word tree.
  * Returns:	None.
  *=======================================================================*/
 
 void
-word_dump(Word *w)
+word_dump(UnrtfContext *ctx, Word *w)
 {
 	const char *s;
 
 	CHECK_PARAM_NOT_NULL(w);
 
-	printf("\n");
-	indent_level += 2;
-	print_indentation(indent_level);
+	outbuf_printf(ctx->out, "\n");
+	ctx->indent_level += 2;
+	print_indentation(ctx, ctx->indent_level);
 
 	while (w)
 	{
 		s = word_string(w);
 		if (s)
 		{
-			printf("\"%s\" ", s);
+			outbuf_printf(ctx->out, "\"%s\" ", s);
 		}
 		else
 		{
 			if (w->child)
 			{
-				word_dump(w->child);
-				printf("\n");
-				print_indentation(indent_level);
+				word_dump(ctx, w->child);
+				outbuf_printf(ctx->out, "\n");
+				print_indentation(ctx, ctx->indent_level);
 			}
 			else
 			{
@@ -191,24 +152,51 @@ word_dump(Word *w)
 		w = w->next;
 	}
 
-	indent_level -= 2;
+	ctx->indent_level -= 2;
 }
 
 /*========================================================================
- * Name:	optimize_word
+ * Name:	optimize_tag
+ * Purpose:	Looks a word up in the list of commands optimize_word can
+ *   eliminate.
+ * Args:	Word.
+ * Returns:	Index in OPT_ARRAY, or -1.
+ *=======================================================================*/
+int
+optimize_tag(const Word *w)
+{
+	static const Tag tags_to_opt[] = OPT_ARRAY;
+	int i;
+
+	if (w->kw == KW_NONE)
+	{
+		return -1;
+	}
+	for (i = 0; tags_to_opt[i].kw != KW_NONE; i++)
+	{
+		if (tags_to_opt[i].kw == w->kw && tags_to_opt[i].has_param == w->has_param)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*========================================================================
+ * Name:	optimize_words
  * Purpose:	Function tries to optimize group by eliminating redundant commands
  *   consecutively setting same attribute to same value.
- * Args:	Word to optimize.
- * Returns:	Optimized word.
+ * Args:	Words of the group, depth, and the attribute values already set
+ *   in the group (NULL if the words start the group).
+ * Returns:	Optimized words.
  *=======================================================================*/
 Word *
-optimize_word(Word *w, int depth)
+optimize_words(Word *w, int depth, Collection **group)
 {
 	const char *s, *s1;
-	int i = 0, len;
-	Collection *c = NULL;
-	Tag tags_to_opt[] = OPT_ARRAY;
-	Word *root = w, *w2 = 0;
+	int i;
+	Collection *c = group ? *group : NULL;
+	Word *root = w, *w2 = 0, *next;
 
 	if (depth > MAX_GROUP_DEPTH)
 	{
@@ -216,54 +204,58 @@ optimize_word(Word *w, int depth)
 		warning_handler("Max group depth reached");
 		return w;
 	}
-	for (; w != NULL; w = w->next)
+	while (w != NULL)
 	{
-
-		if ((s = word_string(w)))
+		if ((s = word_string(w)) && (i = optimize_tag(w)) >= 0)
 		{
-			for (i = 0; tags_to_opt[i].name[0] != '\0'; i++)
-			{
-				if (tags_to_opt[i].has_param)
-				{
-					len = strlen(tags_to_opt[i].name);
-					if (!strncmp(tags_to_opt[i].name, s, len) && (isdigit(s[len]) || s[len] == '-'))
-					{
-						break;
-					}
-				}
-				else if (!strcmp(tags_to_opt[i].name, s))
-				{
-					break;
-				}
-			}
+			s1 = get_from_collection(c, i);
 
-			if (tags_to_opt[i].name[0] != '\0')
+			if (s1 != NULL && !strcmp(s1, s))
 			{
-				s1 = get_from_collection(c, i);
-
-				if (s != NULL && s1 != NULL && !strcmp(s1, s))
+				next = w->next;
+				if (w2)
 				{
-					w2->next = w->next;
-					my_free((char *)w);
-					w = w2;
+					w2->next = next;
 				}
 				else
 				{
-					c = add_to_collection(c, i, s);
+					root = next;
 				}
+				w = next;
+				continue;
 			}
+			c = add_to_collection(c, i, s);
 		}
 
 		if (w->child != NULL)
 		{
-			w->child = optimize_word(w->child, depth + 1);
+			w->child = optimize_words(w->child, depth + 1, NULL);
 		}
 
 		w2 = w;
+		w = w->next;
 	}
 
-	free_collection(c);
+	if (group)
+	{
+		*group = c;
+	}
+	else
+	{
+		free_collection(c);
+	}
 
 	return root;
 }
 
+/*========================================================================
+ * Name:	optimize_word
+ * Purpose:	Optimizes a tree of words, see optimize_words.
+ * Args:	Word to optimize.
+ * Returns:	Optimized word.
+ *=======================================================================*/
+Word *
+optimize_word(Word *w, int depth)
+{
+	return optimize_words(w, depth, NULL);
+}
@@ -38,18 +38,32 @@
 
 #include <stdio.h>
 
+#include "keywords.h"
+
 typedef struct _w
 {
 	const char *str;
 	struct _w *next;
 	struct _w *child;
+	/* Classified by the parser, for control words */
+	unsigned short kw;	/* Keyword, KW_NONE for anything else */
+	char has_param;
+	int param;		/* numeric parameter, if has_param */
 } Word;
 
-extern Word *word_new(char *);
-extern void word_free(Word *);
-extern Word *word_read(FILE *);
+/* w is the control word kw, without a parameter */
+#define WORD_IS(w, k) ((w)->kw == (k) && !(w)->has_param)
+
+typedef struct _unrtf_context UnrtfContext;
+
+extern Word *word_new(UnrtfContext *, char *);
+extern Word *word_read(UnrtfContext *, const char *, size_t);
+extern void word_read_begin(UnrtfContext *, const char *, size_t);
+extern int word_read_next(UnrtfContext *);
+extern Word *word_new_token(UnrtfContext *);
+extern Word *word_read_group(UnrtfContext *);
 extern const char *word_string(Word *);
-extern void word_dump(Word *);
+extern void word_dump(UnrtfContext *, Word *);
 extern void word_print_html(Word *);
 
 #ifndef MAX_GROUP_DEPTH
@@ -57,18 +71,20 @@ extern void word_print_html(Word *);
 #endif
 
 extern Word *optimize_word(Word *, int depth);
+extern Word *optimize_words(Word *, int depth, struct _c **group);
+extern int optimize_tag(const Word *);
 
 typedef struct _t
 {
-	char *name;
+	Keyword kw;
 	int has_param;
 } Tag;
 
 #define OPT_ARRAY \
 {\
-	{"\\fs", 1},\
-	{"\\f", 1},\
-	{"", 0}\
+	{KW_FS, 1},\
+	{KW_F, 1},\
+	{KW_NONE, 0}\
 }
 
 #endif /* _WORD_H_INCLUDED_ */